@@ -0,0 +1,227 @@
+
+///////////////////////////////////////////////////////////////////////////////
+// gfxband.hpp
+//
+// Render and write PNG images in horizontal bands, for outputs too large to
+// hold in memory as a whole hdr_image. Each band is rasterized into a small
+// buffer, converted, and handed to the PNG encoder, so peak memory is set by
+// the band height rather than the image height.
+//
+// This file builds upon gfximage.hpp, gfxpng.hpp, and gfxrasterize.hpp, so
+// you may want to familiarize yourself with those headers before diving into
+// this one.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <png++/png.hpp>
+
+#include "gfximage.hpp"
+#include "gfxpng.hpp"
+#include "gfxrasterize.hpp"
+
+namespace gfx {
+
+// Default number of rows in each band.
+const size_t DEFAULT_BAND_HEIGHT = 256;
+
+namespace detail {
+
+// png++ row generator that renders the image one band at a time.
+//
+// Two band buffers are used in turn: while the encoder pulls the rows of
+// band N from one buffer, band N+1 is rendered into the other on a separate
+// thread.
+template <typename render_type>
+class band_generator
+  : public png::generator<png::rgb_pixel, band_generator<render_type>> {
+private:
+    using base = png::generator<png::rgb_pixel, band_generator<render_type>>;
+
+    size_t width_, height_, band_height_, current_band_;
+    hdr_rgb background_;
+    render_type& render_;
+    hdr_image bands_[2];
+    std::future<void> pending_;
+    std::vector<png::byte> row_;
+
+    size_t band_count() const {
+      return (height_ + band_height_ - 1) / band_height_;
+    }
+
+    // Start rendering band on another thread.
+    void start(size_t band) {
+      size_t y_offset = band * band_height_,
+             rows = std::min(band_height_, height_ - y_offset);
+      hdr_image& buffer = bands_[band % 2];
+      pending_ = std::async(std::launch::async,
+                            [this, &buffer, y_offset, rows]() {
+                              buffer.resize(width_, rows, background_);
+                              buffer.fill(background_);
+                              render_(buffer, y_offset);
+                            });
+    }
+
+public:
+  band_generator(size_t width,
+                 size_t height,
+                 size_t band_height,
+                 const hdr_rgb& background,
+                 render_type& render)
+  : base(width, height),
+    width_(width),
+    height_(height),
+    band_height_(band_height),
+    current_band_(SIZE_MAX),
+    background_(background),
+    render_(render),
+    row_(width * 3) {
+    start(0);
+  }
+
+  // Return the bytes of row y; called by png::generator for each row in
+  // order.
+  png::byte* get_next_row(size_t y) {
+    size_t band = y / band_height_;
+    if (band != current_band_) {
+      // rethrows any exception from the render function
+      pending_.get();
+      current_band_ = band;
+      if ((band + 1) < band_count()) {
+        start(band + 1);
+      }
+    }
+
+    const hdr_image& buffer = bands_[band % 2];
+    size_t band_y = y - (band * band_height_);
+    for (size_t x = 0; x < width_; ++x) {
+      auto& hdr_pixel = buffer.pixel(x, band_y);
+      row_[(3 * x) + 0] = hdr_to_byte(hdr_pixel.r());
+      row_[(3 * x) + 1] = hdr_to_byte(hdr_pixel.g());
+      row_[(3 * x) + 2] = hdr_to_byte(hdr_pixel.b());
+    }
+    return row_.data();
+  }
+};
+
+} // namespace detail
+
+// Render an image of the given dimensions band by band, and write it to a
+// PNG file at the given path.
+//
+// render is called once for each band, in order from the top, as
+// render(band, y_offset). band is an hdr_image of width pixels and at most
+// band_height rows, already filled with background, and pixel (x, y) of band
+// is pixel (x, y_offset + y) of the whole image. Rendering the next band
+// overlaps with encoding the previous one, so render is called on a separate
+// thread, though never concurrently with itself.
+//
+// width, height, and band_height must be positive.
+//
+// Returns true on success, and false on I/O error, or when render throws an
+// exception.
+template <typename render_type>
+bool write_png_banded(const std::string& path,
+                      size_t width,
+                      size_t height,
+                      render_type render,
+                      const hdr_rgb& background = BLACK,
+                      size_t band_height = DEFAULT_BAND_HEIGHT) {
+  assert(width > 0);
+  assert(height > 0);
+  assert(band_height > 0);
+
+  try {
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+      return false;
+    }
+
+    detail::band_generator<render_type> generator(width, height, band_height,
+                                                  background, render);
+    generator.write(file);
+
+    file.close();
+    return !file.fail();
+
+  } catch (const std::exception& error) {
+    return false;
+  }
+}
+
+// Draw every segment in segments with color, on a background of the given
+// dimensions, and write the result to a PNG file at the given path, one
+// band at a time as in write_png_banded.
+//
+// Segments are first binned by the bands they overlap, so each band draws
+// only its own segments, and steps each one only through its rows of the
+// band. The pixels are identical to calling rasterize_line_segments on a
+// whole image.
+//
+// width, height, and band_height must be positive, and every endpoint must
+// be a valid coordinate in the image.
+//
+// Returns true on success and false on I/O error.
+bool write_png_banded_segments(const std::string& path,
+                               size_t width,
+                               size_t height,
+                               const std::vector<line_segment>& segments,
+                               const hdr_rgb& color,
+                               const hdr_rgb& background = BLACK,
+                               size_t band_height = DEFAULT_BAND_HEIGHT) {
+  assert(band_height > 0);
+
+  // counting sort of segment indices into per-band lists; the segments of
+  // band b are binned[starts[b]] through binned[starts[b + 1] - 1]
+  size_t band_count = (height + band_height - 1) / band_height;
+  std::vector<size_t> starts(band_count + 1, 0);
+  for (auto& segment : segments) {
+    assert((segment.x0 < width) && (segment.y0 < height));
+    assert((segment.x1 < width) && (segment.y1 < height));
+    size_t first = std::min(segment.y0, segment.y1) / band_height,
+           last = std::max(segment.y0, segment.y1) / band_height;
+    for (size_t band = first; band <= last; ++band) {
+      ++starts[band + 1];
+    }
+  }
+  std::partial_sum(starts.begin(), starts.end(), starts.begin());
+
+  std::vector<size_t> binned(starts.back()),
+                      next(starts.begin(), starts.end() - 1);
+  for (size_t i = 0; i < segments.size(); ++i) {
+    auto& segment = segments[i];
+    size_t first = std::min(segment.y0, segment.y1) / band_height,
+           last = std::max(segment.y0, segment.y1) / band_height;
+    for (size_t band = first; band <= last; ++band) {
+      binned[next[band]++] = i;
+    }
+  }
+
+  // each segment steps only through its pixels inside the band
+  auto render = [&](hdr_image& band, size_t y_offset) {
+    size_t index = y_offset / band_height;
+    int dy = -int(y_offset);
+    raster_rect bounds = image_rect(band);
+    for (size_t i = starts[index]; i < starts[index + 1]; ++i) {
+      auto& segment = segments[binned[i]];
+      detail::step_line_clipped(int(segment.x0), int(segment.y0) + dy,
+                                int(segment.x1), int(segment.y1) + dy,
+                                bounds, [&](int x, int y) {
+                                  band.pixel(x, y, color);
+                                });
+    }
+  };
+  return write_png_banded(path, width, height, render, background,
+                          band_height);
+}
+
+} // namespace gfx
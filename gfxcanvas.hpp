@@ -0,0 +1,381 @@
+
+///////////////////////////////////////////////////////////////////////////////
+// gfxcanvas.hpp
+//
+// A stateful drawing canvas over an hdr_image.
+//
+// A canvas holds the current color, an affine transform, a clip rectangle,
+// and a blend mode, so callers draw in their own coordinates instead of
+// transforming and clipping every primitive themselves. Line segments are
+// queued, and drawn in batches: the endpoints of a whole batch are
+// transformed together with transform_points, and each segment is clipped
+// once, rather than once per pixel.
+//
+// This file builds upon gfximage.hpp, gfxrasterize.hpp, and
+// gfxtransform.hpp, so you may want to familiarize yourself with those
+// headers before diving into this one.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "gfximage.hpp"
+#include "gfxrasterize.hpp"
+#include "gfxtransform.hpp"
+
+namespace gfx {
+
+// How a drawn color is combined with the color already in the image. Every
+// mode works per channel, with destination d and source s:
+//
+// replace:  s
+// add:      min(d + s, 1)
+// multiply: d * s
+// screen:   1 - (1 - d) * (1 - s)
+// darken:   min(d, s)
+// lighten:  max(d, s)
+enum class blend_mode {
+  replace,
+  add,
+  multiply,
+  screen,
+  darken,
+  lighten
+};
+
+// Return the result of drawing source over destination with mode.
+hdr_rgb blend_colors(const hdr_rgb& destination,
+                     const hdr_rgb& source,
+                     blend_mode mode) {
+  auto channel = [mode](hdr_intensity d, hdr_intensity s) {
+    switch (mode) {
+    case blend_mode::replace:  return s;
+    case blend_mode::add:      return std::min(d + s, 1.0f);
+    case blend_mode::multiply: return d * s;
+    case blend_mode::screen:   return 1.0f - ((1.0f - d) * (1.0f - s));
+    case blend_mode::darken:   return std::min(d, s);
+    case blend_mode::lighten:  return std::max(d, s);
+    }
+    return s;
+  };
+  return hdr_rgb(channel(destination.r(), source.r()),
+                 channel(destination.g(), source.g()),
+                 channel(destination.b(), source.b()));
+}
+
+// An adapter that draws into an hdr_image through a blend mode. It has the
+// image interface of hdr_image, so every primitive of gfxrasterize.hpp can
+// target it; each pixel write becomes a read, a blend, and a write.
+class blended_image {
+private:
+    hdr_image& target_;
+    blend_mode mode_;
+
+public:
+  blended_image(hdr_image& target, blend_mode mode)
+  : target_(target), mode_(mode) { }
+
+  // Blend new_value into every pixel (x, y) with x in [x_begin, x_end).
+  void fill_span(size_t x_begin, size_t x_end, size_t y,
+                 const hdr_rgb& new_value) {
+    for (size_t x = x_begin; x < x_end; ++x) {
+      pixel(x, y, new_value);
+    }
+  }
+
+  size_t height() const { return target_.height(); }
+  bool is_empty() const { return target_.is_empty(); }
+  bool is_x(size_t x) const { return target_.is_x(x); }
+  bool is_y(size_t y) const { return target_.is_y(y); }
+  bool is_xy(size_t x, size_t y) const { return target_.is_xy(x, y); }
+
+  // Return the pixel color at (x, y).
+  const hdr_rgb& pixel(size_t x, size_t y) const {
+    return target_.pixel(x, y);
+  }
+
+  // Blend new_value into the pixel at (x, y).
+  void pixel(size_t x, size_t y, const hdr_rgb& new_value) {
+    target_.pixel(x, y, blend_colors(target_.pixel(x, y), new_value, mode_));
+  }
+
+  size_t width() const { return target_.width(); }
+};
+
+// A drawing canvas over an hdr_image, which must outlive it.
+//
+// Coordinates passed to primitives are transformed by the current transform,
+// and rounded to the nearest pixel center. Pixels outside the clip
+// rectangle are never written.
+//
+// Line segments are queued, and drawn when the queue is flushed: by flush(),
+// by any change of state, by any other primitive, and on destruction. So
+// the target image may not show queued segments until then.
+class canvas {
+private:
+
+    struct drawing_state {
+      hdr_rgb color;
+      affine_transform transform;
+      raster_rect clip;
+      blend_mode blend;
+    };
+
+    hdr_image& target_;
+    drawing_state state_;
+    std::vector<drawing_state> saved_;
+
+    // queued segments in user coordinates, as a structure of arrays, and
+    // scratch space for their transformed endpoints
+    std::vector<float> x0_, y0_, x1_, y1_;
+    std::vector<int> pixel_x0_, pixel_y0_, pixel_x1_, pixel_y1_;
+
+    // Points round to the nearest pixel, ties up, and are clamped far
+    // outside any image.
+    static quantize_options pixel_options() {
+      quantize_options options;
+      options.rounding = rounding_mode::nearest_up;
+      return options;
+    }
+
+    raster_point to_pixel(const curve_point& p) const {
+      float x = float(p.x), y = float(p.y);
+      raster_point result;
+      transform_points(state_.transform, &x, &y, 1, &result.x, &result.y,
+                       pixel_options());
+      return result;
+    }
+
+    // Transform the endpoints of every queued segment, one batch of
+    // endpoints at a time.
+    void transform_queue() {
+      size_t count = x0_.size();
+      pixel_x0_.resize(count);
+      pixel_y0_.resize(count);
+      pixel_x1_.resize(count);
+      pixel_y1_.resize(count);
+      transform_points(state_.transform, x0_.data(), y0_.data(), count,
+                       pixel_x0_.data(), pixel_y0_.data(), pixel_options());
+      transform_points(state_.transform, x1_.data(), y1_.data(), count,
+                       pixel_x1_.data(), pixel_y1_.data(), pixel_options());
+    }
+
+    // Draw the transformed queue into target. A segment entirely outside
+    // the clip rectangle is skipped, and one entirely inside is drawn
+    // whole; the rest step only through their range of steps inside the
+    // rectangle. No segment tests its pixels one by one.
+    template <typename image_type>
+    void draw_queue(image_type& target) {
+      const raster_rect& clip = state_.clip;
+      for (size_t i = 0; i < pixel_x0_.size(); ++i) {
+        int x0 = pixel_x0_[i], y0 = pixel_y0_[i],
+            x1 = pixel_x1_[i], y1 = pixel_y1_[i];
+        raster_rect bounds{std::min(x0, x1), std::min(y0, y1),
+                           std::max(x0, x1) + 1, std::max(y0, y1) + 1};
+        if (!bounds.intersects(clip)) {
+          continue;
+        }
+        if (clip.contains(bounds)) {
+          detail::step_line(x0, y0, x1, y1, [&](int x, int y) {
+              target.pixel(x, y, state_.color);
+            });
+        } else {
+          detail::step_line_clipped(x0, y0, x1, y1, clip, [&](int x, int y) {
+              target.pixel(x, y, state_.color);
+            });
+        }
+      }
+    }
+
+    // Draw with the current blend mode, through an adapter unless the mode
+    // is replace.
+    template <typename draw_type>
+    void with_blended_target(draw_type draw) {
+      if (state_.blend == blend_mode::replace) {
+        draw(target_);
+      } else {
+        blended_image blended(target_, state_.blend);
+        draw(blended);
+      }
+    }
+
+public:
+
+  // Create a canvas drawing into target, which must be non-empty, with
+  // color WHITE, the identity transform, no clipping beyond the image
+  // bounds, and blend mode replace.
+  explicit canvas(hdr_image& target)
+  : target_(target),
+    state_{WHITE, affine_transform::identity(), image_rect(target),
+           blend_mode::replace} {
+    assert(!target.is_empty());
+  }
+
+  canvas(const canvas&) = delete;
+  canvas& operator=(const canvas&) = delete;
+
+  ~canvas() { flush(); }
+
+  // Return the current blend mode.
+  blend_mode blend() const { return state_.blend; }
+
+  // Return the current clip rectangle, which is always within the image.
+  const raster_rect& clip() const { return state_.clip; }
+
+  // Return the current color.
+  const hdr_rgb& color() const { return state_.color; }
+
+  // Change the transform to the composition that applies transform first,
+  // then the current transform.
+  void concat(const affine_transform& transform) {
+    set_transform(state_.transform * transform);
+  }
+
+  // Fill the polygon with vertices in user coordinates, with the current
+  // color, as fill_polygon does.
+  void fill_polygon(const std::vector<curve_point>& vertices,
+                    fill_rule rule = fill_rule::even_odd) {
+    flush();
+    std::vector<raster_point> points;
+    points.reserve(vertices.size());
+    for (auto& vertex : vertices) {
+      points.push_back(to_pixel(vertex));
+    }
+    with_blended_target([&](auto& target) {
+        gfx::fill_polygon(target, points, state_.color, rule, state_.clip);
+      });
+  }
+
+  // Fill the rectangle with corner (x, y) and the given width and height,
+  // in user coordinates, with the current color. Under an axis-aligned
+  // transform, this is a rectangle fill; otherwise it is a polygon fill of
+  // the transformed corners.
+  void fill_rect(float x, float y, float width, float height) {
+    std::vector<curve_point> corners{{x, y},
+                                     {x + width, y},
+                                     {x + width, y + height},
+                                     {x, y + height}};
+    if (!state_.transform.is_axis_aligned()) {
+      fill_polygon(corners);
+      return;
+    }
+    flush();
+    raster_point a = to_pixel(corners[0]), b = to_pixel(corners[2]);
+    raster_rect rect{std::min(a.x, b.x), std::min(a.y, b.y),
+                     std::max(a.x, b.x), std::max(a.y, b.y)};
+    with_blended_target([&](auto& target) {
+        gfx::fill_rect(target, rect, state_.color, state_.clip);
+      });
+  }
+
+  // Draw every queued line segment now.
+  void flush() {
+    if (x0_.empty()) {
+      return;
+    }
+    transform_queue();
+    with_blended_target([&](auto& target) { draw_queue(target); });
+    x0_.clear();
+    y0_.clear();
+    x1_.clear();
+    y1_.clear();
+  }
+
+  // Queue a line segment from (x0, y0) to (x1, y1), in user coordinates,
+  // with the current color.
+  void line(float x0, float y0, float x1, float y1) {
+    x0_.push_back(x0);
+    y0_.push_back(y0);
+    x1_.push_back(x1);
+    y1_.push_back(y1);
+  }
+
+  // Return the number of queued line segments.
+  size_t queued() const { return x0_.size(); }
+
+  // Draw a connected sequence of line segments through points, in user
+  // coordinates, with the current color, as rasterize_polyline does.
+  void polyline(const std::vector<curve_point>& points) {
+    flush();
+    std::vector<raster_point> pixels;
+    pixels.reserve(points.size());
+    for (auto& point : points) {
+      pixels.push_back(to_pixel(point));
+    }
+    with_blended_target([&](auto& target) {
+        rasterize_polyline(target, pixels, state_.color, state_.clip);
+      });
+  }
+
+  // Restore the state saved by the matching call to save(). There must be
+  // one.
+  void restore() {
+    assert(!saved_.empty());
+    flush();
+    state_ = saved_.back();
+    saved_.pop_back();
+  }
+
+  // Change the clip rectangle back to the whole image.
+  void reset_clip() { set_clip(image_rect(target_)); }
+
+  // Change the transform by rotating by radians first.
+  void rotate(float radians) {
+    concat(affine_transform::rotation(radians));
+  }
+
+  // Save the current color, transform, clip rectangle, and blend mode, to
+  // be restored by restore().
+  void save() { saved_.push_back(state_); }
+
+  // Change the transform by scaling by sx and sy first.
+  void scale(float sx, float sy) {
+    concat(affine_transform::scaling(sx, sy));
+  }
+
+  // Change the blend mode.
+  void set_blend(blend_mode mode) {
+    if (mode != state_.blend) {
+      flush();
+      state_.blend = mode;
+    }
+  }
+
+  // Change the clip rectangle, in pixels, to its intersection with the
+  // image bounds.
+  void set_clip(const raster_rect& clip) {
+    flush();
+    state_.clip = clip.intersection(image_rect(target_));
+  }
+
+  // Change the current color.
+  void set_color(const hdr_rgb& color) {
+    if (!(color == state_.color)) {
+      flush();
+      state_.color = color;
+    }
+  }
+
+  // Change the transform.
+  void set_transform(const affine_transform& transform) {
+    flush();
+    state_.transform = transform;
+  }
+
+  // Return the target image.
+  hdr_image& target() { return target_; }
+
+  // Return the current transform.
+  const affine_transform& transform() const { return state_.transform; }
+
+  // Change the transform by translating by (dx, dy) first.
+  void translate(float dx, float dy) {
+    concat(affine_transform::translation(dx, dy));
+  }
+};
+
+} // namespace gfx
@@ -0,0 +1,659 @@
+
+///////////////////////////////////////////////////////////////////////////////
+// gfxcodec.hpp
+//
+// Fast lossless image codecs for intermediate files: QOI and binary PPM.
+//
+// PNG spends most of its time in deflate. QOI ("Quite OK Image", see
+// https://qoiformat.org) compresses with a handful of byte-aligned run,
+// index, and delta chunks instead, so it encodes and decodes many times
+// faster than PNG at a moderately larger size. Binary PPM (P6) is not
+// compressed at all, and costs little more than a copy.
+//
+// Both formats store 8-bit RGB pixels, with the same quantization as
+// write_png, so every codec here accepts either an hdr_image or an
+// rgb8_image, and decodes into either one. PPM files with 16-bit samples are
+// also supported, for hdr_image pixels that need more precision.
+//
+// Images are encoded and decoded one row at a time, through a single row
+// buffer, so an hdr_image is never converted as a whole.
+//
+// This file builds upon gfximage.hpp and gfxfile.hpp, so you may want to
+// familiarize yourself with those headers before diving into this one.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "gfxfile.hpp"
+#include "gfximage.hpp"
+
+namespace gfx {
+
+// An image of 8-bit RGB pixels. Each row is stored as consecutive R, G, B
+// bytes, left to right, and rows are stored top to bottom; this is the pixel
+// layout of QOI and PPM files.
+class rgb8_image {
+private:
+
+    size_t width_ = 0, height_ = 0;
+    std::vector<uint8_t> bytes_;
+
+public:
+
+  // Create an empty image.
+  rgb8_image() {
+    assert(is_empty());
+  }
+
+  // Create an image with the given dimensions, both positive, with every
+  // pixel black.
+  rgb8_image(size_t width, size_t height)
+  : width_(width),
+    height_(height),
+    bytes_(width * height * 3) {
+    assert(width > 0);
+    assert(height > 0);
+    assert(!is_empty());
+  }
+
+  // Convert image, which must be non-empty, with hdr_to_byte, as write_png
+  // does.
+  explicit rgb8_image(const hdr_image& image)
+  : rgb8_image(image.width(), image.height()) {
+    for (size_t y = 0; y < height_; ++y) {
+      uint8_t* bytes = row(y);
+      for (size_t x = 0; x < width_; ++x) {
+        auto& color = image.pixel(x, y);
+        bytes[(3 * x) + 0] = hdr_to_byte(color.r());
+        bytes[(3 * x) + 1] = hdr_to_byte(color.g());
+        bytes[(3 * x) + 2] = hdr_to_byte(color.b());
+      }
+    }
+  }
+
+  bool operator==(const rgb8_image& rhs) const {
+    return (width_ == rhs.width_) && (height_ == rhs.height_)
+           && (bytes_ == rhs.bytes_);
+  }
+
+  // Return the height of the image. An empty image has height zero.
+  size_t height() const { return height_; }
+
+  // Return true iff the image is empty.
+  bool is_empty() const { return width_ == 0; }
+
+  // Return the 3 * width() bytes of row y, which must be a valid row.
+  const uint8_t* row(size_t y) const {
+    assert(y < height_);
+    return &bytes_[y * width_ * 3];
+  }
+  uint8_t* row(size_t y) {
+    assert(y < height_);
+    return &bytes_[y * width_ * 3];
+  }
+
+  // Convert this image, which must be non-empty, to an hdr_image with
+  // byte_to_hdr, as read_png does.
+  hdr_image to_hdr() const {
+    assert(!is_empty());
+    hdr_image result(width_, height_, BLACK);
+    for (size_t y = 0; y < height_; ++y) {
+      const uint8_t* bytes = row(y);
+      for (size_t x = 0; x < width_; ++x) {
+        result.pixel(x, y, hdr_rgb::from_bytes(bytes[(3 * x) + 0],
+                                               bytes[(3 * x) + 1],
+                                               bytes[(3 * x) + 2]));
+      }
+    }
+    return result;
+  }
+
+  // Return the width of the image. An empty image has width zero.
+  size_t width() const { return width_; }
+};
+
+namespace detail {
+
+// Return the bytes of row y of image, converting into buffer if necessary.
+const uint8_t* rgb8_row(const rgb8_image& image, size_t y,
+                        std::vector<uint8_t>&) {
+  return image.row(y);
+}
+
+const uint8_t* rgb8_row(const hdr_image& image, size_t y,
+                        std::vector<uint8_t>& buffer) {
+  buffer.resize(image.width() * 3);
+  for (size_t x = 0; x < image.width(); ++x) {
+    auto& color = image.pixel(x, y);
+    buffer[(3 * x) + 0] = hdr_to_byte(color.r());
+    buffer[(3 * x) + 1] = hdr_to_byte(color.g());
+    buffer[(3 * x) + 2] = hdr_to_byte(color.b());
+  }
+  return buffer.data();
+}
+
+// Create the decoded image of a codec. image_type is hdr_image or
+// rgb8_image.
+template <typename image_type>
+image_type make_decoded_image(size_t width, size_t height) {
+  if constexpr (std::is_same<image_type, hdr_image>::value) {
+    return hdr_image(width, height, BLACK);
+  } else {
+    return rgb8_image(width, height);
+  }
+}
+
+// Store the 8-bit bytes of row y of image.
+void store_rgb8_row(rgb8_image& image, size_t y, const uint8_t* bytes) {
+  std::memcpy(image.row(y), bytes, image.width() * 3);
+}
+
+void store_rgb8_row(hdr_image& image, size_t y, const uint8_t* bytes) {
+  for (size_t x = 0; x < image.width(); ++x) {
+    image.pixel(x, y, hdr_rgb::from_bytes(bytes[(3 * x) + 0],
+                                          bytes[(3 * x) + 1],
+                                          bytes[(3 * x) + 2]));
+  }
+}
+
+} // namespace detail
+
+///////////////////////////////////////////////////////////////////////////////
+// QOI
+///////////////////////////////////////////////////////////////////////////////
+
+namespace detail {
+
+// QOI chunk tags; the 2-bit tags are in the top two bits of the first byte.
+const uint8_t QOI_OP_INDEX = 0x00,
+              QOI_OP_DIFF = 0x40,
+              QOI_OP_LUMA = 0x80,
+              QOI_OP_RUN = 0xc0,
+              QOI_OP_RGB = 0xfe,
+              QOI_OP_RGBA = 0xff,
+              QOI_MASK_2 = 0xc0;
+
+const size_t QOI_HEADER_BYTES = 14;
+
+// Every QOI file ends with these bytes.
+const uint8_t QOI_PADDING[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+// Longest run of one chunk.
+const unsigned QOI_MAX_RUN = 62;
+
+struct qoi_rgba {
+  uint8_t r = 0, g = 0, b = 0, a = 255;
+
+  bool operator==(const qoi_rgba& rhs) const {
+    return (r == rhs.r) && (g == rhs.g) && (b == rhs.b) && (a == rhs.a);
+  }
+
+  unsigned hash() const {
+    return ((r * 3) + (g * 5) + (b * 7) + (a * 11)) % 64;
+  }
+};
+
+void store_big_endian_32(uint8_t* bytes, uint32_t value) {
+  bytes[0] = uint8_t(value >> 24);
+  bytes[1] = uint8_t(value >> 16);
+  bytes[2] = uint8_t(value >> 8);
+  bytes[3] = uint8_t(value);
+}
+
+uint32_t load_big_endian_32(const uint8_t* bytes) {
+  return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16)
+         | (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
+}
+
+// Encoder state, which carries over from one row to the next, since QOI
+// treats the image as one stream of pixels.
+class qoi_encoder {
+private:
+
+    uint8_t* out_;
+    qoi_rgba previous_;
+    std::array<qoi_rgba, 64> index_;
+    unsigned run_ = 0;
+
+public:
+
+  // Write chunks starting at out, which must have room for 4 bytes per
+  // pixel.
+  explicit qoi_encoder(uint8_t* out)
+  : out_(out) {
+    index_.fill(qoi_rgba{0, 0, 0, 0});
+  }
+
+  // Encode a row of width pixels of R, G, B bytes.
+  void encode_row(const uint8_t* rgb, size_t width) {
+    for (size_t x = 0; x < width; ++x, rgb += 3) {
+      qoi_rgba pixel{rgb[0], rgb[1], rgb[2], 255};
+      if (pixel == previous_) {
+        if (++run_ == QOI_MAX_RUN) {
+          *out_++ = QOI_OP_RUN | (run_ - 1);
+          run_ = 0;
+        }
+        continue;
+      }
+      if (run_ > 0) {
+        *out_++ = QOI_OP_RUN | (run_ - 1);
+        run_ = 0;
+      }
+
+      unsigned slot = pixel.hash();
+      if (index_[slot] == pixel) {
+        *out_++ = QOI_OP_INDEX | slot;
+      } else {
+        index_[slot] = pixel;
+        // differences wrap around, as in the reference encoder
+        int dr = int8_t(pixel.r - previous_.r),
+            dg = int8_t(pixel.g - previous_.g),
+            db = int8_t(pixel.b - previous_.b),
+            dr_dg = dr - dg,
+            db_dg = db - dg;
+        if ((dr >= -2) && (dr <= 1) && (dg >= -2) && (dg <= 1)
+            && (db >= -2) && (db <= 1)) {
+          *out_++ = QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2)
+                    | (db + 2);
+        } else if ((dg >= -32) && (dg <= 31) && (dr_dg >= -8) && (dr_dg <= 7)
+                   && (db_dg >= -8) && (db_dg <= 7)) {
+          *out_++ = QOI_OP_LUMA | (dg + 32);
+          *out_++ = uint8_t(((dr_dg + 8) << 4) | (db_dg + 8));
+        } else {
+          *out_++ = QOI_OP_RGB;
+          *out_++ = pixel.r;
+          *out_++ = pixel.g;
+          *out_++ = pixel.b;
+        }
+      }
+      previous_ = pixel;
+    }
+  }
+
+  // Flush any pending run, and return the end of the chunks written.
+  uint8_t* finish() {
+    if (run_ > 0) {
+      *out_++ = QOI_OP_RUN | (run_ - 1);
+      run_ = 0;
+    }
+    return out_;
+  }
+};
+
+// Decoder state; chunks are read from [in, end), which excludes the
+// padding.
+class qoi_decoder {
+private:
+
+    const uint8_t* in_;
+    const uint8_t* end_;
+    qoi_rgba previous_;
+    std::array<qoi_rgba, 64> index_;
+    unsigned run_ = 0;
+
+public:
+
+  qoi_decoder(const uint8_t* in, const uint8_t* end)
+  : in_(in),
+    end_(end) {
+    index_.fill(qoi_rgba{0, 0, 0, 0});
+  }
+
+  // Decode a row of width pixels into R, G, B bytes at rgb. Returns false
+  // if the chunks end early.
+  bool decode_row(uint8_t* rgb, size_t width) {
+    for (size_t x = 0; x < width; ++x, rgb += 3) {
+      if (run_ > 0) {
+        --run_;
+      } else {
+        if (in_ >= end_) {
+          return false;
+        }
+        uint8_t tag = *in_++;
+        if (tag == QOI_OP_RGB) {
+          if ((end_ - in_) < 3) {
+            return false;
+          }
+          previous_.r = in_[0];
+          previous_.g = in_[1];
+          previous_.b = in_[2];
+          in_ += 3;
+        } else if (tag == QOI_OP_RGBA) {
+          if ((end_ - in_) < 4) {
+            return false;
+          }
+          previous_ = qoi_rgba{in_[0], in_[1], in_[2], in_[3]};
+          in_ += 4;
+        } else if ((tag & QOI_MASK_2) == QOI_OP_INDEX) {
+          previous_ = index_[tag];
+        } else if ((tag & QOI_MASK_2) == QOI_OP_DIFF) {
+          previous_.r += ((tag >> 4) & 0x03) - 2;
+          previous_.g += ((tag >> 2) & 0x03) - 2;
+          previous_.b += (tag & 0x03) - 2;
+        } else if ((tag & QOI_MASK_2) == QOI_OP_LUMA) {
+          if (in_ >= end_) {
+            return false;
+          }
+          uint8_t second = *in_++;
+          int dg = (tag & 0x3f) - 32;
+          previous_.r += dg - 8 + ((second >> 4) & 0x0f);
+          previous_.g += dg;
+          previous_.b += dg - 8 + (second & 0x0f);
+        } else {
+          run_ = tag & 0x3f;
+        }
+        index_[previous_.hash()] = previous_;
+      }
+      rgb[0] = previous_.r;
+      rgb[1] = previous_.g;
+      rgb[2] = previous_.b;
+    }
+    return true;
+  }
+};
+
+} // namespace detail
+
+// Encode image, which must be non-empty, as a QOI file in memory, with three
+// channels. image_type may be hdr_image or rgb8_image.
+template <typename image_type>
+std::string encode_qoi(const image_type& image) {
+  assert(!image.is_empty());
+  assert(image.width() <= UINT32_MAX);
+  assert(image.height() <= UINT32_MAX);
+
+  size_t width = image.width(), height = image.height();
+  std::string bytes(detail::QOI_HEADER_BYTES + (4 * width * height)
+                    + sizeof(detail::QOI_PADDING),
+                    '\0');
+  uint8_t* begin = reinterpret_cast<uint8_t*>(&bytes[0]);
+  std::memcpy(begin, "qoif", 4);
+  detail::store_big_endian_32(begin + 4, uint32_t(width));
+  detail::store_big_endian_32(begin + 8, uint32_t(height));
+  begin[12] = 3; // channels
+  begin[13] = 0; // sRGB with linear alpha
+
+  detail::qoi_encoder encoder(begin + detail::QOI_HEADER_BYTES);
+  std::vector<uint8_t> buffer;
+  for (size_t y = 0; y < height; ++y) {
+    encoder.encode_row(detail::rgb8_row(image, y, buffer), width);
+  }
+  uint8_t* end = encoder.finish();
+  std::memcpy(end, detail::QOI_PADDING, sizeof(detail::QOI_PADDING));
+  bytes.resize((end - begin) + sizeof(detail::QOI_PADDING));
+  return bytes;
+}
+
+// Decode the bytes of a QOI file. image_type may be hdr_image or
+// rgb8_image. An alpha channel, if any, is ignored.
+//
+// On success, returns a non-empty optional containing the image. When bytes
+// is not a valid QOI file, returns an empty optional object.
+template <typename image_type = hdr_image>
+std::optional<image_type> decode_qoi(const std::string& bytes) {
+  const size_t overhead = detail::QOI_HEADER_BYTES
+                          + sizeof(detail::QOI_PADDING);
+  auto begin = reinterpret_cast<const uint8_t*>(bytes.data());
+  if ((bytes.size() < overhead) || (std::memcmp(begin, "qoif", 4) != 0)) {
+    return std::nullopt;
+  }
+  uint64_t width = detail::load_big_endian_32(begin + 4),
+           height = detail::load_big_endian_32(begin + 8);
+  uint8_t channels = begin[12], colorspace = begin[13];
+  // every chunk byte decodes to at most QOI_MAX_RUN pixels, so this also
+  // rejects dimensions too large to allocate
+  if ((width == 0) || (height == 0) || ((channels != 3) && (channels != 4))
+      || (colorspace > 1)
+      || ((width * height) > ((bytes.size() - overhead)
+                              * detail::QOI_MAX_RUN))) {
+    return std::nullopt;
+  }
+
+  image_type result = detail::make_decoded_image<image_type>(width, height);
+  detail::qoi_decoder decoder(begin + detail::QOI_HEADER_BYTES,
+                              begin + bytes.size()
+                                - sizeof(detail::QOI_PADDING));
+  std::vector<uint8_t> row(width * 3);
+  for (size_t y = 0; y < height; ++y) {
+    if (!decoder.decode_row(row.data(), width)) {
+      return std::nullopt;
+    }
+    detail::store_rgb8_row(result, y, row.data());
+  }
+  return result;
+}
+
+// Read a QOI file at the given path. image_type may be hdr_image or
+// rgb8_image.
+//
+// On success, returns a non-empty optional containing the image. On I/O
+// error, or when the file is not a valid QOI file, returns an empty optional
+// object.
+template <typename image_type = hdr_image>
+std::optional<image_type> read_qoi(const std::string& path) {
+  std::string bytes;
+  if (!detail::read_file(path, bytes)) {
+    return std::nullopt;
+  }
+  return decode_qoi<image_type>(bytes);
+}
+
+// Write image, which must be non-empty, to a QOI file at the given path.
+// image_type may be hdr_image or rgb8_image.
+//
+// Returns true on success and false on I/O error.
+template <typename image_type>
+bool write_qoi(const image_type& image, const std::string& path) {
+  return detail::write_file(path, encode_qoi(image));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PPM
+///////////////////////////////////////////////////////////////////////////////
+
+namespace detail {
+
+// Return the next number in a PPM header starting at position, skipping
+// whitespace and comments, and advance position past it; or return an
+// empty optional if there is none.
+std::optional<uint32_t> parse_ppm_number(const std::string& bytes,
+                                         size_t& position) {
+  auto is_space = [](char c) {
+    return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r')
+           || (c == '\v') || (c == '\f');
+  };
+  while (position < bytes.size()) {
+    if (is_space(bytes[position])) {
+      ++position;
+    } else if (bytes[position] == '#') {
+      while ((position < bytes.size()) && (bytes[position] != '\n')) {
+        ++position;
+      }
+    } else {
+      break;
+    }
+  }
+
+  uint64_t value = 0;
+  size_t first = position;
+  while ((position < bytes.size()) && (bytes[position] >= '0')
+         && (bytes[position] <= '9')) {
+    value = (value * 10) + (bytes[position] - '0');
+    if (value > UINT32_MAX) {
+      return std::nullopt;
+    }
+    ++position;
+  }
+  if (position == first) {
+    return std::nullopt;
+  }
+  return uint32_t(value);
+}
+
+} // namespace detail
+
+// Encode image, which must be non-empty, as a binary PPM (P6) file in
+// memory, with samples from 0 to 255. image_type may be hdr_image or
+// rgb8_image.
+template <typename image_type>
+std::string encode_ppm(const image_type& image) {
+  assert(!image.is_empty());
+
+  std::string bytes = "P6\n" + std::to_string(image.width()) + " "
+                      + std::to_string(image.height()) + "\n255\n";
+  size_t header_bytes = bytes.size(),
+         row_bytes = image.width() * 3;
+  bytes.resize(header_bytes + (row_bytes * image.height()));
+  std::vector<uint8_t> buffer;
+  for (size_t y = 0; y < image.height(); ++y) {
+    std::memcpy(&bytes[header_bytes + (y * row_bytes)],
+                detail::rgb8_row(image, y, buffer), row_bytes);
+  }
+  return bytes;
+}
+
+// Encode image, which must be non-empty, as a binary PPM (P6) file in
+// memory, with samples from 0 to max_value, which must be in [1, 65535].
+// Intensities are converted as hdr_to_byte does, scaled to max_value
+// instead of 255; so a max_value of 255 gives the same file as the
+// overload above, and a max_value of 65535 keeps 16 bits of precision.
+std::string encode_ppm(const hdr_image& image, unsigned max_value) {
+  assert(!image.is_empty());
+  assert((max_value >= 1) && (max_value <= 65535));
+
+  std::string bytes = "P6\n" + std::to_string(image.width()) + " "
+                      + std::to_string(image.height()) + "\n"
+                      + std::to_string(max_value) + "\n";
+  size_t sample_bytes = (max_value < 256) ? 1 : 2,
+         header_bytes = bytes.size(),
+         row_bytes = image.width() * 3 * sample_bytes;
+  bytes.resize(header_bytes + (row_bytes * image.height()));
+  for (size_t y = 0; y < image.height(); ++y) {
+    auto out = reinterpret_cast<uint8_t*>(&bytes[header_bytes
+                                                 + (y * row_bytes)]);
+    for (size_t x = 0; x < image.width(); ++x) {
+      auto& color = image.pixel(x, y);
+      for (hdr_intensity intensity : {color.r(), color.g(), color.b()}) {
+        assert(is_hdr_intensity_valid(intensity));
+        unsigned sample = unsigned(intensity * float(max_value));
+        if (sample_bytes == 2) {
+          *out++ = uint8_t(sample >> 8);
+        }
+        *out++ = uint8_t(sample);
+      }
+    }
+  }
+  return bytes;
+}
+
+// Decode the bytes of a binary PPM (P6) file. image_type may be hdr_image
+// or rgb8_image. Samples with a maximum value other than 255 are scaled to
+// [0.0, 1.0] for an hdr_image, and rounded to the nearest byte for an
+// rgb8_image. Only the first image of a multi-image file is decoded.
+//
+// On success, returns a non-empty optional containing the image. When bytes
+// is not a valid P6 file, returns an empty optional object.
+template <typename image_type = hdr_image>
+std::optional<image_type> decode_ppm(const std::string& bytes) {
+  if ((bytes.size() < 2) || (bytes[0] != 'P') || (bytes[1] != '6')) {
+    return std::nullopt;
+  }
+  size_t position = 2;
+  auto width = detail::parse_ppm_number(bytes, position),
+       height = detail::parse_ppm_number(bytes, position),
+       max_value = detail::parse_ppm_number(bytes, position);
+  // exactly one whitespace byte separates the header from the samples
+  if (!width || !height || !max_value || (*width == 0) || (*height == 0)
+      || (*max_value == 0) || (*max_value > 65535)
+      || (position >= bytes.size())) {
+    return std::nullopt;
+  }
+  ++position;
+
+  uint64_t sample_bytes = (*max_value < 256) ? 1 : 2,
+           row_bytes = uint64_t(*width) * 3 * sample_bytes;
+  if ((row_bytes * *height) > (bytes.size() - position)) {
+    return std::nullopt;
+  }
+
+  image_type result = detail::make_decoded_image<image_type>(*width,
+                                                             *height);
+  auto samples = reinterpret_cast<const uint8_t*>(bytes.data() + position);
+  std::vector<uint8_t> row;
+  for (size_t y = 0; y < *height; ++y, samples += row_bytes) {
+    if (*max_value == 255) {
+      detail::store_rgb8_row(result, y, samples);
+      continue;
+    }
+
+    const uint8_t* in = samples;
+    auto next = [&]() {
+      unsigned sample = *in++;
+      if (sample_bytes == 2) {
+        sample = (sample << 8) | *in++;
+      }
+      return std::min(sample, unsigned(*max_value));
+    };
+    if constexpr (std::is_same<image_type, hdr_image>::value) {
+      for (size_t x = 0; x < *width; ++x) {
+        hdr_intensity r = float(next()) / float(*max_value),
+                      g = float(next()) / float(*max_value),
+                      b = float(next()) / float(*max_value);
+        result.pixel(x, y, hdr_rgb(r, g, b));
+      }
+    } else {
+      row.resize(size_t(*width) * 3);
+      for (auto& byte : row) {
+        byte = uint8_t(((next() * 255) + (*max_value / 2)) / *max_value);
+      }
+      detail::store_rgb8_row(result, y, row.data());
+    }
+  }
+  return result;
+}
+
+// Read a binary PPM (P6) file at the given path. image_type may be
+// hdr_image or rgb8_image.
+//
+// On success, returns a non-empty optional containing the image. On I/O
+// error, or when the file is not a valid P6 file, returns an empty optional
+// object.
+template <typename image_type = hdr_image>
+std::optional<image_type> read_ppm(const std::string& path) {
+  std::string bytes;
+  if (!detail::read_file(path, bytes)) {
+    return std::nullopt;
+  }
+  return decode_ppm<image_type>(bytes);
+}
+
+// Write image, which must be non-empty, to a binary PPM (P6) file at the
+// given path, with samples from 0 to 255. image_type may be hdr_image or
+// rgb8_image.
+//
+// Returns true on success and false on I/O error.
+template <typename image_type>
+bool write_ppm(const image_type& image, const std::string& path) {
+  return detail::write_file(path, encode_ppm(image));
+}
+
+// Write image, which must be non-empty, to a binary PPM (P6) file at the
+// given path, with samples from 0 to max_value, as in encode_ppm.
+//
+// Returns true on success and false on I/O error.
+bool write_ppm(const hdr_image& image, const std::string& path,
+               unsigned max_value) {
+  return detail::write_file(path, encode_ppm(image, max_value));
+}
+
+} // namespace gfx
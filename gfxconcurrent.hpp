@@ -0,0 +1,364 @@
+
+///////////////////////////////////////////////////////////////////////////////
+// gfxconcurrent.hpp
+//
+// An image that many threads may draw into at once.
+//
+// hdr_image is not safe for concurrent writes, and a lock around every
+// pixel would serialize the threads. Instead, a concurrent_image stores each
+// pixel as one 64-bit atomic cell, holding a palette index and the sequence
+// number of the primitive that wrote it. A write only lands if its sequence
+// number is higher than the one already in the cell, so however the threads
+// interleave, each pixel ends up with the color of the highest-numbered
+// primitive that covers it; exactly as if the primitives had been drawn one
+// after another, in sequence order.
+//
+// This file builds upon gfximage.hpp and gfxrasterize.hpp, so you may want
+// to familiarize yourself with those headers before diving into this one.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "gfximage.hpp"
+#include "gfxrasterize.hpp"
+
+namespace gfx {
+
+// Default maximum number of distinct colors in a concurrent_image.
+const size_t DEFAULT_PALETTE_CAPACITY = size_t(1) << 16;
+
+// An image whose pixels may be written by several threads concurrently.
+//
+// Every write carries a sequence number, and a pixel keeps the write with
+// the highest sequence number; sequence number zero belongs to the
+// background. Give each primitive its own sequence number, in the order a
+// serial program would draw them, and the result is deterministic. Writes
+// with equal sequence numbers and different colors resolve to one of the
+// colors, but which one is unspecified.
+//
+// Colors are kept in a palette, shared by all threads, with a fixed
+// capacity chosen at construction; drawing more distinct colors than that,
+// counting the background, is an error. The palette is an open-addressing
+// hash table that threads add to with compare-and-swap, so neither drawing
+// nor reading pixels takes a lock.
+//
+// Draw through a pixel_writer, obtained from writer(sequence), which has the
+// pixel and fill_span interface of hdr_image, so it can be passed to any
+// rasterize function. Each pixel_writer may only be used by one thread at a
+// time, but any number of them may be used at once.
+class concurrent_image {
+private:
+
+    using color_key = std::array<uint32_t, 3>;
+
+    // states of a palette slot other than holding index + 1
+    static constexpr uint32_t EMPTY_SLOT = 0, BUSY_SLOT = UINT32_MAX;
+
+    size_t width_ = 0, height_ = 0, palette_capacity_ = 0;
+    std::unique_ptr<std::atomic<uint64_t>[]> cells_;
+
+    // palette_[i] is written once, before its index is published in
+    // palette_slots_ with a release store
+    std::unique_ptr<hdr_rgb[]> palette_;
+    std::unique_ptr<std::atomic<uint32_t>[]> palette_slots_;
+    size_t slot_mask_ = 0;
+    std::atomic<uint32_t> palette_size_{0};
+
+    static uint64_t make_cell(uint32_t sequence, uint32_t color_index) {
+      return (uint64_t(sequence) << 32) | color_index;
+    }
+
+    static color_key make_key(const hdr_rgb& color) {
+      float intensities[3] = {color.r(), color.g(), color.b()};
+      color_key key;
+      std::memcpy(key.data(), intensities, sizeof(intensities));
+      return key;
+    }
+
+    static uint64_t hash_key(const color_key& key) {
+      uint64_t hash = (uint64_t(key[0]) * 0x9e3779b97f4a7c15u) ^ key[1];
+      hash = (hash * 0xc2b2ae3d27d4eb4fu) ^ key[2];
+      hash *= 0x165667b19e3779f9u;
+      return hash ^ (hash >> 29);
+    }
+
+    std::atomic<uint64_t>& cell(size_t x, size_t y) const {
+      assert(is_xy(x, y));
+      return cells_[(y * width_) + x];
+    }
+
+    // Store cell_value at (x, y) unless the cell already holds a higher
+    // value; an atomic maximum. The release pairs with the acquire loads
+    // of pixel, so a reader sees the palette entry of any index it loads.
+    void store_max(size_t x, size_t y, uint64_t cell_value) {
+      std::atomic<uint64_t>& target = cell(x, y);
+      uint64_t old = target.load(std::memory_order_relaxed);
+      while ((old < cell_value)
+             && !target.compare_exchange_weak(old, cell_value,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed)) {
+      }
+    }
+
+public:
+
+  // A handle for drawing one primitive, or a run of primitives, with a
+  // given sequence number. It keeps a small direct-mapped cache of the
+  // palette indices of colors it drew recently, so a run of one color, or
+  // a gradient revisiting a few colors, rarely consults the shared palette.
+  class pixel_writer {
+  private:
+      struct cached_color {
+        // no valid intensity has the bits of a NaN, so this never matches
+        color_key key{{UINT32_MAX, UINT32_MAX, UINT32_MAX}};
+        uint32_t index = 0;
+      };
+
+      static constexpr size_t CACHE_SLOTS = 64;
+
+      concurrent_image* image_;
+      uint32_t sequence_;
+      std::array<cached_color, CACHE_SLOTS> cache_;
+
+      uint64_t cell_value(const hdr_rgb& color) {
+        color_key key = make_key(color);
+        cached_color& slot = cache_[hash_key(key) % CACHE_SLOTS];
+        if (slot.key != key) {
+          slot.index = image_->intern(color);
+          slot.key = key;
+        }
+        return make_cell(sequence_, slot.index);
+      }
+
+  public:
+    pixel_writer(concurrent_image& image, uint32_t sequence)
+    : image_(&image), sequence_(sequence) {
+      assert(sequence > 0);
+    }
+
+    // Write new_value to every pixel (x, y) with x in [x_begin, x_end).
+    void fill_span(size_t x_begin, size_t x_end, size_t y,
+                   const hdr_rgb& new_value) {
+      assert(x_begin <= x_end);
+      assert(x_end <= width());
+      uint64_t value = cell_value(new_value);
+      for (size_t x = x_begin; x < x_end; ++x) {
+        image_->store_max(x, y, value);
+      }
+    }
+
+    size_t height() const { return image_->height(); }
+    bool is_empty() const { return image_->is_empty(); }
+    bool is_x(size_t x) const { return image_->is_x(x); }
+    bool is_y(size_t y) const { return image_->is_y(y); }
+    bool is_xy(size_t x, size_t y) const { return image_->is_xy(x, y); }
+
+    // Return the pixel color at (x, y), as in concurrent_image::pixel.
+    hdr_rgb pixel(size_t x, size_t y) const { return image_->pixel(x, y); }
+
+    // Write new_value to the pixel at (x, y).
+    void pixel(size_t x, size_t y, const hdr_rgb& new_value) {
+      image_->store_max(x, y, cell_value(new_value));
+    }
+
+    // Return the sequence number of writes.
+    uint32_t sequence() const { return sequence_; }
+
+    // Change the sequence number of later writes, which must be positive.
+    void set_sequence(uint32_t sequence) {
+      assert(sequence > 0);
+      sequence_ = sequence;
+    }
+
+    size_t width() const { return image_->width(); }
+  };
+
+  // Create an empty image.
+  concurrent_image() {
+    assert(is_empty());
+  }
+
+  // Create an image with a given width and height, both positive, filled
+  // with background at sequence number zero, whose palette holds up to
+  // palette_capacity distinct colors, which must be positive and less than
+  // 2^31.
+  concurrent_image(size_t width,
+                   size_t height,
+                   const hdr_rgb& background,
+                   size_t palette_capacity = DEFAULT_PALETTE_CAPACITY)
+  : width_(width),
+    height_(height),
+    palette_capacity_(palette_capacity),
+    cells_(new std::atomic<uint64_t>[width * height]),
+    palette_(new hdr_rgb[palette_capacity]) {
+    assert(width > 0);
+    assert(height > 0);
+    assert((palette_capacity > 0) && (palette_capacity < (size_t(1) << 31)));
+
+    // at most half full, so probe sequences stay short
+    size_t slot_count = 2;
+    while (slot_count < (2 * palette_capacity)) {
+      slot_count *= 2;
+    }
+    palette_slots_.reset(new std::atomic<uint32_t>[slot_count]);
+    for (size_t i = 0; i < slot_count; ++i) {
+      palette_slots_[i].store(EMPTY_SLOT, std::memory_order_relaxed);
+    }
+    slot_mask_ = slot_count - 1;
+
+    uint32_t index = intern(background);
+    for (size_t i = 0; i < (width * height); ++i) {
+      cells_[i].store(make_cell(0, index), std::memory_order_relaxed);
+    }
+    assert(!is_empty());
+  }
+
+  concurrent_image(const concurrent_image&) = delete;
+  concurrent_image& operator=(const concurrent_image&) = delete;
+
+  // Return the height of the image. An empty image has height zero.
+  size_t height() const { return height_; }
+
+  // Return the palette index of color, adding it to the palette if it is
+  // new; the palette must not be full then. Thread-safe, and lock-free
+  // except that a thread looking up a color may briefly wait for another
+  // thread to finish adding one in the same slot.
+  uint32_t intern(const hdr_rgb& color) {
+    color_key key = make_key(color);
+    for (size_t slot = hash_key(key) & slot_mask_; ;
+         slot = (slot + 1) & slot_mask_) {
+      auto& state = palette_slots_[slot];
+      uint32_t value = state.load(std::memory_order_acquire);
+      if ((value == EMPTY_SLOT)
+          && state.compare_exchange_strong(value, BUSY_SLOT,
+                                           std::memory_order_acquire)) {
+        // this thread owns the slot until it publishes the index
+        uint32_t index = palette_size_.fetch_add(1, std::memory_order_relaxed);
+        assert(index < palette_capacity_);
+        if (index >= palette_capacity_) {
+          // with asserts off, a color beyond the capacity draws as the
+          // background rather than corrupt memory
+          state.store(EMPTY_SLOT, std::memory_order_release);
+          return 0;
+        }
+        palette_[index] = color;
+        state.store(index + 1, std::memory_order_release);
+        return index;
+      }
+      while (value == BUSY_SLOT) {
+        std::this_thread::yield();
+        value = state.load(std::memory_order_acquire);
+      }
+      if (make_key(palette_[value - 1]) == key) {
+        return value - 1;
+      }
+    }
+  }
+
+  // Return true iff the image is empty.
+  bool is_empty() const { return width_ == 0; }
+
+  // Return true when x or y is a valid coordinate for this image. When an
+  // image is empty, no coordinate is valid.
+  bool is_x(size_t x) const { return x < width();  }
+  bool is_y(size_t y) const { return y < height(); }
+  bool is_xy(size_t x, size_t y) const {
+    return is_x(x) && is_y(y);
+  }
+
+  // Return the maximum number of distinct colors in the palette.
+  size_t palette_capacity() const { return palette_capacity_; }
+
+  // Return the number of distinct colors in the palette.
+  size_t palette_size() const {
+    return std::min<size_t>(palette_size_.load(std::memory_order_relaxed),
+                            palette_capacity_);
+  }
+
+  // Return the pixel color at (x, y) as of now; while other threads are
+  // drawing, it may change at any time. x and y must both be valid
+  // coordinates according to is_xy.
+  hdr_rgb pixel(size_t x, size_t y) const {
+    uint64_t value = cell(x, y).load(std::memory_order_acquire);
+    return palette_[uint32_t(value)];
+  }
+
+  // Return the sequence number of the write that the pixel at (x, y) holds.
+  uint32_t sequence(size_t x, size_t y) const {
+    return uint32_t(cell(x, y).load(std::memory_order_relaxed) >> 32);
+  }
+
+  // Return the pixels as an ordinary hdr_image. Call this after every
+  // drawing thread has been joined.
+  hdr_image to_image() const {
+    if (is_empty()) {
+      return hdr_image();
+    }
+    hdr_image result(width_, height_, BLACK);
+    for (size_t y = 0; y < height_; ++y) {
+      for (size_t x = 0; x < width_; ++x) {
+        uint64_t value = cell(x, y).load(std::memory_order_acquire);
+        result.pixel(x, y, palette_[uint32_t(value)]);
+      }
+    }
+    return result;
+  }
+
+  // Return the width of the image. An empty image has width zero.
+  size_t width() const { return width_; }
+
+  // Return a writer for primitives with the given sequence number, which
+  // must be positive.
+  pixel_writer writer(uint32_t sequence) {
+    return pixel_writer(*this, sequence);
+  }
+};
+
+// Draw every segment in segments with color, on thread_count threads.
+// Segment i gets sequence number first_sequence + i, so the result is the
+// same as drawing the segments in order, on one thread, over whatever
+// target held before. Every endpoint must be a valid coordinate in target,
+// and thread_count must be positive; std::thread::hardware_concurrency() is
+// a reasonable choice.
+void rasterize_line_segments(concurrent_image& target,
+                             const std::vector<line_segment>& segments,
+                             const hdr_rgb& color,
+                             uint32_t first_sequence,
+                             unsigned thread_count) {
+  assert(first_sequence > 0);
+  assert(thread_count > 0);
+  assert((uint64_t(first_sequence) + segments.size()) <= UINT32_MAX);
+
+  auto draw = [&](size_t begin, size_t end) {
+    auto out = target.writer(first_sequence);
+    for (size_t i = begin; i < end; ++i) {
+      auto& segment = segments[i];
+      out.set_sequence(uint32_t(first_sequence + i));
+      rasterize_line_segment(out, segment.x0, segment.y0,
+                             segment.x1, segment.y1, color);
+    }
+  };
+
+  size_t count = segments.size(),
+         chunk = (count + thread_count - 1) / thread_count;
+  std::vector<std::thread> threads;
+  for (size_t begin = chunk; begin < count; begin += chunk) {
+    threads.emplace_back(draw, begin, std::min(count, begin + chunk));
+  }
+  draw(0, std::min(count, chunk));
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+} // namespace gfx
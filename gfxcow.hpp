@@ -0,0 +1,269 @@
+
+///////////////////////////////////////////////////////////////////////////////
+// gfxcow.hpp
+//
+// Copy-on-write images, for cheap snapshots.
+//
+// A cow_image divides its rows into blocks, and shares blocks between
+// copies; copying an image takes constant time, and a block is duplicated
+// only when one of the images sharing it writes to it. So snapshots for
+// undo, golden references, or handing a frame to another thread cost memory
+// only in proportion to what changes afterwards.
+//
+// This file builds upon gfximage.hpp, so you may want to familiarize
+// yourself with that header before diving into this one.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "gfximage.hpp"
+
+namespace gfx {
+
+// Default number of rows in each block of a cow_image.
+const size_t DEFAULT_COW_BLOCK_ROWS = 16;
+
+// An image with copy-on-write storage.
+//
+// Rows are grouped into blocks of block_rows() rows each; the last block
+// may be shorter. Each block is an hdr_image, held by reference-counted
+// pointer, and the table of blocks is itself shared, so the copy
+// constructor and copy assignment only copy one pointer. Before a write,
+// the image takes private copies of the table and of the block being
+// written, if they are shared.
+//
+// A cow_image has the same pixel and fill_span interface as hdr_image, so
+// it can be passed to rasterize_line_segment and rasterize_line_segments.
+//
+// Copies may be read and written from different threads, as long as each
+// cow_image object is only used by one thread at a time.
+class cow_image {
+private:
+
+    using block_pointer = std::shared_ptr<hdr_image>;
+    using block_table = std::vector<block_pointer>;
+
+    std::shared_ptr<block_table> blocks_;
+    size_t width_ = 0, height_ = 0, block_rows_ = DEFAULT_COW_BLOCK_ROWS;
+
+    // Return true iff pointer is the only owner of its object, in which case
+    // the object may be written. The fence orders this thread's writes after
+    // every access made through owners that have since let go.
+    template <typename pointer_type>
+    static bool is_unique(const pointer_type& pointer) {
+      if (pointer.use_count() == 1) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return true;
+      }
+      return false;
+    }
+
+    // Return the block holding row y, to be written, after unsharing it.
+    hdr_image& writable_block(size_t y) {
+      if (!is_unique(blocks_)) {
+        blocks_ = std::make_shared<block_table>(*blocks_);
+      }
+      block_pointer& block = (*blocks_)[y / block_rows_];
+      if (!is_unique(block)) {
+        block = std::make_shared<hdr_image>(*block);
+      }
+      return *block;
+    }
+
+    // Make every block a shared image of rows filled with fill_color.
+    void fill_blocks(const hdr_rgb& fill_color) {
+      size_t count = (height_ + block_rows_ - 1) / block_rows_,
+             last_rows = height_ - ((count - 1) * block_rows_);
+      auto full = std::make_shared<hdr_image>(width_, block_rows_,
+                                              fill_color);
+      auto table = std::make_shared<block_table>(count, full);
+      if (last_rows != block_rows_) {
+        table->back() = std::make_shared<hdr_image>(width_, last_rows,
+                                                    fill_color);
+      }
+      blocks_ = std::move(table);
+    }
+
+public:
+
+  // Create an empty image.
+  cow_image() {
+    assert(is_empty());
+  }
+
+  // Create an image with a given width, height, and color for all the
+  // pixels, in blocks of block_rows rows. width, height, and block_rows must
+  // all be positive. Every full block initially shares one image of
+  // fill_color, so this allocates only one or two blocks.
+  cow_image(size_t width,
+            size_t height,
+            const hdr_rgb& fill_color,
+            size_t block_rows = DEFAULT_COW_BLOCK_ROWS)
+  : width_(width), height_(height), block_rows_(block_rows) {
+    assert(width > 0);
+    assert(height > 0);
+    assert(block_rows > 0);
+    fill_blocks(fill_color);
+    assert(!is_empty());
+  }
+
+  // Create an image with the same pixels as image, which must be non-empty,
+  // in blocks of block_rows rows.
+  explicit cow_image(const hdr_image& image,
+                     size_t block_rows = DEFAULT_COW_BLOCK_ROWS)
+  : width_(image.width()), height_(image.height()), block_rows_(block_rows) {
+    assert(!image.is_empty());
+    assert(block_rows > 0);
+    auto table = std::make_shared<block_table>();
+    for (size_t y_begin = 0; y_begin < height_; y_begin += block_rows_) {
+      size_t rows = std::min(block_rows_, height_ - y_begin);
+      auto block = std::make_shared<hdr_image>(width_, rows, BLACK);
+      for (size_t y = 0; y < rows; ++y) {
+        for (size_t x = 0; x < width_; ++x) {
+          block->pixel(x, y, image.pixel(x, y_begin + y));
+        }
+      }
+      table->push_back(std::move(block));
+    }
+    blocks_ = std::move(table);
+  }
+
+  // Copying shares every block, in constant time.
+  cow_image(const cow_image&) = default;
+  cow_image& operator=(const cow_image&) = default;
+
+  // Moving leaves other empty.
+  cow_image(cow_image&& other) noexcept
+  : cow_image() {
+    swap(other);
+  }
+
+  cow_image& operator=(cow_image&& other) noexcept {
+    cow_image moved(std::move(other));
+    swap(moved);
+    return *this;
+  }
+
+  // Strict equality comparison, as for hdr_image. Blocks shared by both
+  // images are not compared pixel by pixel.
+  bool operator==(const cow_image& rhs) const {
+    if ((width_ != rhs.width_) || (height_ != rhs.height_)) {
+      return false;
+    }
+    for (size_t y = 0; y < height_; ++y) {
+      const block_pointer& left = (*blocks_)[y / block_rows_];
+      const block_pointer& right = (*rhs.blocks_)[y / rhs.block_rows_];
+      if ((left == right) && (block_rows_ == rhs.block_rows_)) {
+        continue;
+      }
+      for (size_t x = 0; x < width_; ++x) {
+        if (!(pixel(x, y) == rhs.pixel(x, y))) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  // Return the number of blocks.
+  size_t block_count() const { return blocks_ ? blocks_->size() : 0; }
+
+  // Return the number of rows in each block.
+  size_t block_rows() const { return block_rows_; }
+
+  // Set every pixel to fill_color. Like construction, this replaces every
+  // block with one shared block.
+  void fill(const hdr_rgb& fill_color) {
+    if (!is_empty()) {
+      fill_blocks(fill_color);
+    }
+  }
+
+  // Assign every pixel (x, y) with x in [x_begin, x_end) to new_value.
+  // y must be a valid coordinate, and x_begin <= x_end <= width().
+  void fill_span(size_t x_begin, size_t x_end, size_t y,
+                 const hdr_rgb& new_value) {
+    assert(is_y(y));
+    assert(x_begin <= x_end);
+    assert(x_end <= width());
+    if (x_begin < x_end) {
+      writable_block(y).fill_span(x_begin, x_end, y % block_rows_,
+                                  new_value);
+    }
+  }
+
+  // Return the height of the image. An empty image has height zero.
+  size_t height() const { return height_; }
+
+  // Return true iff the image is empty.
+  bool is_empty() const { return width_ == 0; }
+
+  // Return true when x or y is a valid coordinate for this image. When an
+  // image is empty, no coordinate is valid.
+  bool is_x(size_t x) const { return x < width();  }
+  bool is_y(size_t y) const { return y < height(); }
+  bool is_xy(size_t x, size_t y) const {
+    return is_x(x) && is_y(y);
+  }
+
+  // Return the number of blocks that no other image shares, which is the
+  // memory this image would free if it were destroyed.
+  size_t owned_block_count() const {
+    if (!blocks_) {
+      return 0;
+    }
+    if (blocks_.use_count() > 1) {
+      return 0;
+    }
+    return std::count_if(blocks_->begin(), blocks_->end(),
+                         [](auto& block) { return block.use_count() == 1; });
+  }
+
+  // Return the pixel color at (x, y).
+  // x and y must both be valid coordinates according to is_xy.
+  const hdr_rgb& pixel(size_t x, size_t y) const {
+    assert(is_xy(x, y));
+    return (*blocks_)[y / block_rows_]->pixel(x, y % block_rows_);
+  }
+
+  // Assign the pixel at (x, y) to new_value, duplicating its block first if
+  // it is shared. x and y must both be valid coordinates according to is_xy.
+  void pixel(size_t x, size_t y, const hdr_rgb& new_value) {
+    assert(is_xy(x, y));
+    writable_block(y).pixel(x, y % block_rows_, new_value);
+  }
+
+  // Swap contents with another image.
+  void swap(cow_image& other) noexcept {
+    blocks_.swap(other.blocks_);
+    std::swap(width_, other.width_);
+    std::swap(height_, other.height_);
+    std::swap(block_rows_, other.block_rows_);
+  }
+
+  // Return a copy of the pixels as an ordinary hdr_image.
+  hdr_image to_image() const {
+    if (is_empty()) {
+      return hdr_image();
+    }
+    hdr_image result(width_, height_, BLACK);
+    for (size_t y = 0; y < height_; ++y) {
+      for (size_t x = 0; x < width_; ++x) {
+        result.pixel(x, y, pixel(x, y));
+      }
+    }
+    return result;
+  }
+
+  // Return the width of the image. An empty image has width zero.
+  size_t width() const { return width_; }
+};
+
+} // namespace gfx
@@ -0,0 +1,516 @@
+
+///////////////////////////////////////////////////////////////////////////////
+// gfxdisplay.hpp
+//
+// Display lists: drawing commands recorded once into a compact buffer, and
+// replayed many times, either serially or tile by tile in parallel.
+//
+// This file builds upon gfxrasterize.hpp, so you may want to familiarize
+// yourself with that header before diving into this one.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "gfximage.hpp"
+#include "gfxrasterize.hpp"
+
+namespace gfx {
+
+// The kinds of command that may be recorded in a display_list. Each one
+// corresponds to the gfxrasterize.hpp primitive of the same name.
+enum class draw_opcode : uint32_t {
+  line_segment,
+  fill_rect,
+  fill_polygon,
+  circle,
+  fill_circle,
+  ellipse,
+  fill_ellipse
+};
+
+// A recorded sequence of drawing commands.
+//
+// Commands are packed back to back into one arena of 32-bit words: a fixed
+// size header, followed by a payload whose size depends on the command; for
+// example a polygon stores its vertices inline. Colors are not stored per
+// command; like a drawing context, the list has a current color, set with
+// set_color, and each command refers to an entry in a table of distinct
+// consecutive colors.
+//
+// Recording never touches an image. Use replay to execute the commands
+// serially, or tile_bins and replay_tiled to execute them tile by tile.
+class display_list {
+public:
+
+  // Fixed size header at the start of every command.
+  struct command_header {
+    draw_opcode opcode;
+    uint32_t color;      // index into colors()
+    uint32_t words;      // size of the payload that follows, in words
+    raster_rect bounds;  // contains every pixel the command may write
+  };
+
+  // Payloads, by opcode. A fill_polygon payload is a polygon_payload
+  // followed by vertex_count raster_points.
+  struct segment_payload {
+    raster_point p0, p1;
+  };
+  struct rect_payload {
+    raster_rect rect;
+  };
+  struct polygon_payload {
+    fill_rule rule;
+    uint32_t vertex_count;
+  };
+  struct ellipse_payload {
+    raster_point center;
+    uint32_t radius_x, radius_y;
+  };
+
+private:
+  std::vector<uint32_t> arena_;
+  std::vector<size_t> offsets_; // arena index of each command header
+  std::vector<hdr_rgb> colors_;
+  hdr_rgb color_;
+  uint64_t revision_;
+
+  static constexpr size_t HEADER_WORDS = sizeof(command_header) / 4;
+
+  template <typename payload_type>
+  static constexpr size_t words_of() {
+    static_assert(sizeof(payload_type) % 4 == 0,
+                  "payloads must be a whole number of words");
+    return sizeof(payload_type) / 4;
+  }
+
+  // Append a command header for opcode, and reserve payload_words words of
+  // payload after it. Returns the arena index of the payload.
+  size_t begin_command(draw_opcode opcode,
+                       const raster_rect& bounds,
+                       size_t payload_words) {
+    if (colors_.empty() || !(colors_.back() == color_)) {
+      colors_.push_back(color_);
+    }
+    command_header header{opcode,
+                          uint32_t(colors_.size() - 1),
+                          uint32_t(payload_words),
+                          bounds};
+    size_t offset = arena_.size();
+    offsets_.push_back(offset);
+    arena_.resize(offset + HEADER_WORDS + payload_words);
+    std::memcpy(&arena_[offset], &header, sizeof(header));
+    ++revision_;
+    return offset + HEADER_WORDS;
+  }
+
+  template <typename payload_type>
+  void store(size_t index, const payload_type& payload) {
+    std::memcpy(&arena_[index], &payload, sizeof(payload));
+  }
+
+  template <typename payload_type>
+  void record(draw_opcode opcode,
+              const raster_rect& bounds,
+              const payload_type& payload) {
+    store(begin_command(opcode, bounds, words_of<payload_type>()), payload);
+  }
+
+public:
+
+  // Create an empty display list, with current color BLACK.
+  display_list()
+  : color_(BLACK), revision_(0) {
+    assert(is_empty());
+  }
+
+  // Remove every command, keeping the memory allocated for reuse. The
+  // current color is unchanged.
+  void clear() {
+    arena_.clear();
+    offsets_.clear();
+    colors_.clear();
+    ++revision_;
+  }
+
+  // Return the current color, used by subsequently recorded commands.
+  const hdr_rgb& color() const { return color_; }
+
+  // Return the table of colors referred to by command_header::color.
+  const std::vector<hdr_rgb>& colors() const { return colors_; }
+
+  // Return the header of the command at index, which must be < size().
+  command_header header(size_t index) const {
+    assert(index < size());
+    command_header result;
+    std::memcpy(&result, &arena_[offsets_[index]], sizeof(result));
+    return result;
+  }
+
+  // Return true iff there are no commands.
+  bool is_empty() const { return offsets_.empty(); }
+
+  // Return the payload of the command at index, which must be < size(), and
+  // whose payload must be a payload_type.
+  template <typename payload_type>
+  payload_type payload(size_t index) const {
+    assert(index < size());
+    payload_type result;
+    std::memcpy(&result,
+                &arena_[offsets_[index] + HEADER_WORDS],
+                sizeof(result));
+    return result;
+  }
+
+  // Copy the vertices of the fill_polygon command at index into vertices,
+  // replacing its previous contents, and return the fill rule.
+  fill_rule polygon_vertices(size_t index,
+                             std::vector<raster_point>& vertices) const {
+    assert(header(index).opcode == draw_opcode::fill_polygon);
+    auto polygon = payload<polygon_payload>(index);
+    vertices.resize(polygon.vertex_count);
+    if (polygon.vertex_count > 0) {
+      std::memcpy(vertices.data(),
+                  &arena_[offsets_[index] + HEADER_WORDS
+                          + words_of<polygon_payload>()],
+                  polygon.vertex_count * sizeof(raster_point));
+    }
+    return polygon.rule;
+  }
+
+  // Return a number that changes whenever a command is added or the list
+  // is cleared. Used to detect stale tile_bins.
+  uint64_t revision() const { return revision_; }
+
+  // Change the current color.
+  void set_color(const hdr_rgb& color) { color_ = color; }
+
+  // Return the number of commands.
+  size_t size() const { return offsets_.size(); }
+
+  // Return the number of bytes used by recorded commands.
+  size_t size_bytes() const {
+    return (arena_.size() * 4) + (colors_.size() * sizeof(hdr_rgb));
+  }
+
+  // Record commands, in the current color. The arguments have the same
+  // meaning as the gfxrasterize.hpp primitive of the same name.
+
+  void circle(int center_x, int center_y, unsigned radius) {
+    ellipse_command(draw_opcode::circle, center_x, center_y, radius, radius);
+  }
+
+  void ellipse(int center_x, int center_y,
+               unsigned radius_x, unsigned radius_y) {
+    ellipse_command(draw_opcode::ellipse,
+                    center_x, center_y, radius_x, radius_y);
+  }
+
+  void fill_circle(int center_x, int center_y, unsigned radius) {
+    ellipse_command(draw_opcode::fill_circle,
+                    center_x, center_y, radius, radius);
+  }
+
+  void fill_ellipse(int center_x, int center_y,
+                    unsigned radius_x, unsigned radius_y) {
+    ellipse_command(draw_opcode::fill_ellipse,
+                    center_x, center_y, radius_x, radius_y);
+  }
+
+  void fill_polygon(const std::vector<raster_point>& vertices,
+                    fill_rule rule = fill_rule::even_odd) {
+    // pixels are filled when their centers are strictly left of and above
+    // the right and bottom extremes
+    raster_rect bounds{0, 0, 0, 0};
+    if (!vertices.empty()) {
+      bounds = raster_rect{vertices[0].x, vertices[0].y,
+                           vertices[0].x, vertices[0].y};
+      for (auto& v : vertices) {
+        bounds.x_min = std::min(bounds.x_min, v.x);
+        bounds.y_min = std::min(bounds.y_min, v.y);
+        bounds.x_max = std::max(bounds.x_max, v.x);
+        bounds.y_max = std::max(bounds.y_max, v.y);
+      }
+    }
+    size_t vertex_words = vertices.size() * words_of<raster_point>();
+    size_t index = begin_command(draw_opcode::fill_polygon,
+                                 bounds,
+                                 words_of<polygon_payload>() + vertex_words);
+    store(index, polygon_payload{rule, uint32_t(vertices.size())});
+    if (!vertices.empty()) {
+      std::memcpy(&arena_[index + words_of<polygon_payload>()],
+                  vertices.data(),
+                  vertices.size() * sizeof(raster_point));
+    }
+  }
+
+  void fill_rect(const raster_rect& rect) {
+    record(draw_opcode::fill_rect, rect, rect_payload{rect});
+  }
+
+  void line_segment(const raster_point& p0, const raster_point& p1) {
+    raster_rect bounds{std::min(p0.x, p1.x), std::min(p0.y, p1.y),
+                       std::max(p0.x, p1.x) + 1, std::max(p0.y, p1.y) + 1};
+    record(draw_opcode::line_segment, bounds, segment_payload{p0, p1});
+  }
+
+private:
+  void ellipse_command(draw_opcode opcode,
+                       int center_x, int center_y,
+                       unsigned radius_x, unsigned radius_y) {
+    raster_rect bounds{center_x - int(radius_x), center_y - int(radius_y),
+                       center_x + int(radius_x) + 1,
+                       center_y + int(radius_y) + 1};
+    record(opcode,
+           bounds,
+           ellipse_payload{raster_point{center_x, center_y},
+                           radius_x, radius_y});
+  }
+};
+
+namespace detail {
+
+// Execute the command at index of list on target, clipped to clip.
+// scratch holds polygon vertices, and is reused between calls.
+void execute_command(const display_list& list,
+                     size_t index,
+                     hdr_image& target,
+                     const raster_rect& clip,
+                     std::vector<raster_point>& scratch) {
+  auto header = list.header(index);
+  auto& color = list.colors()[header.color];
+  switch (header.opcode) {
+  case draw_opcode::line_segment: {
+    auto segment = list.payload<display_list::segment_payload>(index);
+    rasterize_line_segment(target, segment.p0, segment.p1, color, clip);
+    break;
+  }
+  case draw_opcode::fill_rect:
+    fill_rect(target,
+              list.payload<display_list::rect_payload>(index).rect,
+              color,
+              clip);
+    break;
+  case draw_opcode::fill_polygon: {
+    fill_rule rule = list.polygon_vertices(index, scratch);
+    fill_polygon(target, scratch, color, rule, clip);
+    break;
+  }
+  case draw_opcode::circle:
+  case draw_opcode::fill_circle:
+  case draw_opcode::ellipse:
+  case draw_opcode::fill_ellipse: {
+    auto e = list.payload<display_list::ellipse_payload>(index);
+    if (header.opcode == draw_opcode::circle) {
+      rasterize_circle(target, e.center.x, e.center.y, e.radius_x,
+                       color, clip);
+    } else if (header.opcode == draw_opcode::fill_circle) {
+      fill_circle(target, e.center.x, e.center.y, e.radius_x, color, clip);
+    } else if (header.opcode == draw_opcode::ellipse) {
+      rasterize_ellipse(target, e.center.x, e.center.y,
+                        e.radius_x, e.radius_y, color, clip);
+    } else {
+      fill_ellipse(target, e.center.x, e.center.y,
+                   e.radius_x, e.radius_y, color, clip);
+    }
+    break;
+  }
+  }
+}
+
+} // namespace detail
+
+// Execute every command of list on target, in the order recorded. The
+// result is identical to calling the corresponding gfxrasterize.hpp
+// primitives directly.
+//
+// target must be non-empty.
+void replay(const display_list& list,
+            hdr_image& target,
+            const raster_rect& clip = UNCLIPPED) {
+  assert(!target.is_empty());
+  std::vector<raster_point> scratch;
+  for (size_t i = 0; i < list.size(); ++i) {
+    detail::execute_command(list, i, target, clip, scratch);
+  }
+}
+
+// The commands of a display_list sorted into square tiles of an image, for
+// replay_tiled.
+//
+// Each tile holds, in recorded order, the indices of the commands whose
+// bounds overlap the tile. Commands that are completely hidden in a tile,
+// because a later fill_rect covers that whole tile, are left out of that
+// tile.
+//
+// Binning is done once and may be reused for any number of replays, as long
+// as the display list is not changed.
+class tile_bins {
+private:
+  size_t width_, height_;
+  unsigned tile_size_;
+  size_t columns_, rows_;
+  uint64_t revision_;
+  std::vector<std::vector<uint32_t>> bins_;
+  size_t culled_;
+
+public:
+
+  // Sort the commands of list into tiles of tile_size by tile_size pixels,
+  // covering an image of width by height pixels.
+  //
+  // width, height, and tile_size must be positive.
+  tile_bins(const display_list& list,
+            size_t width, size_t height,
+            unsigned tile_size = 64)
+  : width_(width),
+    height_(height),
+    tile_size_(tile_size),
+    columns_((width + tile_size - 1) / tile_size),
+    rows_((height + tile_size - 1) / tile_size),
+    revision_(list.revision()),
+    bins_(columns_ * rows_),
+    culled_(0) {
+
+    assert(width > 0);
+    assert(height > 0);
+    assert(tile_size > 0);
+
+    // Walk the commands from last to first, so that by the time a command
+    // is reached, it is known whether a later command hides it. A tile is
+    // sealed once a fill_rect covers all of it.
+    std::vector<bool> sealed(bins_.size(), false);
+    raster_rect image{0, 0, int(width), int(height)};
+    for (size_t i = list.size(); i-- > 0; ) {
+      auto header = list.header(i);
+      raster_rect bounds = header.bounds.intersection(image);
+      if (bounds.is_empty()) {
+        continue;
+      }
+      size_t column_begin = bounds.x_min / tile_size,
+             column_end = (bounds.x_max - 1) / tile_size + 1,
+             row_begin = bounds.y_min / tile_size,
+             row_end = (bounds.y_max - 1) / tile_size + 1;
+      for (size_t row = row_begin; row < row_end; ++row) {
+        for (size_t column = column_begin; column < column_end; ++column) {
+          size_t tile = (row * columns_) + column;
+          if (sealed[tile]) {
+            ++culled_;
+            continue;
+          }
+          bins_[tile].push_back(uint32_t(i));
+          if ((header.opcode == draw_opcode::fill_rect) &&
+              bounds.contains(tile_rect(tile))) {
+            sealed[tile] = true;
+          }
+        }
+      }
+    }
+
+    for (auto& bin : bins_) {
+      std::reverse(bin.begin(), bin.end());
+    }
+  }
+
+  // Return the indices of the commands to execute in tile, in order.
+  const std::vector<uint32_t>& commands(size_t tile) const {
+    assert(tile < tile_count());
+    return bins_[tile];
+  }
+
+  // Return the number of (command, tile) pairs that were left out because
+  // the command is hidden in that tile.
+  size_t culled_count() const { return culled_; }
+
+  // Return the image dimensions the bins were built for.
+  size_t height() const { return height_; }
+  size_t width() const { return width_; }
+
+  // Return the revision of the display list the bins were built from.
+  uint64_t revision() const { return revision_; }
+
+  // Return the number of tiles.
+  size_t tile_count() const { return bins_.size(); }
+
+  // Return the pixels covered by tile, clipped to the image.
+  raster_rect tile_rect(size_t tile) const {
+    assert(tile < tile_count());
+    int x = int((tile % columns_) * tile_size_),
+        y = int((tile / columns_) * tile_size_);
+    return raster_rect{x, y,
+                       std::min(x + int(tile_size_), int(width_)),
+                       std::min(y + int(tile_size_), int(height_))};
+  }
+
+  // Return the width and height of each tile.
+  unsigned tile_size() const { return tile_size_; }
+};
+
+// Execute the commands of list on target, tile by tile, using up to
+// thread_count threads. Each tile is replayed by one thread, clipped to
+// that tile, so threads never write the same pixel. The result is identical
+// to replay(list, target), except that when target tracks dirty pixels,
+// the bounds of the commands in each tile are recorded as written.
+//
+// bins must have been built from list, in its current state, for the
+// dimensions of target. thread_count must be positive.
+void replay_tiled(const display_list& list,
+                  const tile_bins& bins,
+                  hdr_image& target,
+                  unsigned thread_count
+                    = std::max(1u, std::thread::hardware_concurrency())) {
+  assert(!target.is_empty());
+  assert(bins.revision() == list.revision());
+  assert(bins.width() == target.width());
+  assert(bins.height() == target.height());
+  assert(thread_count > 0);
+
+  // Concurrent updates of the dirty tracking state would race, so tracking
+  // is paused during the replay, and afterwards the bounds of the commands
+  // replayed in each tile are reported as written.
+  bool tracking = target.is_dirty_tracking();
+  target.set_dirty_tracking(false);
+
+  std::atomic<size_t> next_tile(0);
+  auto worker = [&]() {
+    std::vector<raster_point> scratch;
+    for (size_t tile = next_tile++;
+         tile < bins.tile_count();
+         tile = next_tile++) {
+      raster_rect clip = bins.tile_rect(tile);
+      for (auto index : bins.commands(tile)) {
+        detail::execute_command(list, index, target, clip, scratch);
+      }
+    }
+  };
+
+  thread_count = unsigned(std::min<size_t>(thread_count, bins.tile_count()));
+  std::vector<std::thread> helpers;
+  for (unsigned i = 1; i < thread_count; ++i) {
+    helpers.emplace_back(worker);
+  }
+  worker();
+  for (auto& helper : helpers) {
+    helper.join();
+  }
+
+  if (tracking) {
+    target.set_dirty_tracking(true);
+    for (size_t tile = 0; tile < bins.tile_count(); ++tile) {
+      raster_rect written{0, 0, 0, 0};
+      for (auto index : bins.commands(tile)) {
+        written = written.bounding_union(list.header(index).bounds);
+      }
+      target.mark_dirty(written.intersection(bins.tile_rect(tile)));
+    }
+  }
+}
+
+} // namespace gfx
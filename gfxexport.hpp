@@ -0,0 +1,172 @@
+
+///////////////////////////////////////////////////////////////////////////////
+// gfxexport.hpp
+//
+// Asynchronous PNG export.
+//
+// write_png blocks its caller for the whole encode and file write. A
+// png_export_queue takes ownership of a finished frame and returns at once,
+// with a future for the result; encoder threads compress the frame into
+// memory and write the file with one pwrite, while the caller renders the
+// next frame.
+//
+// This file builds upon gfximage.hpp, gfxpng.hpp, gfxcow.hpp, and
+// gfxfile.hpp, so you may want to familiarize yourself with those headers
+// before diving into this one.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+#include "gfxcow.hpp"
+#include "gfxfile.hpp"
+#include "gfximage.hpp"
+#include "gfxpng.hpp"
+
+namespace gfx {
+
+// Default number of encoder threads of a png_export_queue.
+const unsigned DEFAULT_EXPORT_THREADS = 2;
+
+// Default number of frames a png_export_queue holds before submit blocks.
+const size_t DEFAULT_EXPORT_BACKLOG = 4;
+
+// A queue of PNG files to write, served by a fixed number of encoder
+// threads.
+//
+// submit takes ownership of an image, by move or as a copy-on-write
+// snapshot, and returns a future that becomes true once the file is
+// written, or false on error; exactly what write_png would have returned.
+// Frames may finish out of order when there are several threads.
+//
+// At most max_backlog frames are held, queued or being encoded; beyond
+// that, submit blocks until a frame finishes. This bounds memory, and
+// slows a renderer that outruns the encoders.
+//
+// The destructor finishes every submitted frame before returning.
+class png_export_queue {
+private:
+
+    struct job {
+      std::variant<hdr_image, cow_image> image;
+      std::string path;
+      std::promise<bool> result;
+    };
+
+    size_t max_backlog_;
+    mutable std::mutex mutex_;
+    std::condition_variable changed_;
+    std::deque<job> queue_;
+    size_t backlog_ = 0;
+    bool stopping_ = false;
+    std::vector<std::thread> threads_;
+
+    void serve() {
+      for (;;) {
+        job next;
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          changed_.wait(lock, [&] { return stopping_ || !queue_.empty(); });
+          if (queue_.empty()) {
+            return;
+          }
+          next = std::move(queue_.front());
+          queue_.pop_front();
+        }
+
+        auto bytes = std::visit([](auto& image) { return encode_png(image); },
+                                next.image);
+        // release the pixels before the frame leaves the backlog
+        next.image = hdr_image();
+        next.result.set_value(bytes && detail::write_file(next.path, *bytes));
+
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          --backlog_;
+        }
+        changed_.notify_all();
+      }
+    }
+
+    std::future<bool> enqueue(job&& new_job) {
+      assert(!std::visit([](auto& image) { return image.is_empty(); },
+                         new_job.image));
+      std::future<bool> result = new_job.result.get_future();
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [&] { return backlog_ < max_backlog_; });
+        ++backlog_;
+        queue_.push_back(std::move(new_job));
+      }
+      changed_.notify_all();
+      return result;
+    }
+
+public:
+
+  // Start thread_count encoder threads, holding at most max_backlog
+  // frames. Both must be positive.
+  explicit png_export_queue(unsigned thread_count = DEFAULT_EXPORT_THREADS,
+                            size_t max_backlog = DEFAULT_EXPORT_BACKLOG)
+  : max_backlog_(max_backlog) {
+    assert(thread_count > 0);
+    assert(max_backlog > 0);
+    for (unsigned i = 0; i < thread_count; ++i) {
+      threads_.emplace_back([this] { serve(); });
+    }
+  }
+
+  png_export_queue(const png_export_queue&) = delete;
+  png_export_queue& operator=(const png_export_queue&) = delete;
+
+  ~png_export_queue() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    changed_.notify_all();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  // Return the number of frames queued or being encoded.
+  size_t backlog() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return backlog_;
+  }
+
+  // Return the maximum number of frames held before submit blocks.
+  size_t max_backlog() const { return max_backlog_; }
+
+  // Write image, which must be non-empty, to a PNG file at path, taking
+  // ownership of its pixels. Blocks while the backlog is full.
+  std::future<bool> submit(hdr_image&& image, const std::string& path) {
+    return enqueue(job{std::move(image), path, std::promise<bool>()});
+  }
+
+  // Write a snapshot of image, which must be non-empty, to a PNG file at
+  // path. Copying a cow_image takes constant time, and the caller may keep
+  // drawing into image; only the blocks it writes are duplicated.
+  std::future<bool> submit(const cow_image& image, const std::string& path) {
+    return enqueue(job{image, path, std::promise<bool>()});
+  }
+
+  // Block until every submitted frame has finished.
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [&] { return backlog_ == 0; });
+  }
+};
+
+} // namespace gfx
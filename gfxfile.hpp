@@ -0,0 +1,117 @@
+
+///////////////////////////////////////////////////////////////////////////////
+// gfxfile.hpp
+//
+// Small helpers for reading and writing files with the POSIX file system
+// calls, shared by the file formats and by tiled_image.
+//
+// read_file and write_file move a whole file in one pread or pwrite, with no
+// stream buffering in between, so the in-memory codecs can be used on files
+// without extra copies.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace gfx {
+
+namespace detail {
+
+// Owner of a POSIX file descriptor, which is closed on destruction. A
+// negative descriptor means no file.
+class unique_fd {
+private:
+  int fd_;
+
+public:
+  explicit unique_fd(int fd = -1) : fd_(fd) { }
+
+  unique_fd(const unique_fd&) = delete;
+  unique_fd& operator=(const unique_fd&) = delete;
+
+  unique_fd(unique_fd&& other) : fd_(other.fd_) { other.fd_ = -1; }
+
+  unique_fd& operator=(unique_fd&& other) {
+    if (this != &other) {
+      reset();
+      fd_ = other.fd_;
+      other.fd_ = -1;
+    }
+    return *this;
+  }
+
+  ~unique_fd() { reset(); }
+
+  int get() const { return fd_; }
+
+  void reset() {
+    if (fd_ >= 0) {
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+};
+
+// Read exactly count bytes at offset in fd into buffer, retrying short
+// reads. Returns true on success.
+bool pread_fully(int fd, void* buffer, size_t count, off_t offset) {
+  auto bytes = static_cast<unsigned char*>(buffer);
+  while (count > 0) {
+    ssize_t result = pread(fd, bytes, count, offset);
+    if (result <= 0) {
+      return false;
+    }
+    bytes += result;
+    count -= size_t(result);
+    offset += result;
+  }
+  return true;
+}
+
+// Write exactly count bytes from buffer at offset in fd, retrying short
+// writes. Returns true on success.
+bool pwrite_fully(int fd, const void* buffer, size_t count, off_t offset) {
+  auto bytes = static_cast<const unsigned char*>(buffer);
+  while (count > 0) {
+    ssize_t result = pwrite(fd, bytes, count, offset);
+    if (result <= 0) {
+      return false;
+    }
+    bytes += result;
+    count -= size_t(result);
+    offset += result;
+  }
+  return true;
+}
+
+// Read the whole file at path into bytes. Returns true on success.
+bool read_file(const std::string& path, std::string& bytes) {
+  unique_fd file(open(path.c_str(), O_RDONLY));
+  struct stat status;
+  if ((file.get() < 0) || (fstat(file.get(), &status) != 0)) {
+    return false;
+  }
+  bytes.resize(size_t(status.st_size));
+  return pread_fully(file.get(), bytes.data(), bytes.size(), 0);
+}
+
+// Write bytes to a file at path, replacing any existing file. Returns true
+// on success.
+bool write_file(const std::string& path, const std::string& bytes) {
+  unique_fd file(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+  if (file.get() < 0) {
+    return false;
+  }
+  return pwrite_fully(file.get(), bytes.data(), bytes.size(), 0);
+}
+
+} // namespace detail
+
+} // namespace gfx
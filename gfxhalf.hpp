@@ -0,0 +1,514 @@
+
+///////////////////////////////////////////////////////////////////////////////
+// gfxhalf.hpp
+//
+// Half-precision HDR pixel storage, and PFM (portable float map) I/O.
+//
+// hdr_rgb asserts that intensities are in [0.0, 1.0], and takes 12 bytes per
+// pixel. A half_image stores unbounded intensities, such as light values
+// above 1.0, as IEEE 754 half-precision floats, in 6 bytes per pixel; half
+// the memory and bandwidth of an hdr_image. Halves have 11 significant bits,
+// so intensities in [0.0, 1.0] are stored to within 1/4096, and multiples
+// of 1/2048 in that range exactly.
+//
+// Rows are converted between float and half all at once. When compiled with
+// F16C enabled (for example -mf16c or -march=native), eight values are
+// converted per instruction; otherwise a scalar conversion gives
+// bit-identical results.
+//
+// PFM files store 32-bit floats, so writing a half_image to one, and reading
+// it back, is lossless.
+//
+// This file builds upon gfximage.hpp, gfxcodec.hpp, and gfxfile.hpp, so you
+// may want to familiarize yourself with those headers before diving into
+// this one.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+#include "gfxcodec.hpp"
+#include "gfxfile.hpp"
+#include "gfximage.hpp"
+
+namespace gfx {
+
+namespace detail {
+
+uint32_t float_bits(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+float bits_float(uint32_t bits) {
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// Convert a float to the bits of the nearest half, rounding ties to even,
+// as the F16C instructions do. Values too large for a half become
+// infinity, and NaNs stay NaNs, made quiet.
+uint16_t float_to_half_bits(float value) {
+  uint32_t bits = float_bits(value),
+           sign = (bits >> 16) & 0x8000,
+           magnitude = bits & 0x7fffffff;
+
+  if (magnitude >= 0x7f800000) {
+    // infinity, or NaN keeping the top of its payload
+    return uint16_t(sign | 0x7c00
+                    | ((magnitude > 0x7f800000)
+                       ? (0x200 | ((magnitude >> 13) & 0x3ff)) : 0));
+  }
+  if (magnitude >= 0x477ff000) {
+    // at least 65520, which rounds past the largest half, 65504
+    return uint16_t(sign | 0x7c00);
+  }
+  if (magnitude < 0x38800000) {
+    // below the smallest normal half, 2^-14; adding 0.5 makes the float
+    // adder round to a multiple of 2^-24, the spacing of subnormal halves,
+    // which then sits in the low bits
+    float shifted = bits_float(magnitude) + 0.5f;
+    return uint16_t(sign | (float_bits(shifted) - 0x3f000000));
+  }
+  // rebias the exponent from 127 to 15, and round the 13 dropped mantissa
+  // bits to nearest, ties to even
+  uint32_t odd = (magnitude >> 13) & 1;
+  magnitude += 0xc8000fff + odd;
+  return uint16_t(sign | (magnitude >> 13));
+}
+
+// Convert the bits of a half to a float, exactly. NaNs are made quiet, as
+// the F16C instructions do.
+float half_bits_to_float(uint16_t half) {
+  uint32_t sign = uint32_t(half & 0x8000) << 16,
+           exponent = (half >> 10) & 0x1f,
+           mantissa = half & 0x3ff;
+  if (exponent == 0) {
+    // zero or subnormal: mantissa * 2^-24
+    float magnitude = float(mantissa) * (1.0f / 16777216.0f);
+    return bits_float(sign | float_bits(magnitude));
+  }
+  if (exponent == 31) {
+    return bits_float(sign | 0x7f800000
+                      | (mantissa ? (0x400000 | (mantissa << 13)) : 0));
+  }
+  return bits_float(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+// Clamp x to a valid hdr_intensity; NaN becomes 0.0.
+hdr_intensity clamp_intensity(float x) {
+  return (x > 0.0f) ? std::fmin(x, 1.0f) : 0.0f;
+}
+
+} // namespace detail
+
+// An IEEE 754 half-precision (16-bit) float.
+class half {
+private:
+
+    uint16_t bits_ = 0;
+
+public:
+
+  // Create positive zero.
+  constexpr half() { }
+
+  // Create the half nearest to value, as detail::float_to_half_bits does.
+  explicit half(float value)
+  : bits_(detail::float_to_half_bits(value)) { }
+
+  // Bitwise equality; so NaNs with equal bits are equal, and positive and
+  // negative zero are not.
+  bool operator==(const half& rhs) const { return bits_ == rhs.bits_; }
+  bool operator!=(const half& rhs) const { return bits_ != rhs.bits_; }
+
+  // Return the encoding of this half.
+  constexpr uint16_t bits() const { return bits_; }
+
+  // Create a half from its encoding.
+  static constexpr half from_bits(uint16_t bits) {
+    half result;
+    result.bits_ = bits;
+    return result;
+  }
+
+  // Return the exact value of this half as a float.
+  float to_float() const { return detail::half_bits_to_float(bits_); }
+};
+
+static_assert(sizeof(half) == 2, "half must be two bytes");
+static_assert(std::is_trivially_copyable<half>::value,
+              "half must be trivially copyable");
+
+// Convert count floats at source to halves at destination, rounding to
+// nearest, ties to even.
+void floats_to_halves(const float* source, half* destination,
+                      size_t count) {
+  size_t i = 0;
+#if defined(__F16C__)
+  for (; (i + 8) <= count; i += 8) {
+    __m128i converted = _mm256_cvtps_ph(_mm256_loadu_ps(source + i),
+                                        _MM_FROUND_TO_NEAREST_INT
+                                        | _MM_FROUND_NO_EXC);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), converted);
+  }
+#endif
+  for (; i < count; ++i) {
+    destination[i] = half(source[i]);
+  }
+}
+
+// Convert count halves at source to floats at destination, exactly.
+void halves_to_floats(const half* source, float* destination,
+                      size_t count) {
+  size_t i = 0;
+#if defined(__F16C__)
+  for (; (i + 8) <= count; i += 8) {
+    __m128i halves
+      = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+    _mm256_storeu_ps(destination + i, _mm256_cvtph_ps(halves));
+  }
+#endif
+  for (; i < count; ++i) {
+    destination[i] = source[i].to_float();
+  }
+}
+
+// An RGB color with unbounded float intensities, unlike hdr_rgb.
+struct float_rgb {
+  float r = 0.0f, g = 0.0f, b = 0.0f;
+
+  bool operator==(const float_rgb& rhs) const {
+    return (r == rhs.r) && (g == rhs.g) && (b == rhs.b);
+  }
+};
+
+// An image whose pixels are three half intensities, R, G, B, stored row by
+// row, top row first.
+//
+// A half_image has the pixel and fill_span interface of hdr_image for
+// writing hdr_rgb colors, so it can be passed to any rasterize function.
+class half_image {
+private:
+
+    size_t width_ = 0, height_ = 0;
+    std::vector<half> channels_;
+
+public:
+
+  // Create an empty image.
+  half_image() {
+    assert(is_empty());
+  }
+
+  // Create an image with the given dimensions, both positive, with every
+  // pixel set to fill_color.
+  half_image(size_t width, size_t height,
+             const float_rgb& fill_color = float_rgb())
+  : width_(width),
+    height_(height),
+    channels_(width * height * 3) {
+    assert(width > 0);
+    assert(height > 0);
+    for (size_t x = 0; x < width; ++x) {
+      pixel(x, 0, fill_color);
+    }
+    for (size_t y = 1; y < height; ++y) {
+      std::memcpy(row(y), row(0), width * 3 * sizeof(half));
+    }
+    assert(!is_empty());
+  }
+
+  // Convert image, which must be non-empty, rounding every intensity to the
+  // nearest half.
+  explicit half_image(const hdr_image& image)
+  : half_image(image.width(), image.height()) {
+    static_assert(sizeof(hdr_rgb) == 3 * sizeof(float),
+                  "hdr_rgb must be three packed floats");
+    for (size_t y = 0; y < height_; ++y) {
+      store_row(y, reinterpret_cast<const float*>(&image.pixel(0, y)));
+    }
+  }
+
+  bool operator==(const half_image& rhs) const {
+    return (width_ == rhs.width_) && (height_ == rhs.height_)
+           && (channels_ == rhs.channels_);
+  }
+
+  // Write new_value to every pixel (x, y) with x in [x_begin, x_end).
+  // y must be a valid coordinate, and x_begin <= x_end <= width().
+  void fill_span(size_t x_begin, size_t x_end, size_t y,
+                 const hdr_rgb& new_value) {
+    assert(is_y(y));
+    assert(x_begin <= x_end);
+    assert(x_end <= width());
+    for (size_t x = x_begin; x < x_end; ++x) {
+      pixel(x, y, new_value);
+    }
+  }
+
+  // Return the height of the image. An empty image has height zero.
+  size_t height() const { return height_; }
+
+  // Return true iff the image is empty.
+  bool is_empty() const { return width_ == 0; }
+
+  // Return true when x or y is a valid coordinate for this image.
+  bool is_x(size_t x) const { return x < width();  }
+  bool is_y(size_t y) const { return y < height(); }
+  bool is_xy(size_t x, size_t y) const {
+    return is_x(x) && is_y(y);
+  }
+
+  // Convert row y, which must be valid, to 3 * width() floats at
+  // destination.
+  void load_row(size_t y, float* destination) const {
+    halves_to_floats(row(y), destination, width_ * 3);
+  }
+
+  // Return the color of the pixel at (x, y), which must be valid.
+  float_rgb pixel(size_t x, size_t y) const {
+    assert(is_xy(x, y));
+    const half* channels = row(y) + (3 * x);
+    return float_rgb{channels[0].to_float(), channels[1].to_float(),
+                     channels[2].to_float()};
+  }
+
+  // Write new_value, rounded to halves, to the pixel at (x, y), which must
+  // be valid.
+  void pixel(size_t x, size_t y, const float_rgb& new_value) {
+    assert(is_xy(x, y));
+    half* channels = row(y) + (3 * x);
+    channels[0] = half(new_value.r);
+    channels[1] = half(new_value.g);
+    channels[2] = half(new_value.b);
+  }
+
+  void pixel(size_t x, size_t y, const hdr_rgb& new_value) {
+    pixel(x, y, float_rgb{new_value.r(), new_value.g(), new_value.b()});
+  }
+
+  // Return the 3 * width() halves of row y, which must be valid.
+  const half* row(size_t y) const {
+    assert(is_y(y));
+    return &channels_[y * width_ * 3];
+  }
+  half* row(size_t y) {
+    assert(is_y(y));
+    return &channels_[y * width_ * 3];
+  }
+
+  // Overwrite row y, which must be valid, with 3 * width() floats at
+  // source, rounded to halves.
+  void store_row(size_t y, const float* source) {
+    floats_to_halves(source, row(y), width_ * 3);
+  }
+
+  // Convert this image, which must be non-empty, to an hdr_image, clamping
+  // every intensity to [0.0, 1.0]; NaN becomes 0.0.
+  hdr_image to_hdr() const {
+    assert(!is_empty());
+    hdr_image result(width_, height_, BLACK);
+    std::vector<float> floats(width_ * 3);
+    for (size_t y = 0; y < height_; ++y) {
+      load_row(y, floats.data());
+      for (size_t x = 0; x < width_; ++x) {
+        const float* channels = &floats[3 * x];
+        result.pixel(x, y, hdr_rgb(detail::clamp_intensity(channels[0]),
+                                   detail::clamp_intensity(channels[1]),
+                                   detail::clamp_intensity(channels[2])));
+      }
+    }
+    return result;
+  }
+
+  // Return the width of the image. An empty image has width zero.
+  size_t width() const { return width_; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// PFM
+///////////////////////////////////////////////////////////////////////////////
+
+namespace detail {
+
+bool is_little_endian() {
+  const uint16_t probe = 1;
+  uint8_t first;
+  std::memcpy(&first, &probe, 1);
+  return first == 1;
+}
+
+// Return the floats of row y of image, converting into buffer if necessary.
+const float* float_row(const hdr_image& image, size_t y,
+                       std::vector<float>&) {
+  return reinterpret_cast<const float*>(&image.pixel(0, y));
+}
+
+const float* float_row(const half_image& image, size_t y,
+                       std::vector<float>& buffer) {
+  buffer.resize(image.width() * 3);
+  image.load_row(y, buffer.data());
+  return buffer.data();
+}
+
+// Create the decoded image of a PFM file. image_type is hdr_image or
+// half_image.
+template <typename image_type>
+image_type make_float_image(size_t width, size_t height) {
+  if constexpr (std::is_same<image_type, hdr_image>::value) {
+    return hdr_image(width, height, BLACK);
+  } else {
+    return half_image(width, height);
+  }
+}
+
+// Store 3 * width floats as row y of image; clamped to [0.0, 1.0] for an
+// hdr_image, as half_image::to_hdr does.
+void store_float_row(half_image& image, size_t y, const float* floats) {
+  image.store_row(y, floats);
+}
+
+void store_float_row(hdr_image& image, size_t y, const float* floats) {
+  for (size_t x = 0; x < image.width(); ++x) {
+    const float* channels = &floats[3 * x];
+    image.pixel(x, y, hdr_rgb(detail::clamp_intensity(channels[0]),
+                              detail::clamp_intensity(channels[1]),
+                              detail::clamp_intensity(channels[2])));
+  }
+}
+
+} // namespace detail
+
+// Encode image, which must be non-empty, as a color PFM file in memory, in
+// the byte order of this machine. image_type may be hdr_image or
+// half_image; both are stored without loss.
+template <typename image_type>
+std::string encode_pfm(const image_type& image) {
+  assert(!image.is_empty());
+
+  // the sign of the scale gives the byte order
+  std::string bytes = "PF\n" + std::to_string(image.width()) + " "
+                      + std::to_string(image.height()) + "\n"
+                      + (detail::is_little_endian() ? "-1.0\n" : "1.0\n");
+  size_t header_bytes = bytes.size(),
+         row_bytes = image.width() * 3 * sizeof(float);
+  bytes.resize(header_bytes + (row_bytes * image.height()));
+  std::vector<float> buffer;
+  for (size_t y = 0; y < image.height(); ++y) {
+    // rows are stored bottom to top
+    size_t stored = image.height() - 1 - y;
+    std::memcpy(&bytes[header_bytes + (stored * row_bytes)],
+                detail::float_row(image, y, buffer), row_bytes);
+  }
+  return bytes;
+}
+
+// Decode the bytes of a PFM file, in either byte order. image_type may be
+// half_image, which rounds intensities to halves, or hdr_image, which
+// clamps them to [0.0, 1.0]. Grayscale ("Pf") files are decoded with equal
+// R, G, and B. The absolute value of the scale is ignored.
+//
+// On success, returns a non-empty optional containing the image. When bytes
+// is not a valid PFM file, returns an empty optional object.
+template <typename image_type = half_image>
+std::optional<image_type> decode_pfm(const std::string& bytes) {
+  if ((bytes.size() < 2) || (bytes[0] != 'P')
+      || ((bytes[1] != 'F') && (bytes[1] != 'f'))) {
+    return std::nullopt;
+  }
+  size_t channels = (bytes[1] == 'F') ? 3 : 1, position = 2;
+  auto width = detail::parse_ppm_number(bytes, position),
+       height = detail::parse_ppm_number(bytes, position);
+  if (!width || !height || (*width == 0) || (*height == 0)) {
+    return std::nullopt;
+  }
+
+  // the scale, a decimal number, ends at a single whitespace byte
+  size_t scale_begin = bytes.find_first_not_of(" \t\r\n", position),
+         scale_end = bytes.find_first_of(" \t\r\n", scale_begin);
+  if ((scale_begin == std::string::npos)
+      || (scale_end == std::string::npos)) {
+    return std::nullopt;
+  }
+  std::string scale_text = bytes.substr(scale_begin, scale_end - scale_begin);
+  char* parsed_end = nullptr;
+  float scale = std::strtof(scale_text.c_str(), &parsed_end);
+  if ((parsed_end != scale_text.c_str() + scale_text.size())
+      || !std::isfinite(scale) || (scale == 0.0f)) {
+    return std::nullopt;
+  }
+  position = scale_end + 1;
+
+  uint64_t row_floats = uint64_t(*width) * channels,
+           row_bytes = row_floats * sizeof(float);
+  if ((row_bytes * *height) > (bytes.size() - position)) {
+    return std::nullopt;
+  }
+
+  bool swap = ((scale < 0.0f) != detail::is_little_endian());
+  image_type result = detail::make_float_image<image_type>(*width, *height);
+  std::vector<float> file_row(row_floats), rgb_row(size_t(*width) * 3);
+  for (size_t stored = 0; stored < *height; ++stored) {
+    std::memcpy(file_row.data(), &bytes[position + (stored * row_bytes)],
+                row_bytes);
+    if (swap) {
+      for (auto& value : file_row) {
+        uint32_t b = detail::float_bits(value);
+        value = detail::bits_float((b >> 24) | ((b >> 8) & 0xff00)
+                                   | ((b << 8) & 0xff0000) | (b << 24));
+      }
+    }
+    const float* rgb = file_row.data();
+    if (channels == 1) {
+      for (size_t x = 0; x < *width; ++x) {
+        rgb_row[(3 * x) + 0] = rgb_row[(3 * x) + 1] = rgb_row[(3 * x) + 2]
+          = file_row[x];
+      }
+      rgb = rgb_row.data();
+    }
+    detail::store_float_row(result, *height - 1 - stored, rgb);
+  }
+  return result;
+}
+
+// Read a PFM file at the given path. image_type may be half_image or
+// hdr_image, as in decode_pfm.
+//
+// On success, returns a non-empty optional containing the image. On I/O
+// error, or when the file is not a valid PFM file, returns an empty
+// optional object.
+template <typename image_type = half_image>
+std::optional<image_type> read_pfm(const std::string& path) {
+  std::string bytes;
+  if (!detail::read_file(path, bytes)) {
+    return std::nullopt;
+  }
+  return decode_pfm<image_type>(bytes);
+}
+
+// Write image, which must be non-empty, to a color PFM file at the given
+// path. image_type may be hdr_image or half_image.
+//
+// Returns true on success and false on I/O error.
+template <typename image_type>
+bool write_pfm(const image_type& image, const std::string& path) {
+  return detail::write_file(path, encode_pfm(image));
+}
+
+} // namespace gfx
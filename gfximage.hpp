@@ -17,10 +17,14 @@
 #include <algorithm>
 #include <array>
 #include <cstdint>
+#include <cstring>
 #include <functional>
+#include <memory>
+#include <type_traits>
 #include <vector>
 
 #include "gfxnumeric.hpp" // for approx_equal
+#include "gfxpool.hpp"
 
 namespace gfx {
 
@@ -176,13 +180,131 @@ const hdr_rgb WHITE  (hdr_rgb::from_hex(0xFFFFFF)),
               FUSCHIA(hdr_rgb::from_hex(0xFF00FF)),
               PURPLE (hdr_rgb::from_hex(0x800080));
 
+// An axis-aligned rectangle of pixels; the half-open ranges
+// x_min <= x < x_max and y_min <= y < y_max. Rectangles describe regions of
+// an image, such as the clip rectangles of the primitives in
+// gfxrasterize.hpp, which restrict drawing to the pixels inside them.
+struct raster_rect {
+  int x_min, y_min, x_max, y_max;
+
+  // Return true iff the rectangle contains no pixels.
+  constexpr bool is_empty() const {
+    return (x_min >= x_max) || (y_min >= y_max);
+  }
+
+  // Return true iff pixel (x, y) is inside the rectangle.
+  constexpr bool contains(int x, int y) const {
+    return (x >= x_min) && (x < x_max) && (y >= y_min) && (y < y_max);
+  }
+
+  // Return true iff every pixel of other is inside this rectangle. An empty
+  // other is contained in every rectangle.
+  constexpr bool contains(const raster_rect& other) const {
+    return (other.is_empty() ||
+            ((other.x_min >= x_min) && (other.x_max <= x_max) &&
+             (other.y_min >= y_min) && (other.y_max <= y_max)));
+  }
+
+  // Return true iff the rectangles have at least one pixel in common.
+  constexpr bool intersects(const raster_rect& other) const {
+    return !intersection(other).is_empty();
+  }
+
+  // Return the rectangle of pixels inside both rectangles. The result may
+  // be empty.
+  constexpr raster_rect intersection(const raster_rect& other) const {
+    return raster_rect{std::max(x_min, other.x_min),
+                       std::max(y_min, other.y_min),
+                       std::min(x_max, other.x_max),
+                       std::min(y_max, other.y_max)};
+  }
+
+  // Return the smallest rectangle containing every pixel of both
+  // rectangles. An empty rectangle contributes no pixels.
+  constexpr raster_rect bounding_union(const raster_rect& other) const {
+    if (is_empty()) {
+      return other;
+    } else if (other.is_empty()) {
+      return *this;
+    } else {
+      return raster_rect{std::min(x_min, other.x_min),
+                         std::min(y_min, other.y_min),
+                         std::max(x_max, other.x_max),
+                         std::max(y_max, other.y_max)};
+    }
+  }
+};
+
 // A 2D raster image; a grid of pixels, where each pixel is an hdr_rgb.
 //
 // An hdr_image can be in either an empty state, containing no pixels, or
 // in a nonempty state with positive width and positive height.
+//
+// Pixels are stored contiguously, row after row, in one block from
+// default_buffer_pool(), so creating and destroying images of similar sizes
+// reuses memory instead of allocating it.
+//
+// An image can optionally track which pixels have been written since the
+// last call to reset_dirty; see set_dirty_tracking. Every write through
+// pixel, fill_span, fill, or resize is recorded, as a range of columns per
+// row, so the primitives of gfxrasterize.hpp are tracked automatically.
 class hdr_image {
 private:
-    std::vector<std::vector<hdr_rgb>> rows_;
+    // Columns x_begin <= x < x_end of one row have been written. The row is
+    // clean when the range is empty.
+    struct dirty_span {
+      size_t x_begin, x_end;
+    };
+
+    static_assert(std::is_trivially_destructible<hdr_rgb>::value,
+                  "pooled pixels are released without destruction");
+
+    hdr_rgb* pixels_ = nullptr;
+    size_t capacity_ = 0, width_ = 0, height_ = 0;
+    bool dirty_tracking_ = false;
+    std::vector<dirty_span> dirty_; // one per row, while tracking
+
+    void mark_dirty_span(size_t x_begin, size_t x_end, size_t y) {
+      auto& span = dirty_[y];
+      if (span.x_begin >= span.x_end) {
+        span = dirty_span{x_begin, x_end};
+      } else {
+        span.x_begin = std::min(span.x_begin, x_begin);
+        span.x_end = std::max(span.x_end, x_end);
+      }
+    }
+
+    void mark_all_dirty() {
+      dirty_.assign(height(), dirty_span{0, width()});
+    }
+
+    // Replace this image's storage with an uninitialized block from the
+    // pool, with room for at least count pixels, and make the image empty.
+    void acquire_pixels(size_t count) {
+      release_pixels();
+      size_t bytes = buffer_pool::block_bytes(count * sizeof(hdr_rgb));
+      pixels_ = static_cast<hdr_rgb*>(default_buffer_pool().acquire(bytes));
+      capacity_ = bytes / sizeof(hdr_rgb);
+    }
+
+    // Return this image's storage to the pool, and make the image empty.
+    void release_pixels() {
+      if (pixels_) {
+        default_buffer_pool().release(pixels_, capacity_ * sizeof(hdr_rgb));
+      }
+      pixels_ = nullptr;
+      capacity_ = width_ = height_ = 0;
+    }
+
+    // Move the storage to a new block with room for at least count pixels,
+    // keeping the current pixels.
+    void reallocate(size_t count) {
+      hdr_image moved;
+      moved.acquire_pixels(count);
+      std::uninitialized_copy_n(pixels_, width_ * height_, moved.pixels_);
+      std::swap(pixels_, moved.pixels_);
+      std::swap(capacity_, moved.capacity_);
+    }
 
 public:
 
@@ -195,15 +317,66 @@ public:
   // width and height must both be positive.
   hdr_image(size_t width,
             size_t height,
-            const hdr_rgb& fill_color)
-  : rows_(height, std::vector<hdr_rgb>(width, fill_color)) {
+            const hdr_rgb& fill_color) {
     assert(width > 0);
     assert(height > 0);
+    size_t count = width * height;
+    acquire_pixels(count);
+    width_ = width;
+    height_ = height;
+    std::uninitialized_fill_n(pixels_, count, fill_color);
     assert(!is_empty());
   }
 
   // Copy constructor.
-  hdr_image(const hdr_image&) = default;
+  hdr_image(const hdr_image& other)
+  : dirty_tracking_(other.dirty_tracking_),
+    dirty_(other.dirty_) {
+    if (!other.is_empty()) {
+      acquire_pixels(other.width_ * other.height_);
+      width_ = other.width_;
+      height_ = other.height_;
+      std::uninitialized_copy_n(other.pixels_, width_ * height_, pixels_);
+    }
+  }
+
+  // Move constructor; other is left empty. This is noexcept so that
+  // containers of images move, rather than copy, them when growing.
+  hdr_image(hdr_image&& other) noexcept
+  : hdr_image() {
+    swap(other);
+  }
+
+  ~hdr_image() { release_pixels(); }
+
+  // Copy assignment. When this image's capacity suffices, the pixels are
+  // copied into its existing storage, without allocating.
+  hdr_image& operator=(const hdr_image& other) {
+    if (this != &other) {
+      size_t count = other.width_ * other.height_;
+      if (capacity_ < count) {
+        acquire_pixels(count);
+      }
+      std::copy_n(other.pixels_, count, pixels_);
+      width_ = other.width_;
+      height_ = other.height_;
+      dirty_tracking_ = other.dirty_tracking_;
+      dirty_ = other.dirty_;
+    }
+    return *this;
+  }
+
+  // Move assignment. This image's storage is released, and other is left
+  // empty, with no storage.
+  hdr_image& operator=(hdr_image&& other) noexcept {
+    if (this != &other) {
+      release_pixels();
+      dirty_tracking_ = false;
+      dirty_.clear();
+      swap(other);
+    }
+    return *this;
+  }
 
   // Create an image with the same dimensions as other, but all pixels are
   // initialized to fill_color.
@@ -216,12 +389,7 @@ public:
   // images count as ==.
   bool operator==(const hdr_image& rhs) const {
     return (is_same_size(rhs) &&
-            std::equal(rows_.begin(),
-                       rows_.end(),
-                       rhs.rows_.begin(),
-                       [](auto& l, auto& r) {
-                         return std::equal(l.begin(), l.end(), r.begin());
-                       }));
+            std::equal(pixels_, pixels_ + (width_ * height_), rhs.pixels_));
   }
 
   // Approximate equality. To be approximately equal, both images must have
@@ -244,42 +412,112 @@ public:
     return true;
   }
 
-  // Make the image empty.
+  // Assign every pixel of row y, which must be a valid coordinate, from
+  // width() pixels at pixels, stored in the memory layout of hdr_rgb; one
+  // memcpy, for bulk loading. Every pixel must hold valid intensities.
+  void assign_row(size_t y, const void* pixels) {
+    assert(is_y(y));
+    std::memcpy(pixels_ + (y * width_), pixels, width_ * sizeof(hdr_rgb));
+    if (dirty_tracking_) {
+      mark_dirty_span(0, width_, y);
+    }
+  }
+
+  // Return the number of pixels the image can hold without allocating
+  // storage.
+  size_t capacity() const { return capacity_; }
+
+  // Make the image empty. Its storage is kept for reuse; call shrink_to_fit
+  // afterwards to release it.
   void clear() {
-    rows_.clear();
+    width_ = height_ = 0;
+    dirty_.clear();
     assert(is_empty());
   }
 
+  // Return the smallest rectangle containing every pixel written since
+  // dirty tracking was turned on or last reset. Returns an empty rectangle
+  // when no pixel has been written.
+  raster_rect dirty_bounds() const {
+    raster_rect bounds{0, 0, 0, 0};
+    for (size_t y = 0; y < dirty_.size(); ++y) {
+      auto& span = dirty_[y];
+      bounds = bounds.bounding_union(raster_rect{int(span.x_begin), int(y),
+                                                 int(span.x_end), int(y + 1)});
+    }
+    return bounds;
+  }
+
+  // Return a list of disjoint rectangles that together contain exactly the
+  // columns written in each row, since dirty tracking was turned on or last
+  // reset. Consecutive rows with identical dirty columns are merged into one
+  // rectangle. The rectangles are sorted from top to bottom, and the list
+  // is empty when no pixel has been written.
+  std::vector<raster_rect> dirty_rects() const {
+    std::vector<raster_rect> rects;
+    for (size_t y = 0; y < dirty_.size(); ++y) {
+      auto& span = dirty_[y];
+      if (span.x_begin >= span.x_end) {
+        continue;
+      }
+      if (!rects.empty() &&
+          (rects.back().y_max == int(y)) &&
+          (rects.back().x_min == int(span.x_begin)) &&
+          (rects.back().x_max == int(span.x_end))) {
+        ++rects.back().y_max;
+      } else {
+        rects.push_back(raster_rect{int(span.x_begin), int(y),
+                                    int(span.x_end), int(y + 1)});
+      }
+    }
+    return rects;
+  }
+
   // Set every pixel to fill_color.
   void fill(const hdr_rgb& fill_color) {
-    for (auto& row : rows_) {
-      row.assign(width(), fill_color);
+    std::fill_n(pixels_, width_ * height_, fill_color);
+    if (dirty_tracking_) {
+      mark_all_dirty();
     }
   }
 
-  // Return the height of the image. An empty image has height zero.
-  size_t height() const {
-    if (is_empty()) {
-      return 0;
-    } else {
-      return rows_.size();
+  // Assign every pixel (x, y) with x in the half-open range [x_begin, x_end)
+  // to new_value; a horizontal run of pixels within one row.
+  // y must be a valid coordinate, and x_begin <= x_end <= width().
+  void fill_span(size_t x_begin, size_t x_end, size_t y,
+                 const hdr_rgb& new_value) {
+    assert(is_y(y));
+    assert(x_begin <= x_end);
+    assert(x_end <= width());
+    hdr_rgb* row = pixels_ + (y * width_);
+    std::fill(row + x_begin, row + x_end, new_value);
+    if (dirty_tracking_ && (x_begin < x_end)) {
+      mark_dirty_span(x_begin, x_end, y);
     }
   }
 
+  // Return the height of the image. An empty image has height zero.
+  size_t height() const { return height_; }
+
+  // Return true iff any pixel has been written since dirty tracking was
+  // turned on or last reset.
+  bool is_dirty() const {
+    return std::any_of(dirty_.begin(),
+                       dirty_.end(),
+                       [](auto& span) { return span.x_begin < span.x_end; });
+  }
+
+  // Return true iff writes are currently being tracked.
+  bool is_dirty_tracking() const { return dirty_tracking_; }
+
   // Return true iff the image is empty.
-  bool is_empty() const { return rows_.empty(); }
+  bool is_empty() const { return width_ == 0; }
 
   // Return true iff every pixel is == to color.
   bool is_every_pixel(const hdr_rgb& color) const {
-    return std::all_of(rows_.begin(),
-                       rows_.end(),
-                       [&](auto& row) {
-                         return std::all_of(row.begin(),
-                                            row.end(),
-                                            [&](auto& pixel) {
-                                              return (pixel == color);
-                                            });
-                       });
+    return std::all_of(pixels_,
+                       pixels_ + (width_ * height_),
+                       [&](auto& pixel) { return (pixel == color); });
   }
 
   // Return true when x or y is a valid coordinate for this image. When an
@@ -296,18 +534,40 @@ public:
     return (width() == other.width()) && (height() == other.height());
   }
 
+  // Record every pixel of rect as written, as if it had been assigned.
+  // rect is clipped to the image bounds. Does nothing unless dirty tracking
+  // is on.
+  //
+  // This is for code that writes pixels while tracking is temporarily
+  // off, such as parallel renderers, where concurrent updates of the
+  // tracking state would be unsafe.
+  void mark_dirty(const raster_rect& rect) {
+    if (!dirty_tracking_) {
+      return;
+    }
+    raster_rect bounds = rect.intersection(raster_rect{0, 0,
+                                                       int(width()),
+                                                       int(height())});
+    for (int y = bounds.y_min; y < bounds.y_max; ++y) {
+      mark_dirty_span(bounds.x_min, bounds.x_max, y);
+    }
+  }
+
   // Return the pixel color at (x, y).
   // x and y must both be valid coordinates according to is_xy.
   const hdr_rgb& pixel(size_t x, size_t y) const {
     assert(is_xy(x, y));
-    return rows_[y][x];
+    return pixels_[(y * width_) + x];
   }
 
   // Assign the pixel at (x, y) to new_value.
   // x and y must both be valid coordinates according to is_xy.
   void pixel(size_t x, size_t y, const hdr_rgb& new_value) {
     assert(is_xy(x, y));
-    rows_[y][x] = new_value;
+    pixels_[(y * width_) + x] = new_value;
+    if (dirty_tracking_) {
+      mark_dirty_span(x, x + 1, y);
+    }
   }
 
   // Change dimensions to new_width and new_height.
@@ -327,26 +587,129 @@ public:
       return;
     }
 
-    // fix number of rows; this may add empty rows if necessary
-    rows_.resize(new_height);
+    if (capacity_ < (new_width * new_height)) {
+      reallocate(new_width * new_height);
+    }
+
+    // Rearrange the kept rows to the new row length within the storage.
+    // When rows grow, move them from the bottom up, and otherwise from the
+    // top down, so no row is overwritten before it has moved.
+    size_t kept_width = std::min(width_, new_width),
+           kept_height = std::min(height_, new_height);
+    auto move_row = [&](size_t y) {
+      hdr_rgb* source = pixels_ + (y * width_);
+      hdr_rgb* row = pixels_ + (y * new_width);
+      if (new_width > width_) {
+        std::copy_backward(source, source + kept_width, row + kept_width);
+      } else {
+        std::copy(source, source + kept_width, row);
+      }
+      std::fill(row + kept_width, row + new_width, fill_color);
+    };
+    if (new_width > width_) {
+      for (size_t y = kept_height; y-- > 0; ) {
+        move_row(y);
+      }
+    } else {
+      for (size_t y = 0; y < kept_height; ++y) {
+        move_row(y);
+      }
+    }
+    std::fill(pixels_ + (kept_height * new_width),
+              pixels_ + (new_height * new_width),
+              fill_color);
+    width_ = new_width;
+    height_ = new_height;
+
+    if (dirty_tracking_) {
+      mark_all_dirty();
+    } else {
+      dirty_.clear();
+    }
+  }
 
-    // fix number of columns
-    for (auto& row : rows_) {
-      row.resize(new_width, fill_color);
+  // Make room for at least count pixels, so that the image can later be
+  // resized or reshaped to up to count pixels without allocating. Pixels
+  // are kept. Does nothing when the capacity is already sufficient.
+  void reserve(size_t count) {
+    if (capacity_ < count) {
+      reallocate(count);
     }
   }
 
-  // Swap contents with another image.
-  void swap(hdr_image& other) { rows_.swap(other.rows_); }
+  // Forget every write recorded so far, so that the image is clean. Does
+  // not change whether tracking is on.
+  void reset_dirty() {
+    dirty_.assign(dirty_tracking_ ? height() : 0, dirty_span{0, 0});
+  }
 
-  // Return the width of the image. An empty image has width zero.
-  size_t width() const {
-    if (is_empty()) {
-      return 0;
+  // Change dimensions to new_width and new_height, and set every pixel to
+  // fill_color. Unlike resize, the old pixels are not kept, so the storage
+  // is reused in place whenever its capacity suffices.
+  //
+  // Both new_width and new_height must be positive.
+  void reshape(size_t new_width,
+               size_t new_height,
+               const hdr_rgb& fill_color = BLACK) {
+    assert(new_width > 0);
+    assert(new_height > 0);
+
+    size_t count = new_width * new_height;
+    if (capacity_ < count) {
+      acquire_pixels(count);
+    }
+    width_ = new_width;
+    height_ = new_height;
+    std::fill_n(pixels_, count, fill_color);
+
+    if (dirty_tracking_) {
+      mark_all_dirty();
     } else {
-      return rows_.front().size();
+      dirty_.clear();
     }
   }
+
+  // Turn dirty tracking on or off.
+  //
+  // While tracking is off, writes are not recorded. Turning tracking off
+  // keeps the writes recorded so far, and turning it back on resumes from
+  // them, so a renderer may pause tracking, write pixels, turn tracking
+  // back on, and report its writes with mark_dirty. An image that has never
+  // been tracked, or has been resized since, starts clean.
+  void set_dirty_tracking(bool on) {
+    if (on && !dirty_tracking_) {
+      dirty_tracking_ = true;
+      if (dirty_.size() != height()) {
+        reset_dirty();
+      }
+    }
+    dirty_tracking_ = on;
+  }
+
+  // Release storage beyond what the current pixels need. An empty image
+  // releases all of its storage.
+  void shrink_to_fit() {
+    size_t count = width_ * height_;
+    if (count == 0) {
+      release_pixels();
+    } else if (capacity_ > buffer_pool::block_bytes(count * sizeof(hdr_rgb))
+                           / sizeof(hdr_rgb)) {
+      reallocate(count);
+    }
+  }
+
+  // Swap contents, including dirty tracking state, with another image.
+  void swap(hdr_image& other) noexcept {
+    std::swap(pixels_, other.pixels_);
+    std::swap(capacity_, other.capacity_);
+    std::swap(width_, other.width_);
+    std::swap(height_, other.height_);
+    std::swap(dirty_tracking_, other.dirty_tracking_);
+    dirty_.swap(other.dirty_);
+  }
+
+  // Return the width of the image. An empty image has width zero.
+  size_t width() const { return width_; }
 };
 
 } // namespace gfx
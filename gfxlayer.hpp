@@ -0,0 +1,367 @@
+
+///////////////////////////////////////////////////////////////////////////////
+// gfxlayer.hpp
+//
+// Parallel drawing with one private layer per thread.
+//
+// Each worker thread rasterizes its share of the primitives into its own
+// sparse_layer, with no synchronization at all. A layer only allocates the
+// tiles that its primitives touch, and records, for every pixel it covers,
+// the sequence number of the primitive that wrote it. Then
+// composite_layers merges the layers into the target image, tile by tile on
+// several threads, keeping the highest sequence number at each pixel; so the
+// result is bit-identical to drawing every primitive serially, in sequence
+// order.
+//
+// This is an alternative to concurrent_image in gfxconcurrent.hpp, which
+// shares one image between threads and pays for an atomic operation per
+// pixel instead.
+//
+// This file builds upon gfximage.hpp and gfxrasterize.hpp, so you may want
+// to familiarize yourself with those headers before diving into this one.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "gfximage.hpp"
+#include "gfxrasterize.hpp"
+
+namespace gfx {
+
+// Default width and height, in pixels, of the tiles of a sparse_layer.
+const size_t DEFAULT_LAYER_TILE_SIZE = 64;
+
+// A sparse drawing layer, meant to be written by one thread.
+//
+// The layer is divided into square tiles, allocated on the first write to
+// each one. Every pixel holds a color and the sequence number of the write
+// that set it; sequence number zero means the pixel is uncovered. Writes are
+// tagged with the layer's current sequence number, set with set_sequence,
+// and a write never replaces one with a higher sequence number.
+//
+// A sparse_layer has the pixel and fill_span interface of hdr_image, so it
+// can be passed to any rasterize function.
+class sparse_layer {
+private:
+
+    struct tile {
+      std::vector<hdr_rgb> colors;
+      std::vector<uint32_t> sequences;
+    };
+
+    size_t width_ = 0, height_ = 0, tile_size_ = DEFAULT_LAYER_TILE_SIZE,
+           tiles_across_ = 0;
+    uint32_t sequence_ = 1;
+    std::vector<std::unique_ptr<tile>> tiles_;
+
+    // cache of the last tile written, since consecutive writes are usually
+    // to neighboring pixels
+    size_t last_index_ = SIZE_MAX;
+    tile* last_tile_ = nullptr;
+
+    size_t tile_index(size_t x, size_t y) const {
+      return ((y / tile_size_) * tiles_across_) + (x / tile_size_);
+    }
+
+    size_t offset_in_tile(size_t x, size_t y) const {
+      return ((y % tile_size_) * tile_size_) + (x % tile_size_);
+    }
+
+    tile& writable_tile(size_t x, size_t y) {
+      size_t index = tile_index(x, y);
+      if (index != last_index_) {
+        auto& slot = tiles_[index];
+        if (!slot) {
+          slot = std::make_unique<tile>();
+          slot->colors.resize(tile_size_ * tile_size_);
+          slot->sequences.assign(tile_size_ * tile_size_, 0);
+        }
+        last_index_ = index;
+        last_tile_ = slot.get();
+      }
+      return *last_tile_;
+    }
+
+public:
+
+  // Create an empty layer.
+  sparse_layer() {
+    assert(is_empty());
+  }
+
+  // Create a layer with the given dimensions and tile size, all positive,
+  // with every pixel uncovered.
+  sparse_layer(size_t width,
+               size_t height,
+               size_t tile_size = DEFAULT_LAYER_TILE_SIZE)
+  : width_(width),
+    height_(height),
+    tile_size_(tile_size),
+    tiles_across_((width + tile_size - 1) / tile_size),
+    tiles_(tiles_across_ * ((height + tile_size - 1) / tile_size)) {
+    assert(width > 0);
+    assert(height > 0);
+    assert(tile_size > 0);
+    assert(!is_empty());
+  }
+
+  sparse_layer(const sparse_layer&) = delete;
+  sparse_layer& operator=(const sparse_layer&) = delete;
+  sparse_layer(sparse_layer&&) = default;
+  sparse_layer& operator=(sparse_layer&&) = default;
+
+  // Return the number of tiles that have been written.
+  size_t allocated_tile_count() const {
+    return std::count_if(tiles_.begin(), tiles_.end(),
+                         [](auto& slot) { return bool(slot); });
+  }
+
+  // Make every pixel uncovered, keeping allocated tiles for reuse.
+  void clear() {
+    for (auto& slot : tiles_) {
+      if (slot) {
+        std::fill(slot->sequences.begin(), slot->sequences.end(), 0);
+      }
+    }
+  }
+
+  // Return true iff the pixel at (x, y) has been written.
+  bool covers(size_t x, size_t y) const { return sequence(x, y) != 0; }
+
+  // Write new_value to every pixel (x, y) with x in [x_begin, x_end).
+  // y must be a valid coordinate, and x_begin <= x_end <= width().
+  void fill_span(size_t x_begin, size_t x_end, size_t y,
+                 const hdr_rgb& new_value) {
+    assert(is_y(y));
+    assert(x_begin <= x_end);
+    assert(x_end <= width());
+    for (size_t x = x_begin; x < x_end; ++x) {
+      pixel(x, y, new_value);
+    }
+  }
+
+  // Return the height of the layer. An empty layer has height zero.
+  size_t height() const { return height_; }
+
+  // Return true iff the layer is empty.
+  bool is_empty() const { return width_ == 0; }
+
+  // Return true when x or y is a valid coordinate for this layer.
+  bool is_x(size_t x) const { return x < width();  }
+  bool is_y(size_t y) const { return y < height(); }
+  bool is_xy(size_t x, size_t y) const {
+    return is_x(x) && is_y(y);
+  }
+
+  // Return the pixel color at (x, y), or BLACK if it is uncovered.
+  // x and y must both be valid coordinates according to is_xy.
+  hdr_rgb pixel(size_t x, size_t y) const {
+    assert(is_xy(x, y));
+    const auto& slot = tiles_[tile_index(x, y)];
+    size_t offset = offset_in_tile(x, y);
+    return (slot && slot->sequences[offset]) ? slot->colors[offset] : BLACK;
+  }
+
+  // Write new_value to the pixel at (x, y), with the current sequence
+  // number. x and y must both be valid coordinates according to is_xy.
+  void pixel(size_t x, size_t y, const hdr_rgb& new_value) {
+    assert(is_xy(x, y));
+    tile& t = writable_tile(x, y);
+    size_t offset = offset_in_tile(x, y);
+    if (t.sequences[offset] <= sequence_) {
+      t.sequences[offset] = sequence_;
+      t.colors[offset] = new_value;
+    }
+  }
+
+  // Return the sequence number of later writes.
+  uint32_t sequence() const { return sequence_; }
+
+  // Return the sequence number of the write that set the pixel at (x, y),
+  // or zero if it is uncovered.
+  uint32_t sequence(size_t x, size_t y) const {
+    assert(is_xy(x, y));
+    const auto& slot = tiles_[tile_index(x, y)];
+    return slot ? slot->sequences[offset_in_tile(x, y)] : 0;
+  }
+
+  // Change the sequence number of later writes, which must be positive.
+  void set_sequence(uint32_t sequence) {
+    assert(sequence > 0);
+    sequence_ = sequence;
+  }
+
+  // Return the number of tiles in the layer, allocated or not.
+  size_t tile_count() const { return tiles_.size(); }
+
+  // Return the width and height of tiles.
+  size_t tile_size() const { return tile_size_; }
+
+  // Return the width of the layer. An empty layer has width zero.
+  size_t width() const { return width_; }
+
+  friend void composite_layers(hdr_image& target,
+                               const std::vector<sparse_layer>& layers,
+                               unsigned thread_count);
+};
+
+// Copy the covered pixels of every layer into target. Where several layers
+// cover a pixel, the one with the highest sequence number wins; where two
+// layers have equal sequence numbers, the later layer in layers wins.
+//
+// Every layer must have the dimensions of target and the same tile size.
+// Tiles are handed out to thread_count threads one at a time, so the work
+// balances even when the drawing is concentrated in a few tiles. When
+// target tracks dirty pixels, every tile covered by any layer is marked
+// dirty as a whole.
+void composite_layers(hdr_image& target,
+                      const std::vector<sparse_layer>& layers,
+                      unsigned thread_count) {
+  assert(thread_count > 0);
+  if (layers.empty()) {
+    return;
+  }
+  const sparse_layer& first = layers.front();
+  for (auto& layer : layers) {
+    assert(layer.width() == target.width());
+    assert(layer.height() == target.height());
+    assert(layer.tile_size() == first.tile_size());
+  }
+
+  size_t tile_size = first.tile_size(),
+         tiles_across = first.tiles_across_,
+         tile_count = first.tile_count();
+
+  // Concurrent updates of the dirty tracking state would race, so tracking
+  // is paused while compositing, and afterwards every composited tile is
+  // reported as written.
+  bool tracking = target.is_dirty_tracking();
+  target.set_dirty_tracking(false);
+  std::vector<char> composited(tile_count, false);
+
+  // each tile belongs to exactly one thread, so the writes to target never
+  // overlap
+  std::atomic<size_t> next_tile{0};
+  auto work = [&]() {
+    std::vector<const sparse_layer::tile*> present;
+    for (size_t index; (index = next_tile++) < tile_count; ) {
+      present.clear();
+      for (auto& layer : layers) {
+        if (layer.tiles_[index]) {
+          present.push_back(layer.tiles_[index].get());
+        }
+      }
+      if (present.empty()) {
+        continue;
+      }
+      composited[index] = true;
+
+      size_t x_begin = (index % tiles_across) * tile_size,
+             y_begin = (index / tiles_across) * tile_size,
+             x_end = std::min(target.width(), x_begin + tile_size),
+             y_end = std::min(target.height(), y_begin + tile_size);
+      for (size_t y = y_begin; y < y_end; ++y) {
+        for (size_t x = x_begin; x < x_end; ++x) {
+          size_t offset = ((y - y_begin) * tile_size) + (x - x_begin);
+          const sparse_layer::tile* winner = nullptr;
+          uint32_t best = 0;
+          for (auto* t : present) {
+            if (t->sequences[offset] && (t->sequences[offset] >= best)) {
+              best = t->sequences[offset];
+              winner = t;
+            }
+          }
+          if (winner) {
+            target.pixel(x, y, winner->colors[offset]);
+          }
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < thread_count; ++i) {
+    threads.emplace_back(work);
+  }
+  work();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  if (tracking) {
+    target.set_dirty_tracking(true);
+    for (size_t index = 0; index < tile_count; ++index) {
+      if (composited[index]) {
+        int x_min = int((index % tiles_across) * tile_size),
+            y_min = int((index / tiles_across) * tile_size);
+        target.mark_dirty(raster_rect{x_min, y_min,
+                                      x_min + int(tile_size),
+                                      y_min + int(tile_size)});
+      }
+    }
+  }
+}
+
+// Draw every segment in segments with the corresponding color in colors,
+// using thread_count threads, each drawing a contiguous share of the
+// segments into a private layer, and then composite the layers into
+// target. The result is bit-identical to calling rasterize_line_segment on
+// each segment in order.
+//
+// colors must be the same length as segments, every endpoint must be a
+// valid coordinate in target, and thread_count must be positive;
+// std::thread::hardware_concurrency() is a reasonable choice.
+void rasterize_line_segments_layered(hdr_image& target,
+                                     const std::vector<line_segment>& segments,
+                                     const std::vector<hdr_rgb>& colors,
+                                     unsigned thread_count,
+                                     size_t tile_size
+                                       = DEFAULT_LAYER_TILE_SIZE) {
+  assert(!target.is_empty());
+  assert(colors.size() == segments.size());
+  assert(thread_count > 0);
+  assert(segments.size() < UINT32_MAX);
+
+  size_t count = segments.size(),
+         chunk = std::max(size_t(1),
+                          (count + thread_count - 1) / thread_count),
+         layer_count = (count + chunk - 1) / chunk;
+  std::vector<sparse_layer> layers;
+  for (size_t i = 0; i < layer_count; ++i) {
+    layers.emplace_back(target.width(), target.height(), tile_size);
+  }
+
+  auto draw = [&](size_t layer_index) {
+    sparse_layer& layer = layers[layer_index];
+    size_t end = std::min(count, (layer_index + 1) * chunk);
+    for (size_t i = layer_index * chunk; i < end; ++i) {
+      auto& segment = segments[i];
+      layer.set_sequence(uint32_t(i + 1));
+      rasterize_line_segment(layer, segment.x0, segment.y0,
+                             segment.x1, segment.y1, colors[i]);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < layer_count; ++i) {
+    threads.emplace_back(draw, i);
+  }
+  if (layer_count > 0) {
+    draw(0);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  composite_layers(target, layers, thread_count);
+}
+
+} // namespace gfx
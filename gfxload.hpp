@@ -0,0 +1,92 @@
+
+///////////////////////////////////////////////////////////////////////////////
+// gfxload.hpp
+//
+// Parallel loading of many PNG files.
+//
+// read_pngs decodes a list of files on several threads, instead of calling
+// read_png on each file in turn. Before decoding starts, the kernel is asked
+// to read every file ahead, so on a cold cache the disk reads of later files
+// overlap the decoding of earlier ones.
+//
+// This file builds upon gfximage.hpp, gfxpng.hpp, and gfxfile.hpp, so you
+// may want to familiarize yourself with those headers before diving into
+// this one.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "gfxfile.hpp"
+#include "gfximage.hpp"
+#include "gfxpng.hpp"
+
+namespace gfx {
+
+namespace detail {
+
+// Ask the kernel to start reading the file at path into the page cache,
+// without waiting for it. Failures are ignored; the file is just read
+// later, on demand.
+void prefetch_file(const std::string& path) {
+  unique_fd file(open(path.c_str(), O_RDONLY));
+  if (file.get() >= 0) {
+    posix_fadvise(file.get(), 0, 0, POSIX_FADV_WILLNEED);
+  }
+}
+
+} // namespace detail
+
+// Read the PNG files at paths, on thread_count threads.
+//
+// Returns one result per path, in the same order as paths: a non-empty
+// optional<hdr_image> for each file read successfully, and an empty
+// optional for each file that could not be read or decoded, exactly as
+// read_png would. An error in one file does not affect the others.
+//
+// thread_count must be positive; std::thread::hardware_concurrency() is a
+// reasonable choice. Files are handed out to threads one at a time, so a
+// few large files do not hold up the rest. Decoded images take their
+// storage from default_buffer_pool, like every hdr_image.
+std::vector<std::optional<hdr_image>>
+read_pngs(const std::vector<std::string>& paths, unsigned thread_count) {
+  assert(thread_count > 0);
+
+  for (auto& path : paths) {
+    detail::prefetch_file(path);
+  }
+
+  std::vector<std::optional<hdr_image>> results(paths.size());
+  std::atomic<size_t> next{0};
+  auto work = [&]() {
+    std::string bytes;
+    for (size_t i; (i = next++) < paths.size(); ) {
+      if (detail::read_file(paths[i], bytes)) {
+        results[i] = decode_png(bytes);
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  size_t used = std::min(size_t(thread_count), paths.size());
+  for (size_t i = 1; i < used; ++i) {
+    threads.emplace_back(work);
+  }
+  work();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return results;
+}
+
+} // namespace gfx
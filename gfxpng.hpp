@@ -2,10 +2,10 @@
 ///////////////////////////////////////////////////////////////////////////////
 // gfxpng.hpp
 //
-// Read/write PNG images.
+// Read/write PNG images, from files or from bytes in memory.
 //
-// This file builds upon gfximage.hpp, so you may want to familiarize
-// yourself with that header before diving into this one.
+// This file builds upon gfxfile.hpp and gfximage.hpp, so you may want to
+// familiarize yourself with those headers before diving into this one.
 //
 // This code is a thin wrapper over the png++ library at
 // https://www.nongnu.org/pngpp/ . In order to compile this code you must have
@@ -16,26 +16,34 @@
 //
 ///////////////////////////////////////////////////////////////////////////////
 
+#pragma once
+
+#include <array>
+#include <cstdint>
 #include <optional>
+#include <sstream>
 #include <string>
+#include <vector>
 
 #include <png++/png.hpp>
 
+#include "gfxfile.hpp"
 #include "gfximage.hpp"
 
 namespace gfx {
 
-// Read a PNG file at the given path.
+// Decode the bytes of a PNG file.
 //
 // On success, returns a non-empty optional<hdr_image> containing the hdr_image
 // with the contents of the image file.
 //
-// On I/O error, returns an empty optional object.
-//
-std::optional<hdr_image> read_png(const std::string& path) {
+// On error, returns an empty optional object.
+std::optional<hdr_image> decode_png(const std::string& bytes) {
   try {
 
-    png::image<png::rgb_pixel> loaded(path);
+    std::istringstream stream(bytes);
+    png::image<png::rgb_pixel> loaded;
+    loaded.read_stream(stream);
 
     gfx::hdr_image result(loaded.get_width(), loaded.get_height(), BLACK);
 
@@ -56,16 +64,180 @@ std::optional<hdr_image> read_png(const std::string& path) {
   }
 }
 
-// Write image to a PNG file at the given path.
+// Read a PNG file at the given path.
 //
-// The given image must be non-empty.
+// On success, returns a non-empty optional<hdr_image> containing the hdr_image
+// with the contents of the image file.
 //
-// Returns true on success and false on I/O error.
-bool write_png(const hdr_image& image, const std::string& path) {
+// On I/O error, returns an empty optional object.
+//
+std::optional<hdr_image> read_png(const std::string& path) {
+  std::string bytes;
+  if (!detail::read_file(path, bytes)) {
+    return std::optional<hdr_image>();
+  }
+  return decode_png(bytes);
+}
+
+// How write_png chooses the color type of the file.
+//
+// truecolor: 8-bit RGB.
+// automatic: indexed, with a palette, when the image has at most 256
+//            distinct colors after conversion with hdr_to_byte, at the
+//            fewest of 1, 2, 4, or 8 bits per pixel that can hold them;
+//            otherwise truecolor. The decoded pixels are identical either
+//            way, and indexed files are smaller and faster to compress.
+enum class png_color_mode {
+  truecolor,
+  automatic
+};
+
+namespace detail {
+
+// A set of at most 256 colors packed as 0xRRGGBB, which numbers its
+// elements in insertion order. It is a small open-addressing hash table,
+// never more than half full, so probes are short.
+class palette_set {
+private:
+
+    static constexpr size_t SLOTS = 512;
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+
+    std::array<uint32_t, SLOTS> keys_;
+    std::array<uint8_t, SLOTS> indices_;
+    std::vector<uint32_t> colors_;
+
+public:
+
+  static constexpr size_t MAX_COLORS = 256;
+
+  palette_set() {
+    keys_.fill(EMPTY);
+    colors_.reserve(MAX_COLORS);
+  }
+
+  // Return the index of color, adding it if it is new; or -1 if it is new
+  // and the set is full.
+  int insert(uint32_t color) {
+    size_t slot = (color * 0x9e3779b1u) >> 23;
+    for (;;) {
+      if (keys_[slot] == color) {
+        return indices_[slot];
+      }
+      if (keys_[slot] == EMPTY) {
+        if (colors_.size() == MAX_COLORS) {
+          return -1;
+        }
+        keys_[slot] = color;
+        indices_[slot] = uint8_t(colors_.size());
+        colors_.push_back(color);
+        return indices_[slot];
+      }
+      slot = (slot + 1) % SLOTS;
+    }
+  }
+
+  // Return the colors, in index order.
+  const std::vector<uint32_t>& colors() const { return colors_; }
+};
+
+// Fill a png++ indexed image, whose pixel type holds the given number of
+// bits, with indices and palette, and pass it to write.
+template <typename pixel_type, typename write_type>
+void write_indexed_pixels(size_t width,
+                          size_t height,
+                          const std::vector<uint8_t>& indices,
+                          const png::palette& palette,
+                          write_type& write) {
+  png::image<pixel_type> indexed(width, height);
+  indexed.set_palette(palette);
+  for (size_t y = 0; y < height; ++y) {
+    for (size_t x = 0; x < width; ++x) {
+      indexed.set_pixel(x, y, pixel_type(indices[(y * width) + x]));
+    }
+  }
+  write(indexed);
+}
+
+// If image, which must be non-empty, has at most 256 distinct colors, build
+// an indexed png++ image of it, pass that to write, which should write it
+// out, and return true. Otherwise return false without calling write.
+// image_type may be any image with the const pixel accessor of hdr_image.
+//
+// Colors are collected in one pass, which stops at the 257th color; a run
+// of equal pixels costs one comparison per pixel.
+template <typename image_type, typename write_type>
+bool write_indexed_png(const image_type& image, write_type write) {
+  assert(!image.is_empty());
+
+  size_t width = image.width(), height = image.height();
+  palette_set colors;
+  std::vector<uint8_t> indices(width * height);
+  uint32_t last_color = UINT32_MAX;
+  int last_index = 0;
+  for (size_t y = 0; y < height; ++y) {
+    for (size_t x = 0; x < width; ++x) {
+      auto& hdr_pixel = image.pixel(x, y);
+      uint32_t color = (uint32_t(hdr_to_byte(hdr_pixel.r())) << 16)
+                       | (uint32_t(hdr_to_byte(hdr_pixel.g())) << 8)
+                       | uint32_t(hdr_to_byte(hdr_pixel.b()));
+      if (color != last_color) {
+        last_index = colors.insert(color);
+        if (last_index < 0) {
+          return false;
+        }
+        last_color = color;
+      }
+      indices[(y * width) + x] = uint8_t(last_index);
+    }
+  }
+
+  png::palette palette;
+  for (uint32_t color : colors.colors()) {
+    palette.push_back(png::color((color >> 16) & 0xff,
+                                 (color >> 8) & 0xff,
+                                 color & 0xff));
+  }
+  size_t count = palette.size();
+  if (count <= 2) {
+    write_indexed_pixels<png::index_pixel_1>(width, height, indices,
+                                             palette, write);
+  } else if (count <= 4) {
+    write_indexed_pixels<png::index_pixel_2>(width, height, indices,
+                                             palette, write);
+  } else if (count <= 16) {
+    write_indexed_pixels<png::index_pixel_4>(width, height, indices,
+                                             palette, write);
+  } else {
+    write_indexed_pixels<png::index_pixel>(width, height, indices,
+                                           palette, write);
+  }
+  return true;
+}
+
+} // namespace detail
+
+// Encode image, which must be non-empty, as a PNG file in memory, with the
+// color type chosen by mode. image_type may be hdr_image, or any image with
+// its const pixel accessor, such as cow_image.
+//
+// Returns the bytes of the file on success, and an empty optional on error.
+template <typename image_type>
+std::optional<std::string> encode_png(const image_type& image,
+                                      png_color_mode mode
+                                        = png_color_mode::truecolor) {
   assert(!image.is_empty());
 
   try {
 
+    std::ostringstream stream;
+    if ((mode == png_color_mode::automatic)
+        && detail::write_indexed_png(image, [&](auto& indexed) {
+            indexed.write_stream(stream);
+          })) {
+      return stream ? std::optional<std::string>(stream.str()) : std::nullopt;
+    }
+
     png::image<png::rgb_pixel> truecolor(image.width(), image.height());
 
     for (size_t y = 0; y < image.height(); ++y) {
@@ -78,15 +250,29 @@ bool write_png(const hdr_image& image, const std::string& path) {
       }
     }
 
-    truecolor.write(path);
-
-    return true;
+    truecolor.write_stream(stream);
+    return stream ? std::optional<std::string>(stream.str()) : std::nullopt;
 
   } catch (const std::exception& error) {
-    return false;
+    return std::nullopt;
   }
 }
 
+// Write image to a PNG file at the given path, with the color type chosen
+// by mode.
+//
+// The given image must be non-empty.
+//
+// Returns true on success and false on I/O error.
+bool write_png(const hdr_image& image,
+               const std::string& path,
+               png_color_mode mode = png_color_mode::truecolor) {
+  assert(!image.is_empty());
+
+  auto bytes = encode_png(image, mode);
+  return bytes && detail::write_file(path, *bytes);
+}
+
 // Convenience function: returns true when the PNG images at path1 and path2
 // are == . Returns false when either image cannot be loaded, or when the images
 // are not ==.
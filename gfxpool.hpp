@@ -0,0 +1,310 @@
+
+///////////////////////////////////////////////////////////////////////////////
+// gfxpool.hpp
+//
+// A pool of recycled memory blocks for image storage.
+//
+// Images are often transient: a canvas per test case, a decode target, a
+// scratch buffer per frame. Instead of returning their memory to the heap,
+// a buffer_pool keeps released blocks on free lists, one per size class, and
+// hands them back out to later images of a similar size, so a loop that
+// creates and destroys images stops allocating after its first iteration.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace gfx {
+
+// Counters of buffer_pool activity.
+//
+// system_allocations: blocks obtained from the heap
+// system_frees:       blocks returned to the heap
+// reuses:             allocations served by a recycled block
+// thread_cache_hits:  reuses served by the calling thread's own cache,
+//                     without locking
+// cached_bytes:       bytes currently held on the shared free lists
+struct buffer_pool_stats {
+  size_t system_allocations = 0;
+  size_t system_frees = 0;
+  size_t reuses = 0;
+  size_t thread_cache_hits = 0;
+  size_t cached_bytes = 0;
+};
+
+// A thread-safe pool of memory blocks.
+//
+// Requests are rounded up to a size class; there are four classes per power
+// of two, so at most a quarter of a block is wasted. Released blocks go on
+// the free list of their class, up to a budget of cached bytes; beyond the
+// budget, and for blocks larger than the largest class, memory goes back to
+// the heap.
+//
+// With thread caching on, each thread also keeps a few small blocks of
+// every class for itself, and serves them without taking the pool's lock.
+// Thread caches only ever serve the pool returned by default_buffer_pool.
+class buffer_pool {
+private:
+
+    static constexpr size_t MIN_BLOCK_EXPONENT = 6,
+                            MAX_BLOCK_EXPONENT = 40,
+                            CLASS_COUNT = 1 + 4 * (MAX_BLOCK_EXPONENT
+                                                   - MIN_BLOCK_EXPONENT),
+                            THREAD_CACHE_BLOCKS = 2,
+                            THREAD_CACHE_MAX_BYTES = size_t(1) << 20;
+
+    static constexpr std::align_val_t ALIGNMENT{64};
+
+    // Blocks cached by one thread, returned to their pool when the thread
+    // exits.
+    struct thread_cache {
+      buffer_pool* owner = nullptr;
+      std::array<std::vector<void*>, CLASS_COUNT> blocks;
+
+      ~thread_cache() {
+        if (owner) {
+          for (size_t index = 0; index < CLASS_COUNT; ++index) {
+            for (void* block : blocks[index]) {
+              owner->release_shared(block, index);
+            }
+          }
+        }
+      }
+    };
+
+    mutable std::mutex mutex_;
+    std::array<std::vector<void*>, CLASS_COUNT> free_lists_;
+    size_t cached_bytes_ = 0,
+           max_cached_bytes_;
+    std::atomic<bool> thread_caching_{false};
+    std::atomic<size_t> system_allocations_{0},
+                        system_frees_{0},
+                        reuses_{0},
+                        thread_cache_hits_{0};
+
+    // Return the size class of a request for bytes; CLASS_COUNT means the
+    // request is too large to pool.
+    static size_t class_index(size_t bytes) {
+      if (bytes <= (size_t(1) << MIN_BLOCK_EXPONENT)) {
+        return 0;
+      }
+      // 2^exponent < bytes <= 2^(exponent + 1)
+      size_t exponent = MIN_BLOCK_EXPONENT;
+      while ((size_t(2) << exponent) < bytes) {
+        ++exponent;
+      }
+      if (exponent >= MAX_BLOCK_EXPONENT) {
+        return CLASS_COUNT;
+      }
+      size_t quarter = (bytes - 1 - (size_t(1) << exponent))
+                       >> (exponent - 2);
+      return 1 + (4 * (exponent - MIN_BLOCK_EXPONENT)) + quarter;
+    }
+
+    // Return the number of bytes in a block of size class index.
+    static size_t class_bytes(size_t index) {
+      if (index == 0) {
+        return size_t(1) << MIN_BLOCK_EXPONENT;
+      }
+      size_t exponent = MIN_BLOCK_EXPONENT + ((index - 1) / 4),
+             quarters = 1 + ((index - 1) % 4);
+      return (size_t(1) << exponent) + (quarters << (exponent - 2));
+    }
+
+    void* system_allocate(size_t bytes) {
+      ++system_allocations_;
+      return ::operator new(bytes, ALIGNMENT);
+    }
+
+    void system_free(void* block) {
+      ++system_frees_;
+      ::operator delete(block, ALIGNMENT);
+    }
+
+    thread_cache* local_cache();
+
+    void release_shared(void* block, size_t index) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if ((cached_bytes_ + class_bytes(index)) <= max_cached_bytes_) {
+          free_lists_[index].push_back(block);
+          cached_bytes_ += class_bytes(index);
+          return;
+        }
+      }
+      system_free(block);
+    }
+
+public:
+
+  // Default budget of bytes held on a pool's free lists.
+  static constexpr size_t DEFAULT_MAX_CACHED_BYTES = size_t(256) << 20;
+
+  explicit buffer_pool(size_t max_cached_bytes = DEFAULT_MAX_CACHED_BYTES)
+  : max_cached_bytes_(max_cached_bytes) { }
+
+  buffer_pool(const buffer_pool&) = delete;
+  buffer_pool& operator=(const buffer_pool&) = delete;
+
+  ~buffer_pool() { trim(); }
+
+  // Return a block of at least bytes bytes, aligned to 64 bytes. The block
+  // must eventually be passed to release, with the same bytes.
+  void* acquire(size_t bytes) {
+    size_t index = class_index(bytes);
+    if (index == CLASS_COUNT) {
+      return system_allocate(bytes);
+    }
+
+    if (thread_cache* cache = local_cache()) {
+      auto& blocks = cache->blocks[index];
+      if (!blocks.empty()) {
+        void* block = blocks.back();
+        blocks.pop_back();
+        ++reuses_;
+        ++thread_cache_hits_;
+        return block;
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto& blocks = free_lists_[index];
+      if (!blocks.empty()) {
+        void* block = blocks.back();
+        blocks.pop_back();
+        cached_bytes_ -= class_bytes(index);
+        ++reuses_;
+        return block;
+      }
+    }
+
+    return system_allocate(class_bytes(index));
+  }
+
+  // Return the number of bytes in the block that acquire(bytes) returns,
+  // all of which the caller may use. Passing this to release is equivalent
+  // to passing bytes.
+  static size_t block_bytes(size_t bytes) {
+    size_t index = class_index(bytes);
+    return (index == CLASS_COUNT) ? bytes : class_bytes(index);
+  }
+
+  // Return true iff released blocks may be cached per thread.
+  bool is_thread_caching() const { return thread_caching_; }
+
+  // Return the budget of bytes held on the shared free lists.
+  size_t max_cached_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return max_cached_bytes_;
+  }
+
+  // Give back a block obtained from acquire(bytes), for reuse.
+  void release(void* block, size_t bytes) {
+    if (!block) {
+      return;
+    }
+    size_t index = class_index(bytes);
+    if (index == CLASS_COUNT) {
+      system_free(block);
+      return;
+    }
+
+    if (class_bytes(index) <= THREAD_CACHE_MAX_BYTES) {
+      if (thread_cache* cache = local_cache()) {
+        auto& blocks = cache->blocks[index];
+        if (blocks.size() < THREAD_CACHE_BLOCKS) {
+          blocks.push_back(block);
+          return;
+        }
+      }
+    }
+
+    release_shared(block, index);
+  }
+
+  // Zero the activity counters. cached_bytes is not a counter, and is not
+  // affected.
+  void reset_stats() {
+    system_allocations_ = 0;
+    system_frees_ = 0;
+    reuses_ = 0;
+    thread_cache_hits_ = 0;
+  }
+
+  // Change the budget of bytes held on the shared free lists. Blocks
+  // already cached beyond the new budget are freed.
+  void set_max_cached_bytes(size_t max_cached_bytes) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      max_cached_bytes_ = max_cached_bytes;
+    }
+    if (cached_bytes() > max_cached_bytes) {
+      trim();
+    }
+  }
+
+  // Turn per-thread caches on or off. Blocks already in a thread's cache
+  // stay there until the thread exits.
+  void set_thread_caching(bool on) { thread_caching_ = on; }
+
+  // Return the counters.
+  buffer_pool_stats stats() const {
+    buffer_pool_stats result;
+    result.system_allocations = system_allocations_;
+    result.system_frees = system_frees_;
+    result.reuses = reuses_;
+    result.thread_cache_hits = thread_cache_hits_;
+    result.cached_bytes = cached_bytes();
+    return result;
+  }
+
+  // Return the number of bytes on the shared free lists.
+  size_t cached_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cached_bytes_;
+  }
+
+  // Free every block on the shared free lists.
+  void trim() {
+    std::array<std::vector<void*>, CLASS_COUNT> blocks;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      blocks.swap(free_lists_);
+      cached_bytes_ = 0;
+    }
+    for (auto& list : blocks) {
+      for (void* block : list) {
+        system_free(block);
+      }
+    }
+  }
+};
+
+// Return the pool used for image storage.
+//
+// The pool is never destroyed, so images with static storage duration may
+// safely release their memory at exit.
+buffer_pool& default_buffer_pool() {
+  static buffer_pool* pool = new buffer_pool();
+  return *pool;
+}
+
+buffer_pool::thread_cache* buffer_pool::local_cache() {
+  if (!thread_caching_ || (this != &default_buffer_pool())) {
+    return nullptr;
+  }
+  thread_local thread_cache cache;
+  cache.owner = this;
+  return &cache;
+}
+
+} // namespace gfx
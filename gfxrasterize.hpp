@@ -2,11 +2,16 @@
 ///////////////////////////////////////////////////////////////////////////////
 // gfxrasterize.hpp
 //
-// Line segment rasterization.
+// Rasterization of line segments, gradient and patterned lines, polygons,
+// circles, ellipses, and Bézier curves.
 //
 // This file builds upon gfximage.hpp, so you may want to familiarize
 // yourself with that header before diving into this one.
 //
+// Every primitive is a template on the type of its target image, which may
+// be hdr_image, or any type with the same width, height, is_empty, is_xy,
+// pixel, and fill_span members.
+//
 // Students: all of your work should go in this file, and the only files that
 // you need to modify in project 1 are this file, and README.md.
 //
@@ -14,13 +19,230 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
 #include <string>
+#include <vector>
 
 #include "gfximage.hpp"
 #include "gfxpng.hpp"
 
 namespace gfx {
 
+// A point in integer pixel coordinates. Unlike the unsigned coordinates of
+// rasterize_line_segment, a raster_point may lie outside the target image;
+// primitives taking raster_points clip to the image bounds.
+struct raster_point {
+  int x;
+  int y;
+};
+
+// The pixels of the line segment from (x0, y0) to (x1, y1), as a forward
+// range of raster_points, in order from (x0, y0) to (x1, y1):
+//
+//   for (raster_point p : line_pixels(x0, y0, x1, y1)) { ... }
+//
+// This is the stepping of rasterize_line_segment, and every other line
+// primitive, without the drawing; so hit tests, coverage counts, and custom
+// shaders see exactly the pixels that drawing would write. A line_pixels
+// holds no memory besides a few ints, and iterating it compiles to the same
+// loop as drawing.
+//
+// This is the midpoint algorithm, generalized to all eight octants. The
+// major axis is the one along which the segment is longer, and it advances
+// by one pixel every step; the minor axis advances when the integer decision
+// variable d says the line has passed the midpoint between two pixels.
+//
+// When the line passes exactly through a midpoint, the pixel with the
+// smaller minor coordinate is chosen, no matter which direction the segment
+// is stepped in, so a segment covers the same pixels when its endpoints are
+// swapped.
+class line_pixels {
+private:
+    int x0_, y0_, major_step_x_, major_step_y_, minor_step_x_, minor_step_y_,
+        major_, minor_, d0_;
+
+public:
+
+  class iterator {
+  private:
+      const line_pixels* line_ = nullptr;
+      int x_ = 0, y_ = 0, d_ = 0, remaining_ = 0;
+
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = raster_point;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const raster_point*;
+    using reference = raster_point;
+
+    iterator() = default;
+
+    iterator(const line_pixels& line, int remaining)
+    : line_(&line),
+      x_(line.x0_),
+      y_(line.y0_),
+      d_(line.d0_),
+      remaining_(remaining) { }
+
+    raster_point operator*() const { return raster_point{x_, y_}; }
+
+    iterator& operator++() {
+      assert(remaining_ > 0);
+      if (d_ > 0) {
+        x_ += line_->minor_step_x_;
+        y_ += line_->minor_step_y_;
+        d_ -= 2 * line_->major_;
+      }
+      d_ += 2 * line_->minor_;
+      x_ += line_->major_step_x_;
+      y_ += line_->major_step_y_;
+      --remaining_;
+      return *this;
+    }
+
+    iterator operator++(int) {
+      iterator old = *this;
+      ++*this;
+      return old;
+    }
+
+    // Iterators are only comparable within the same line_pixels.
+    bool operator==(const iterator& rhs) const {
+      return remaining_ == rhs.remaining_;
+    }
+    bool operator!=(const iterator& rhs) const { return !(*this == rhs); }
+  };
+
+  line_pixels(int x0, int y0, int x1, int y1)
+  : x0_(x0), y0_(y0) {
+    const int dx = std::abs(x1 - x0),
+              dy = std::abs(y1 - y0),
+              sx = (x0 < x1) ? 1 : -1,
+              sy = (y0 < y1) ? 1 : -1;
+    const bool x_major = (dx >= dy);
+    major_ = x_major ? dx : dy;
+    minor_ = x_major ? dy : dx;
+    major_step_x_ = x_major ? sx : 0;
+    major_step_y_ = x_major ? 0 : sy;
+    minor_step_x_ = x_major ? 0 : sx;
+    minor_step_y_ = x_major ? sy : 0;
+    const int tie_bias = ((x_major ? sy : sx) < 0) ? 1 : 0;
+    d0_ = (2 * minor_) - major_ + tie_bias;
+  }
+
+  iterator begin() const { return iterator(*this, major_ + 1); }
+  iterator end() const { return iterator(*this, 0); }
+
+  // Return the number of pixels, which is never zero.
+  size_t size() const { return size_t(major_) + 1; }
+};
+
+namespace detail {
+
+// Call visit(x, y) once for each pixel of line_pixels(x0, y0, x1, y1), in
+// order.
+template <typename visitor_type>
+void step_line(int x0, int y0, int x1, int y1, visitor_type visit) {
+  for (raster_point p : line_pixels(x0, y0, x1, y1)) {
+    visit(p.x, p.y);
+  }
+}
+
+// Call visit(x, y) once for each pixel of line_pixels(x0, y0, x1, y1) that
+// is inside clip, in order, without testing each pixel against clip.
+//
+// Both coordinates move monotonically, so the visible pixels are one
+// contiguous range of steps along the major axis. After i steps, the minor
+// coordinate has advanced
+//
+//   floor((2 * minor * i + major - 1 + tie_bias) / (2 * major))
+//
+// times, as in detail::segment_steps of gfxspatial.hpp; inverting that
+// gives the first and last step inside the minor extent of clip. Stepping
+// starts at the first visible step, with the decision variable line_pixels
+// would have there, so the pixels are exactly the same.
+template <typename visitor_type>
+void step_line_clipped(int x0, int y0, int x1, int y1,
+                       const raster_rect& clip,
+                       visitor_type visit) {
+  if (clip.is_empty()) {
+    return;
+  }
+  const int dx = std::abs(x1 - x0),
+            dy = std::abs(y1 - y0),
+            sx = (x0 < x1) ? 1 : -1,
+            sy = (y0 < y1) ? 1 : -1;
+  const bool x_major = (dx >= dy);
+  const int major = x_major ? dx : dy,
+            minor = x_major ? dy : dx,
+            major_sign = x_major ? sx : sy,
+            minor_sign = x_major ? sy : sx,
+            tie_bias = (minor_sign < 0) ? 1 : 0;
+  const int64_t major_start = x_major ? x0 : y0,
+                minor_start = x_major ? y0 : x0;
+
+  // the steps whose major coordinate is inside clip
+  int64_t a = (int64_t(x_major ? clip.x_min : clip.y_min) - major_start)
+              * major_sign,
+          b = (int64_t(x_major ? clip.x_max : clip.y_max) - 1 - major_start)
+              * major_sign;
+  int64_t first = std::max<int64_t>(std::min(a, b), 0),
+          last = std::min<int64_t>(std::max(a, b), major);
+
+  // the minor advances whose minor coordinate is inside clip
+  a = (int64_t(x_major ? clip.y_min : clip.x_min) - minor_start) * minor_sign;
+  b = (int64_t(x_major ? clip.y_max : clip.x_max) - 1 - minor_start)
+      * minor_sign;
+  int64_t taken_min = std::max<int64_t>(std::min(a, b), 0),
+          taken_max = std::min<int64_t>(std::max(a, b), minor);
+  if (taken_min > taken_max) {
+    return;
+  }
+
+  // narrow the steps to those whose minor advances are in that range
+  const int64_t two_major = 2 * int64_t(major),
+                two_minor = 2 * int64_t(minor);
+  if (minor > 0) {
+    if (taken_min > 0) {
+      int64_t numerator = (two_major * taken_min) - major + 1 - tie_bias;
+      first = std::max(first, (numerator + two_minor - 1) / two_minor);
+    }
+    last = std::min(last,
+                    ((two_major * taken_max) + major - tie_bias) / two_minor);
+  }
+  if (first > last) {
+    return;
+  }
+
+  const int64_t taken = (major == 0) ? 0 :
+    ((two_minor * first) + major - 1 + tie_bias) / two_major;
+  int major_coordinate = int(major_start + (major_sign * first)),
+      minor_coordinate = int(minor_start + (minor_sign * taken)),
+      d = int((two_minor * (first + 1)) - major + tie_bias
+              - (two_major * taken));
+  for (int64_t i = first; i <= last; ++i) {
+    if (x_major) {
+      visit(major_coordinate, minor_coordinate);
+    } else {
+      visit(minor_coordinate, major_coordinate);
+    }
+    if (d > 0) {
+      minor_coordinate += minor_sign;
+      d -= 2 * major;
+    }
+    d += 2 * minor;
+    major_coordinate += major_sign;
+  }
+}
+
+} // namespace detail
+
 // Draw a line segment from (x0, y0) to (x1, y1) inside image target, all
 // with color.
 //
@@ -29,7 +251,10 @@ namespace gfx {
 // There is no restriction on how (x0, y0) and (x1, y1) must be oriented
 // relative to each other.
 //
-void rasterize_line_segment(hdr_image& target,
+// image_type may be hdr_image, or any other image type with the same
+// is_empty, is_xy, and pixel members, such as tiled_image.
+template <typename image_type>
+void rasterize_line_segment(image_type& target,
                             unsigned x0, unsigned y0,
                             unsigned x1, unsigned y1,
                             const hdr_rgb& color) {
@@ -38,84 +263,1089 @@ void rasterize_line_segment(hdr_image& target,
   assert(target.is_xy(x0, y0));
   assert(target.is_xy(x1, y1));
 
-  unsigned temp;
+  for (raster_point p : line_pixels(int(x0), int(y0), int(x1), int(y1))) {
+    target.pixel(p.x, p.y, color);
+  }
+}
 
-// ----- BOOK 12 / 16
-  if (y0 > y1){
-    temp = y0;
-    y0 = y1;
-    y1 = temp;
+// A line segment from (x0, y0) to (x1, y1), with the same coordinate
+// conventions as the arguments to rasterize_line_segment.
+struct line_segment {
+  unsigned x0, y0, x1, y1;
+};
+
+// Draw every segment in segments, in order, all with color. The result is
+// identical to calling rasterize_line_segment on each segment.
+//
+// target must be non-empty, and every endpoint must be a valid coordinate
+// in target. As with rasterize_line_segment, image_type may be any image
+// type with the same interface as hdr_image.
+template <typename image_type>
+void rasterize_line_segments(image_type& target,
+                             const std::vector<line_segment>& segments,
+                             const hdr_rgb& color) {
+  assert(!target.is_empty());
+  for (auto& segment : segments) {
+    assert(target.is_xy(segment.x0, segment.y0));
+    assert(target.is_xy(segment.x1, segment.y1));
+    for (raster_point p : line_pixels(int(segment.x0), int(segment.y0),
+                                      int(segment.x1), int(segment.y1))) {
+      target.pixel(p.x, p.y, color);
+    }
   }
+}
+
+// Clip rectangle that does not restrict drawing beyond the image bounds;
+// the default for every primitive taking a clip rectangle.
+const raster_rect UNCLIPPED{std::numeric_limits<int>::min(),
+                            std::numeric_limits<int>::min(),
+                            std::numeric_limits<int>::max(),
+                            std::numeric_limits<int>::max()};
 
-  // vertical case
-   if (x0 == x1){
-     for (int y = y0; y <= y1; y++){
-       target.pixel(x0,y,color);
-     }
-     return;
-   }
+// Return the rectangle covering every pixel of image.
+template <typename image_type>
+raster_rect image_rect(const image_type& image) {
+  return raster_rect{0, 0, int(image.width()), int(image.height())};
+}
+
+// Rule deciding which pixels are inside a polygon whose contours overlap or
+// intersect themselves.
+//
+// even_odd: a pixel is inside when a ray from it crosses an odd number of
+//           edges.
+// non_zero: a pixel is inside when the edges crossing such a ray have a
+//           nonzero sum of winding directions.
+enum class fill_rule { even_odd, non_zero };
+
+namespace detail {
+
+// Floor division and modulus for a positive divisor.
+constexpr int64_t floor_div(int64_t numerator, int64_t divisor) {
+  assert(divisor > 0);
+  return (numerator >= 0) ? (numerator / divisor)
+                          : -((-numerator + divisor - 1) / divisor);
+}
+constexpr int64_t floor_mod(int64_t numerator, int64_t divisor) {
+  return numerator - (floor_div(numerator, divisor) * divisor);
+}
+
+// One non-horizontal polygon edge, oriented top to bottom, covering the
+// scanlines y_top <= y < y_bottom.
+//
+// The x intercept on the current scanline is the exact rational
+// x + remainder/dy, with 0 <= remainder < dy. Like the decision variable of
+// rasterize_line_segment, it is stepped from one scanline to the next with
+// integer additions only.
+struct polygon_edge {
+  int y_top, y_bottom;
+  int x, remainder, dy;
+  int step_whole, step_remainder;
+  int winding;
 
-   if (x0 > x1) {
-     temp = x0;
-     x0 = x1;
-     x1 = temp;
-   }
+  // Leftmost pixel whose center is on or right of the intercept.
+  int x_ceil() const { return x + (remainder > 0); }
 
+  void advance() {
+    x += step_whole;
+    remainder += step_remainder;
+    if (remainder >= dy) {
+      ++x;
+      remainder -= dy;
+    }
+  }
+};
+
+// Fill the pixels x_begin <= x < x_end of row y, clipped to the columns of
+// clip. Row y must be inside clip, and clip must be inside target.
+template <typename image_type>
+void fill_span_clipped(image_type& target,
+                       const raster_rect& clip,
+                       int x_begin, int x_end, int y,
+                       const hdr_rgb& color) {
+  x_begin = std::max(x_begin, clip.x_min);
+  x_end = std::min(x_end, clip.x_max);
+  if (x_begin < x_end) {
+    target.fill_span(x_begin, x_end, y, color);
+  }
+}
+
+// Append the edges of one closed contour to edges, clipped to the rows of
+// clip.
+void add_contour_edges(std::vector<polygon_edge>& edges,
+                       const std::vector<raster_point>& contour,
+                       const raster_rect& clip) {
+  for (size_t i = 0; i < contour.size(); ++i) {
+    raster_point a = contour[i],
+                 b = contour[(i + 1) % contour.size()];
+    if (a.y == b.y) {
+      continue; // horizontal edges never cross a scanline
+    }
+    int winding = 1;
+    if (a.y > b.y) {
+      std::swap(a, b);
+      winding = -1;
+    }
+    int y_first = std::max(a.y, clip.y_min),
+        y_last = std::min(b.y, clip.y_max);
+    if (y_first >= y_last) {
+      continue; // entirely above or below the clip rectangle
+    }
 
+    polygon_edge edge;
+    edge.y_top = y_first;
+    edge.y_bottom = y_last;
+    edge.dy = b.y - a.y;
+    int dx = b.x - a.x;
+    edge.step_whole = int(floor_div(dx, edge.dy));
+    edge.step_remainder = int(floor_mod(dx, edge.dy));
+    int64_t numerator = int64_t(y_first - a.y) * dx;
+    edge.x = a.x + int(floor_div(numerator, edge.dy));
+    edge.remainder = int(floor_mod(numerator, edge.dy));
+    edge.winding = winding;
+    edges.push_back(edge);
+  }
+}
 
-   int y = y0;
+// Scan convert an edge table built by add_contour_edges.
+template <typename image_type>
+void fill_polygon_edges(image_type& target,
+                        const raster_rect& clip,
+                        std::vector<polygon_edge>& edges,
+                        const hdr_rgb& color,
+                        fill_rule rule) {
+  if (edges.empty()) {
+    return;
+  }
 
-   int dx = (int) (x1 - x0);
-   int dy = (int) (y0 - y1);
+  std::sort(edges.begin(), edges.end(),
+            [](auto& l, auto& r) { return l.y_top < r.y_top; });
 
-   int d = (int) (dy * (int) ( x0 + 1)) +
-                (dx * (int) ( y0 + 0.5)) +
-                (int) (x0 * y1) -
-                (int) (x1 * y0);
+  std::vector<polygon_edge> active;
+  size_t next_edge = 0;
+  for (int y = edges.front().y_top;
+       (y < clip.y_max) && ((next_edge < edges.size()) || !active.empty());
+       ++y) {
 
-  for (int x = x0; x <= x1; x++){
+    // retire finished edges, then activate edges starting on this scanline
+    active.erase(std::remove_if(active.begin(), active.end(),
+                                [&](auto& edge) { return edge.y_bottom <= y; }),
+                 active.end());
+    while ((next_edge < edges.size()) && (edges[next_edge].y_top == y)) {
+      active.push_back(edges[next_edge]);
+      ++next_edge;
+    }
 
-    target.pixel(x,y,color);
+    // insertion sort; the order changes little between scanlines
+    for (size_t i = 1; i < active.size(); ++i) {
+      for (size_t j = i;
+           (j > 0) && (active[j].x_ceil() < active[j - 1].x_ceil());
+           --j) {
+        std::swap(active[j], active[j - 1]);
+      }
+    }
 
-    if (d < 0){
-      y++;
-      d += dx + dy;
+    if (rule == fill_rule::even_odd) {
+      for (size_t i = 0; i + 1 < active.size(); i += 2) {
+        fill_span_clipped(target, clip,
+                          active[i].x_ceil(), active[i + 1].x_ceil(),
+                          y, color);
+      }
+    } else {
+      int winding = 0, span_begin = 0;
+      for (auto& edge : active) {
+        if (winding == 0) {
+          span_begin = edge.x_ceil();
+        }
+        winding += edge.winding;
+        if (winding == 0) {
+          fill_span_clipped(target, clip,
+                            span_begin, edge.x_ceil(), y, color);
+        }
+      }
     }
 
-    else {
-      d += dy;
-    } // end if statement
-  } // end for loop
+    for (auto& edge : active) {
+      edge.advance();
+    }
+  }
+}
 
+} // namespace detail
 
-// ------ Backup idea
-  /*
-  int steps;
+// Fill the interior of a polygon with color, using an active edge table
+// scanline algorithm.
+//
+// Each contour is a closed loop of vertices; the last vertex connects back
+// to the first. Several contours may be passed together to describe holes
+// or disjoint pieces, and contours may be concave or self-intersecting; rule
+// decides which regions are inside.
+//
+// Vertices are pixel centers, and a pixel is filled when its center is
+// inside the polygon. Pixels exactly on a left or top edge are inside, and
+// pixels exactly on a right or bottom edge are outside, so polygons sharing
+// an edge never fill the same pixel twice.
+//
+// target must be non-empty. Vertices may lie outside target; the polygon is
+// clipped to the image bounds, and to clip.
+//
+// Every interior run of a scanline is written with one hdr_image::fill_span
+// call, so the cost is proportional to the number of edges plus the number
+// of rows filled, rather than to the number of pixels in the bounding box.
+template <typename image_type>
+void fill_polygon(image_type& target,
+                  const std::vector<std::vector<raster_point>>& contours,
+                  const hdr_rgb& color,
+                  fill_rule rule = fill_rule::even_odd,
+                  const raster_rect& clip = UNCLIPPED) {
+  assert(!target.is_empty());
+  raster_rect bounds = clip.intersection(image_rect(target));
+  std::vector<detail::polygon_edge> edges;
+  for (auto& contour : contours) {
+    detail::add_contour_edges(edges, contour, bounds);
+  }
+  detail::fill_polygon_edges(target, bounds, edges, color, rule);
+}
 
-  if (dx > dy) {steps = dx;}
-  else steps = dy;
+// Fill a polygon made of a single contour.
+template <typename image_type>
+void fill_polygon(image_type& target,
+                  const std::vector<raster_point>& vertices,
+                  const hdr_rgb& color,
+                  fill_rule rule = fill_rule::even_odd,
+                  const raster_rect& clip = UNCLIPPED) {
+  assert(!target.is_empty());
+  raster_rect bounds = clip.intersection(image_rect(target));
+  std::vector<detail::polygon_edge> edges;
+  detail::add_contour_edges(edges, vertices, bounds);
+  detail::fill_polygon_edges(target, bounds, edges, color, rule);
+}
 
-  int x = x0;
-  unsigned true_x = x0;
-  unsigned true_y = y0;
+namespace detail {
 
-  for (int i = 0; i < steps; i++){
+// Assign the pixel at (x, y) to color when (x, y) is inside clip, and do
+// nothing otherwise. clip must be inside target.
+template <typename image_type>
+void plot_clipped(image_type& target,
+                  const raster_rect& clip,
+                  int x, int y,
+                  const hdr_rgb& color) {
+  if (clip.contains(x, y)) {
     target.pixel(x, y, color);
+  }
+}
+
+// Plot the four pixels (cx +/- dx, cy +/- dy), clipped to clip. Each
+// distinct pixel is written once, even when dx or dy is zero.
+template <typename image_type>
+void plot_four_way(image_type& target,
+                   const raster_rect& clip,
+                   int cx, int cy, int dx, int dy,
+                   const hdr_rgb& color) {
+  plot_clipped(target, clip, cx + dx, cy + dy, color);
+  if (dx != 0) {
+    plot_clipped(target, clip, cx - dx, cy + dy, color);
+  }
+  if (dy != 0) {
+    plot_clipped(target, clip, cx + dx, cy - dy, color);
+    if (dx != 0) {
+      plot_clipped(target, clip, cx - dx, cy - dy, color);
+    }
+  }
+}
+
+// Fill the pixels cx - dx through cx + dx, inclusive, on rows cy + dy and
+// cy - dy, clipped to clip. When dy is zero the single row is filled once.
+template <typename image_type>
+void fill_row_pair(image_type& target,
+                   const raster_rect& clip,
+                   int cx, int cy, int dx, int dy,
+                   const hdr_rgb& color) {
+  for (int y : { cy + dy, cy - dy }) {
+    if ((y >= clip.y_min) && (y < clip.y_max)) {
+      fill_span_clipped(target, clip, cx - dx, cx + dx + 1, y, color);
+    }
+    if (dy == 0) {
+      break;
+    }
+  }
+}
+
+// Step through the first quadrant of an axis-aligned ellipse with the
+// midpoint algorithm, calling visit(x, y) for each pixel offset from the
+// center, starting at (0, radius_y) and ending at (radius_x, 0). x never
+// decreases and y never increases from one call to the next.
+//
+// The decision variables are scaled by 4 so that every quantity, including
+// the half-pixel midpoints, stays an integer.
+template <typename visitor_type>
+void step_ellipse(unsigned radius_x, unsigned radius_y, visitor_type visit) {
+  if (radius_y == 0) {
+    for (int x = 0; x <= int(radius_x); ++x) {
+      visit(x, 0);
+    }
+    return;
+  }
+
+  const int64_t rx2 = int64_t(radius_x) * radius_x,
+                ry2 = int64_t(radius_y) * radius_y;
+  int x = 0, y = int(radius_y);
+  int64_t px = 0, py = 2 * rx2 * y;
+
+  // region 1, where the slope is shallower than -1; x steps every time
+  int64_t d = (4 * ry2) - (4 * rx2 * radius_y) + rx2;
+  while (px < py) {
+    visit(x, y);
+    ++x;
+    px += 2 * ry2;
+    if (d < 0) {
+      d += 4 * (ry2 + px);
+    } else {
+      --y;
+      py -= 2 * rx2;
+      d += 4 * (ry2 + px - py);
+    }
+  }
+
+  // region 2, where y steps every time
+  d = (ry2 * (2 * x + 1) * (2 * x + 1)) + (4 * rx2 * (y - 1) * (y - 1))
+      - (4 * rx2 * ry2);
+  while (y >= 0) {
+    visit(x, y);
+    --y;
+    py -= 2 * rx2;
+    if (d > 0) {
+      d += 4 * (rx2 - py);
+    } else {
+      ++x;
+      px += 2 * ry2;
+      d += 4 * (rx2 - py + px);
+    }
+  }
+}
+
+} // namespace detail
+
+// Draw the outline of a circle centered at (center_x, center_y) with the
+// given radius, using the integer midpoint circle algorithm.
+//
+// target must be non-empty. The circle may extend beyond, or lie entirely
+// outside, target; it is clipped to the image bounds, and to clip. Each
+// pixel of the outline is written exactly once, including where the eight
+// symmetric octants meet.
+template <typename image_type>
+void rasterize_circle(image_type& target,
+                      int center_x, int center_y,
+                      unsigned radius,
+                      const hdr_rgb& color,
+                      const raster_rect& clip = UNCLIPPED) {
+  assert(!target.is_empty());
+  raster_rect bounds = clip.intersection(image_rect(target));
+
+  int x = 0, y = int(radius), d = 1 - int(radius);
+  while (x <= y) {
+    detail::plot_four_way(target, bounds, center_x, center_y, x, y, color);
+    if (x != y) {
+      detail::plot_four_way(target, bounds, center_x, center_y, y, x, color);
+    }
+    if (d < 0) {
+      d += (2 * x) + 3;
+    } else {
+      d += (2 * (x - y)) + 5;
+      --y;
+    }
+    ++x;
+  }
+}
+
+// Fill a disk centered at (center_x, center_y) with the given radius. The
+// filled pixels are exactly the pixels of rasterize_circle plus the interior.
+//
+// The midpoint stepping is the same as rasterize_circle, but instead of
+// plotting individual pixels, each row is written as one span, and each row
+// is written only once.
+template <typename image_type>
+void fill_circle(image_type& target,
+                 int center_x, int center_y,
+                 unsigned radius,
+                 const hdr_rgb& color,
+                 const raster_rect& clip = UNCLIPPED) {
+  assert(!target.is_empty());
+  raster_rect bounds = clip.intersection(image_rect(target));
+
+  int x = 0, y = int(radius), d = 1 - int(radius);
+  while (x <= y) {
+    // rows center_y +/- x, from the octants where y is the horizontal offset
+    detail::fill_row_pair(target, bounds, center_x, center_y, y, x, color);
+    if (d < 0) {
+      d += (2 * x) + 3;
+    } else {
+      // rows center_y +/- y are finished, and x is their widest offset
+      if (y > x) {
+        detail::fill_row_pair(target, bounds, center_x, center_y, x, y, color);
+      }
+      d += (2 * (x - y)) + 5;
+      --y;
+    }
+    ++x;
+  }
+}
+
+// Draw the outline of an axis-aligned ellipse centered at
+// (center_x, center_y) with horizontal radius radius_x and vertical radius
+// radius_y, using the integer midpoint ellipse algorithm.
+//
+// target must be non-empty. The ellipse is clipped to the image bounds, and
+// to clip. A
+// zero radius degenerates to a horizontal or vertical line.
+template <typename image_type>
+void rasterize_ellipse(image_type& target,
+                       int center_x, int center_y,
+                       unsigned radius_x, unsigned radius_y,
+                       const hdr_rgb& color,
+                       const raster_rect& clip = UNCLIPPED) {
+  assert(!target.is_empty());
+  raster_rect bounds = clip.intersection(image_rect(target));
+  detail::step_ellipse(radius_x, radius_y, [&](int x, int y) {
+      detail::plot_four_way(target, bounds, center_x, center_y, x, y, color);
+    });
+}
+
+// Fill an axis-aligned ellipse. The filled pixels are exactly the pixels of
+// rasterize_ellipse plus the interior, and each row is written as one span.
+template <typename image_type>
+void fill_ellipse(image_type& target,
+                  int center_x, int center_y,
+                  unsigned radius_x, unsigned radius_y,
+                  const hdr_rgb& color,
+                  const raster_rect& clip = UNCLIPPED) {
+  assert(!target.is_empty());
+  raster_rect bounds = clip.intersection(image_rect(target));
+
+  // a row is finished when the stepping moves to the next y, and since x
+  // never decreases, its last x is its widest
+  int row_x = 0, row_y = int(radius_y);
+  detail::step_ellipse(radius_x, radius_y, [&](int x, int y) {
+      if (y != row_y) {
+        detail::fill_row_pair(target, bounds,
+                              center_x, center_y, row_x, row_y, color);
+        row_y = y;
+      }
+      row_x = x;
+    });
+  detail::fill_row_pair(target, bounds,
+                        center_x, center_y, row_x, row_y, color);
+}
+
+// Draw a line segment from p0 to p1, all with color.
+//
+// This overload covers the same pixels as the one taking unsigned
+// coordinates, but p0 and p1 may lie outside target; the segment is clipped
+// to the image bounds, and to clip.
+//
+// target must be non-empty.
+template <typename image_type>
+void rasterize_line_segment(image_type& target,
+                            const raster_point& p0,
+                            const raster_point& p1,
+                            const hdr_rgb& color,
+                            const raster_rect& clip = UNCLIPPED) {
+  assert(!target.is_empty());
+  raster_rect bounds = clip.intersection(image_rect(target));
+  if (!bounds.is_empty()) {
+    detail::step_line(p0.x, p0.y, p1.x, p1.y, [&](int x, int y) {
+        detail::plot_clipped(target, bounds, x, y, color);
+      });
+  }
+}
+
+// Fill every pixel of rect with color, one span per row.
+//
+// target must be non-empty. rect may extend beyond target; it is clipped to
+// the image bounds, and to clip.
+template <typename image_type>
+void fill_rect(image_type& target,
+               const raster_rect& rect,
+               const hdr_rgb& color,
+               const raster_rect& clip = UNCLIPPED) {
+  assert(!target.is_empty());
+  raster_rect bounds = rect.intersection(clip).intersection(image_rect(target));
+  if (!bounds.is_empty()) {
+    for (int y = bounds.y_min; y < bounds.y_max; ++y) {
+      target.fill_span(bounds.x_min, bounds.x_max, y, color);
+    }
+  }
+}
+
+// Draw a connected sequence of line segments through points, all with color.
+//
+// Consecutive segments share their joint pixel, and it is written only
+// once: every segment after the first skips its first pixel, which is the
+// last pixel of the previous segment.
+//
+// target must be non-empty. Points may lie outside target; the polyline is
+// clipped to the image bounds, and to clip.
+template <typename image_type>
+void rasterize_polyline(image_type& target,
+                        const std::vector<raster_point>& points,
+                        const hdr_rgb& color,
+                        const raster_rect& clip = UNCLIPPED) {
+  assert(!target.is_empty());
+  raster_rect bounds = clip.intersection(image_rect(target));
+
+  if (points.empty()) {
+    return;
+  }
+
+  detail::plot_clipped(target, bounds,
+                       points.front().x, points.front().y, color);
+  for (size_t i = 1; i < points.size(); ++i) {
+    bool joint = true;
+    detail::step_line(points[i - 1].x, points[i - 1].y,
+                      points[i].x, points[i].y,
+                      [&](int x, int y) {
+                        if (joint) {
+                          joint = false;
+                        } else {
+                          detail::plot_clipped(target, bounds, x, y, color);
+                        }
+                      });
+  }
+}
+
+namespace detail {
+
+// Number of fraction bits in the fixed-point intensities of color_stepper.
+const int COLOR_FRACTION_BITS = 40;
+
+// The value of one fixed-point unit, 2^-COLOR_FRACTION_BITS. Scaling by a
+// power of two is exact, so multiplying by this gives the same result as
+// std::ldexp, without a library call per channel per pixel.
+constexpr float COLOR_FIXED_UNIT
+  = 1.0f / float(int64_t(1) << COLOR_FRACTION_BITS);
+
+// Steps a color linearly from start to end in a given number of steps,
+// using integer arithmetic only. Each channel is a fixed-point intensity,
+// advanced by a whole part every step, plus one more unit whenever the
+// accumulated remainder reaches the step count; the same scheme as the
+// decision variable of step_line. After i calls to advance, a channel is
+// exactly start + floor((end - start) * i / steps), so the last color is
+// end itself.
+class color_stepper {
+private:
+    struct channel {
+      int64_t value, whole, remainder, error;
+    };
+
+    std::array<channel, 3> channels_;
+    int64_t steps_;
+
+    static int64_t to_fixed(hdr_intensity intensity) {
+      return std::llround(double(intensity)
+                          * double(int64_t(1) << COLOR_FRACTION_BITS));
+    }
+
+    static hdr_intensity from_fixed(int64_t value) {
+      return float(value) * COLOR_FIXED_UNIT;
+    }
+
+public:
+  // steps must be non-negative; with zero steps, the color stays at start.
+  color_stepper(const hdr_rgb& start, const hdr_rgb& end, int steps)
+  : steps_(std::max(steps, 1)) {
+    assert(steps >= 0);
+    const hdr_intensity starts[3] = {start.r(), start.g(), start.b()},
+                        ends[3] = {end.r(), end.g(), end.b()};
+    for (int i = 0; i < 3; ++i) {
+      int64_t first = to_fixed(starts[i]),
+              delta = to_fixed(ends[i]) - first;
+      channels_[i] = channel{first,
+                             floor_div(delta, steps_),
+                             floor_mod(delta, steps_),
+                             0};
+    }
+  }
+
+  // Return the current color.
+  hdr_rgb color() const {
+    return hdr_rgb(from_fixed(channels_[0].value),
+                   from_fixed(channels_[1].value),
+                   from_fixed(channels_[2].value));
+  }
+
+  // Move on to the color of the next step.
+  void advance() {
+    for (auto& channel : channels_) {
+      channel.value += channel.whole;
+      channel.error += channel.remainder;
+      if (channel.error >= steps_) {
+        channel.error -= steps_;
+        ++channel.value;
+      }
+    }
+  }
+};
+
+// Return the number of steps step_line takes from (x0, y0) to (x1, y1).
+int line_steps(int x0, int y0, int x1, int y1) {
+  return std::max(std::abs(x1 - x0), std::abs(y1 - y0));
+}
+
+} // namespace detail
+
+// Draw a line segment from (x0, y0) to (x1, y1) inside image target, with
+// color interpolated linearly from color0 at (x0, y0) to color1 at
+// (x1, y1), along the major axis.
+//
+// The pixels are the same as those of rasterize_line_segment, and the
+// color is advanced by fixed-point steps in the same loop, so there is no
+// per-pixel division or floating point interpolation.
+//
+// target must be non-empty, and (x0, y0) and (x1, y1) must be valid
+// coordinates in target. image_type may be any image type with the same
+// interface as hdr_image.
+template <typename image_type>
+void rasterize_gradient_line_segment(image_type& target,
+                                     unsigned x0, unsigned y0,
+                                     unsigned x1, unsigned y1,
+                                     const hdr_rgb& color0,
+                                     const hdr_rgb& color1) {
+  assert(!target.is_empty());
+  assert(target.is_xy(x0, y0));
+  assert(target.is_xy(x1, y1));
+
+  detail::color_stepper color(color0, color1,
+                              detail::line_steps(x0, y0, x1, y1));
+  detail::step_line(int(x0), int(y0), int(x1), int(y1),
+                    [&](int x, int y) {
+                      target.pixel(x, y, color.color());
+                      color.advance();
+                    });
+}
+
+// Draw a line segment from p0 to p1 with color interpolated from color0 to
+// color1, as above, except that p0 and p1 may lie outside target. The
+// segment is clipped to the image bounds and to clip, and the colors of the
+// remaining pixels are those of the whole, unclipped segment.
+//
+// target must be non-empty.
+template <typename image_type>
+void rasterize_gradient_line_segment(image_type& target,
+                                     const raster_point& p0,
+                                     const raster_point& p1,
+                                     const hdr_rgb& color0,
+                                     const hdr_rgb& color1,
+                                     const raster_rect& clip = UNCLIPPED) {
+  assert(!target.is_empty());
+  raster_rect bounds = clip.intersection(image_rect(target));
+  if (!bounds.is_empty()) {
+    detail::color_stepper color(color0, color1,
+                                detail::line_steps(p0.x, p0.y, p1.x, p1.y));
+    detail::step_line(p0.x, p0.y, p1.x, p1.y, [&](int x, int y) {
+        detail::plot_clipped(target, bounds, x, y, color.color());
+        color.advance();
+      });
+  }
+}
+
+// A repeating on/off pattern for dashed and stippled lines, stored as runs
+// of pixels that are alternately drawn and skipped.
+//
+// A position in the pattern is its phase: the number of pixels into the
+// pattern, from 0 to period() - 1. Every pixel a patterned line visits,
+// drawn or not, advances the phase by one.
+class line_pattern {
+private:
+
+    struct run {
+      unsigned length;
+      bool on;
+    };
+
+    std::vector<run> runs_;
+    size_t period_ = 0;
+
+    void append(unsigned length, bool on) {
+      if (length == 0) {
+        return;
+      }
+      if (!runs_.empty() && (runs_.back().on == on)) {
+        runs_.back().length += length;
+      } else {
+        runs_.push_back(run{length, on});
+      }
+      period_ += length;
+    }
+
+public:
+
+  // Return a pattern that draws every pixel.
+  static line_pattern solid() {
+    line_pattern result;
+    result.append(1, true);
+    return result;
+  }
+
+  // Return a stipple pattern of length pixels, from bit 0 of mask to bit
+  // length - 1; a pixel is drawn when its bit is 1. length must be in
+  // [1, 32].
+  static line_pattern from_mask(uint32_t mask, unsigned length = 32) {
+    assert(length >= 1);
+    assert(length <= 32);
+    line_pattern result;
+    for (unsigned bit = 0; bit < length; ++bit) {
+      result.append(1, ((mask >> bit) & 1) != 0);
+    }
+    return result;
+  }
+
+  // Return a dash pattern from an array of run lengths, alternately drawn
+  // and skipped, starting with a drawn dash; {6, 3} is a dash of 6 pixels,
+  // then a gap of 3. Zero lengths are allowed, but the total must be
+  // positive.
+  static line_pattern from_dashes(const std::vector<unsigned>& dashes) {
+    line_pattern result;
+    for (size_t i = 0; i < dashes.size(); ++i) {
+      result.append(dashes[i], (i % 2) == 0);
+    }
+    assert(result.period() > 0);
+    return result;
+  }
 
-    true_x += dx/steps;
-    x = round(true_x);
+  // Return true iff the pixel at phase is drawn; phase may be any value,
+  // and is reduced modulo period().
+  bool is_on(size_t phase) const {
+    phase %= period_;
+    for (auto& run : runs_) {
+      if (phase < run.length) {
+        return run.on;
+      }
+      phase -= run.length;
+    }
+    assert(false);
+    return false;
+  }
+
+  // Return the number of pixels after which the pattern repeats.
+  size_t period() const { return period_; }
+
+  // Return the number of runs of drawn or skipped pixels.
+  size_t run_count() const { return runs_.size(); }
+
+  // Return the length, and whether it is drawn, of run index.
+  unsigned run_length(size_t index) const { return runs_[index].length; }
+  bool is_run_on(size_t index) const { return runs_[index].on; }
+};
+
+namespace detail {
+
+// A position in a line_pattern that advances one pixel at a time, without
+// division: it counts down the pixels left in the current run, and moves to
+// the next run when they run out.
+class pattern_cursor {
+private:
+    const line_pattern& pattern_;
+    size_t run_, phase_;
+    unsigned left_;
+
+public:
+  pattern_cursor(const line_pattern& pattern, size_t phase)
+  : pattern_(pattern), run_(0), phase_(phase % pattern.period()) {
+    size_t offset = phase_;
+    while (offset >= pattern_.run_length(run_)) {
+      offset -= pattern_.run_length(run_);
+      ++run_;
+    }
+    left_ = pattern_.run_length(run_) - unsigned(offset);
+  }
+
+  // Return true iff the pixel at the current phase is drawn.
+  bool is_on() const { return pattern_.is_run_on(run_); }
+
+  // Return the current phase.
+  size_t phase() const { return phase_; }
+
+  // Move to the next pixel of the pattern.
+  void advance() {
+    if (++phase_ == pattern_.period()) {
+      phase_ = 0;
+    }
+    if (--left_ == 0) {
+      if (++run_ == pattern_.run_count()) {
+        run_ = 0;
+      }
+      left_ = pattern_.run_length(run_);
+    }
+  }
+};
+
+} // namespace detail
+
+// Draw a line segment from p0 to p1 with color, drawing only the pixels
+// that pattern marks as on, starting at phase.
+//
+// The pixels visited are the same as those of rasterize_line_segment, and
+// each advances the pattern by one. Returns the phase after the last pixel,
+// so that a following segment continues the pattern. p0 and p1 may lie
+// outside target; clipped pixels still advance the pattern.
+//
+// target must be non-empty.
+template <typename image_type>
+size_t rasterize_patterned_line_segment(image_type& target,
+                                        const raster_point& p0,
+                                        const raster_point& p1,
+                                        const hdr_rgb& color,
+                                        const line_pattern& pattern,
+                                        size_t phase = 0,
+                                        const raster_rect& clip = UNCLIPPED) {
+  assert(!target.is_empty());
+  raster_rect bounds = clip.intersection(image_rect(target));
+  detail::pattern_cursor cursor(pattern, phase);
+  detail::step_line(p0.x, p0.y, p1.x, p1.y, [&](int x, int y) {
+      if (cursor.is_on()) {
+        detail::plot_clipped(target, bounds, x, y, color);
+      }
+      cursor.advance();
+    });
+  return cursor.phase();
+}
+
+// Draw a connected sequence of line segments through points with color,
+// following pattern from phase, which carries across the joints so dashes
+// continue around corners. As in rasterize_polyline, each joint pixel is
+// visited, and advances the pattern, only once.
+//
+// Returns the phase after the last pixel. target must be non-empty.
+template <typename image_type>
+size_t rasterize_patterned_polyline(image_type& target,
+                                    const std::vector<raster_point>& points,
+                                    const hdr_rgb& color,
+                                    const line_pattern& pattern,
+                                    size_t phase = 0,
+                                    const raster_rect& clip = UNCLIPPED) {
+  assert(!target.is_empty());
+  raster_rect bounds = clip.intersection(image_rect(target));
+  detail::pattern_cursor cursor(pattern, phase);
+
+  if (points.empty()) {
+    return cursor.phase();
+  }
+
+  auto visit = [&](int x, int y) {
+    if (cursor.is_on()) {
+      detail::plot_clipped(target, bounds, x, y, color);
+    }
+    cursor.advance();
+  };
+  visit(points.front().x, points.front().y);
+  for (size_t i = 1; i < points.size(); ++i) {
+    bool joint = true;
+    detail::step_line(points[i - 1].x, points[i - 1].y,
+                      points[i].x, points[i].y,
+                      [&](int x, int y) {
+                        if (joint) {
+                          joint = false;
+                        } else {
+                          visit(x, y);
+                        }
+                      });
+  }
+  return cursor.phase();
+}
+
+// A point with real-valued coordinates, measured in pixels, used as a
+// control point of a curve.
+struct curve_point {
+  double x;
+  double y;
+};
 
-    true_y += dy/steps;
-    y = round(true_y);
+// Default flattening tolerance for curves, in pixels. Within a quarter
+// pixel, the rounded segment endpoints are nearly always the pixels the
+// exact curve passes through.
+const double DEFAULT_CURVE_TOLERANCE = 0.25;
+
+namespace detail {
+
+// Midpoint of a and b.
+constexpr curve_point midpoint(const curve_point& a, const curve_point& b) {
+  return curve_point{(a.x + b.x) / 2.0, (a.y + b.y) / 2.0};
+}
+
+// Distance from p to the line segment from a to b.
+double distance_to_segment(const curve_point& p,
+                           const curve_point& a,
+                           const curve_point& b) {
+  double dx = b.x - a.x, dy = b.y - a.y,
+         length_squared = (dx * dx) + (dy * dy),
+         t = 0.0;
+  if (length_squared > 0.0) {
+    t = std::clamp((((p.x - a.x) * dx) + ((p.y - a.y) * dy)) / length_squared,
+                   0.0, 1.0);
+  }
+  return std::hypot(p.x - (a.x + (t * dx)), p.y - (a.y + (t * dy)));
+}
+
+// Subdivision depth limit; 2^16 segments is far beyond any sensible
+// tolerance, and guards against non-finite control points.
+const unsigned MAX_CURVE_DEPTH = 16;
+
+// Round a curve point to the nearest pixel, and append it to points unless
+// it is the same pixel as the last point already there.
+void append_rounded(std::vector<raster_point>& points, const curve_point& p) {
+  raster_point rounded{int(std::lround(p.x)), int(std::lround(p.y))};
+  if (points.empty() ||
+      (points.back().x != rounded.x) ||
+      (points.back().y != rounded.y)) {
+    points.push_back(rounded);
+  }
+}
+
+} // namespace detail
+
+// Flatten the quadratic Bézier curve with control points p0, p1, p2 into
+// line segments, none of which deviates from the curve by more than
+// tolerance pixels. The end point of each segment is appended to points, in
+// order; p0 itself is not appended, so consecutive curves chain together.
+//
+// Flattening is adaptive: a piece of the curve is split in half, by de
+// Casteljau subdivision, only while its control point is too far from its
+// chord, so flat or short stretches become single segments and only sharp
+// bends are subdivided finely.
+//
+// tolerance must be positive.
+void flatten_quadratic_bezier(const curve_point& p0,
+                              const curve_point& p1,
+                              const curve_point& p2,
+                              double tolerance,
+                              std::vector<curve_point>& points) {
+  assert(tolerance > 0.0);
+
+  struct piece {
+    curve_point p0, p1, p2;
+    unsigned depth;
+  };
+
+  // a stack holding pieces still to be processed, with the earliest piece
+  // on top
+  std::vector<piece> pending{{p0, p1, p2, 0}};
+  while (!pending.empty()) {
+    piece curve = pending.back();
+    pending.pop_back();
+
+    // the curve deviates from its chord by at most half the control
+    // point's distance
+    if ((curve.depth == detail::MAX_CURVE_DEPTH) ||
+        (detail::distance_to_segment(curve.p1, curve.p0, curve.p2) / 2.0
+         <= tolerance)) {
+      points.push_back(curve.p2);
+      continue;
+    }
+
+    curve_point l1 = detail::midpoint(curve.p0, curve.p1),
+                r1 = detail::midpoint(curve.p1, curve.p2),
+                mid = detail::midpoint(l1, r1);
+    pending.push_back({mid, r1, curve.p2, curve.depth + 1});
+    pending.push_back({curve.p0, l1, mid, curve.depth + 1});
+  }
+}
+
+// Flatten the cubic Bézier curve with control points p0, p1, p2, p3. The
+// conventions are the same as flatten_quadratic_bezier.
+void flatten_cubic_bezier(const curve_point& p0,
+                          const curve_point& p1,
+                          const curve_point& p2,
+                          const curve_point& p3,
+                          double tolerance,
+                          std::vector<curve_point>& points) {
+  assert(tolerance > 0.0);
+
+  struct piece {
+    curve_point p0, p1, p2, p3;
+    unsigned depth;
+  };
+
+  std::vector<piece> pending{{p0, p1, p2, p3, 0}};
+  while (!pending.empty()) {
+    piece curve = pending.back();
+    pending.pop_back();
+
+    // the curve deviates from its chord by at most 3/4 of the farther
+    // control point's distance
+    double distance =
+      std::max(detail::distance_to_segment(curve.p1, curve.p0, curve.p3),
+               detail::distance_to_segment(curve.p2, curve.p0, curve.p3));
+    if ((curve.depth == detail::MAX_CURVE_DEPTH) ||
+        ((distance * 0.75) <= tolerance)) {
+      points.push_back(curve.p3);
+      continue;
+    }
+
+    curve_point l1 = detail::midpoint(curve.p0, curve.p1),
+                m = detail::midpoint(curve.p1, curve.p2),
+                r2 = detail::midpoint(curve.p2, curve.p3),
+                l2 = detail::midpoint(l1, m),
+                r1 = detail::midpoint(m, r2),
+                mid = detail::midpoint(l2, r1);
+    pending.push_back({mid, r1, r2, curve.p3, curve.depth + 1});
+    pending.push_back({curve.p0, l1, l2, mid, curve.depth + 1});
   }
-  */
+}
 
-  // TODO: Rewrite the body of this function so that it actually works. After
-  // you do that, delete this comment.
+// Draw the quadratic Bézier curve with control points p0, p1, p2, all with
+// color.
+//
+// The curve is flattened to within tolerance pixels, the segment endpoints
+// are rounded to pixels, and the result is drawn with rasterize_polyline, so
+// no pixel is written twice where segments meet.
+//
+// target must be non-empty. The curve is clipped to the image bounds, and to
+// clip.
+template <typename image_type>
+void rasterize_quadratic_bezier(image_type& target,
+                                const curve_point& p0,
+                                const curve_point& p1,
+                                const curve_point& p2,
+                                const hdr_rgb& color,
+                                double tolerance = DEFAULT_CURVE_TOLERANCE,
+                                const raster_rect& clip = UNCLIPPED) {
+  std::vector<curve_point> flattened;
+  flatten_quadratic_bezier(p0, p1, p2, tolerance, flattened);
+
+  std::vector<raster_point> points;
+  points.reserve(flattened.size() + 1);
+  detail::append_rounded(points, p0);
+  for (auto& p : flattened) {
+    detail::append_rounded(points, p);
+  }
+  rasterize_polyline(target, points, color, clip);
+}
+
+// Draw the cubic Bézier curve with control points p0, p1, p2, p3. The
+// conventions are the same as rasterize_quadratic_bezier.
+template <typename image_type>
+void rasterize_cubic_bezier(image_type& target,
+                            const curve_point& p0,
+                            const curve_point& p1,
+                            const curve_point& p2,
+                            const curve_point& p3,
+                            const hdr_rgb& color,
+                            double tolerance = DEFAULT_CURVE_TOLERANCE,
+                            const raster_rect& clip = UNCLIPPED) {
+  std::vector<curve_point> flattened;
+  flatten_cubic_bezier(p0, p1, p2, p3, tolerance, flattened);
+
+  std::vector<raster_point> points;
+  points.reserve(flattened.size() + 1);
+  detail::append_rounded(points, p0);
+  for (auto& p : flattened) {
+    detail::append_rounded(points, p);
+  }
+  rasterize_polyline(target, points, color, clip);
 }
 
 // Convenience function to create many images, each containing one rasterized
 // line segment, and write them to PNG files, for the purposes of unit testing.
+// Each image has two colors, so the files are written as indexed PNGs.
 bool write_line_segment_cases(const std::string& filename_prefix) {
   for (unsigned end_x = 0; end_x <= 10; ++end_x) {
     for (unsigned end_y = 0; end_y <= 10; ++end_y) {
@@ -125,7 +1355,7 @@ bool write_line_segment_cases(const std::string& filename_prefix) {
                               + "-" + std::to_string(end_x)
                               + "-" + std::to_string(end_y)
                               + ".png");
-      if (!write_png(img, filename)) {
+      if (!write_png(img, filename, png_color_mode::automatic)) {
         return false;
       }
     }
@@ -0,0 +1,470 @@
+
+///////////////////////////////////////////////////////////////////////////////
+// gfxraw.hpp
+//
+// Read/write images in a simple uncompressed raw format, intended as a fast
+// interchange format for checkpoints and intermediate files. Unlike PNG,
+// raw files need no encoding or decoding, and can be memory-mapped, so an
+// image can be opened instantly, without copying its pixels.
+//
+// This file builds upon gfxfile.hpp and gfximage.hpp, so you may want to
+// familiarize yourself with those headers before diving into this one.
+//
+// This code uses the POSIX file and memory-mapping system calls.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gfxfile.hpp"
+#include "gfximage.hpp"
+
+namespace gfx {
+
+// A raw file is a raw_header, followed immediately by height rows of
+// row_bytes bytes each, top row first. Within a row, pixels are stored left
+// to right, and each pixel is R, G, B in the pixel format. All numbers are
+// in the byte order of the machine that wrote the file.
+
+// Pixel formats of raw files.
+//
+// rgb_float32: three 32-bit floats per pixel; exactly the in-memory layout
+//              of hdr_rgb, so pixels are stored without any loss.
+// rgb_uint8:   three bytes per pixel, converted with hdr_to_byte; a quarter
+//              of the size, with the same 8-bit quantization as PNG.
+enum class raw_pixel_format : uint32_t {
+  rgb_float32 = 1,
+  rgb_uint8 = 2
+};
+
+// Return the number of bytes of one pixel in format.
+constexpr size_t raw_pixel_bytes(raw_pixel_format format) {
+  return (format == raw_pixel_format::rgb_float32) ? 12 : 3;
+}
+
+// Current version of the raw format. Files with any other version are
+// rejected.
+const uint32_t RAW_FORMAT_VERSION = 1;
+
+// Header at the beginning of every raw file. It is 64 bytes long, so that
+// pixel rows in a memory-mapped file are aligned.
+struct raw_header {
+  char magic[8];          // "GFXRAW" followed by two zero bytes
+  uint32_t version;       // RAW_FORMAT_VERSION
+  raw_pixel_format format;
+  uint64_t width;
+  uint64_t height;
+  uint64_t row_bytes;     // width * raw_pixel_bytes(format)
+  uint8_t reserved[24];   // zero
+};
+
+static_assert(sizeof(raw_header) == 64, "raw_header must be 64 bytes");
+static_assert(sizeof(hdr_rgb) == 12, "hdr_rgb must be three packed floats");
+static_assert(std::is_trivially_copyable<hdr_rgb>::value,
+              "hdr_rgb must be trivially copyable");
+
+namespace detail {
+
+const char RAW_MAGIC[8] = {'G', 'F', 'X', 'R', 'A', 'W', 0, 0};
+
+// Return a header describing an image of the given dimensions and format.
+raw_header make_raw_header(size_t width, size_t height,
+                           raw_pixel_format format) {
+  raw_header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, RAW_MAGIC, sizeof(RAW_MAGIC));
+  header.version = RAW_FORMAT_VERSION;
+  header.format = format;
+  header.width = width;
+  header.height = height;
+  header.row_bytes = width * raw_pixel_bytes(format);
+  return header;
+}
+
+// Return true iff header is well formed, and describes a file of exactly
+// file_bytes bytes.
+bool is_raw_header_valid(const raw_header& header, uint64_t file_bytes) {
+  if ((std::memcmp(header.magic, RAW_MAGIC, sizeof(RAW_MAGIC)) != 0) ||
+      (header.version != RAW_FORMAT_VERSION) ||
+      ((header.format != raw_pixel_format::rgb_float32) &&
+       (header.format != raw_pixel_format::rgb_uint8)) ||
+      (header.width == 0) ||
+      (header.height == 0) ||
+      (header.row_bytes != header.width * raw_pixel_bytes(header.format))) {
+    return false;
+  }
+  // guard against overflow in the multiplication below
+  if (header.row_bytes > (file_bytes / header.height)) {
+    return false;
+  }
+  return (file_bytes == sizeof(raw_header) + header.row_bytes * header.height);
+}
+
+// Return true iff the pixel at the start of bytes, stored in format, holds
+// valid intensities. Every rgb_uint8 pixel is valid; an rgb_float32 pixel
+// may hold NaN or values outside [0.0, 1.0] when the file is corrupt or was
+// not written by write_raw.
+bool is_raw_pixel_valid(const unsigned char* bytes, raw_pixel_format format) {
+  if (format != raw_pixel_format::rgb_float32) {
+    return true;
+  }
+  float intensities[3];
+  std::memcpy(intensities, bytes, sizeof(intensities));
+  return is_hdr_intensity_valid(intensities[0]) &&
+         is_hdr_intensity_valid(intensities[1]) &&
+         is_hdr_intensity_valid(intensities[2]);
+}
+
+// Decode the pixel at the start of bytes, stored in format, which must be
+// valid according to is_raw_pixel_valid.
+hdr_rgb decode_raw_pixel(const unsigned char* bytes, raw_pixel_format format) {
+  if (format == raw_pixel_format::rgb_float32) {
+    float intensities[3];
+    std::memcpy(intensities, bytes, sizeof(intensities));
+    return hdr_rgb(intensities[0], intensities[1], intensities[2]);
+  } else {
+    return hdr_rgb::from_bytes(bytes[0], bytes[1], bytes[2]);
+  }
+}
+
+// Encode color to the start of bytes, in format.
+void encode_raw_pixel(const hdr_rgb& color,
+                      raw_pixel_format format,
+                      unsigned char* bytes) {
+  if (format == raw_pixel_format::rgb_float32) {
+    std::memcpy(bytes, &color, sizeof(color));
+  } else {
+    bytes[0] = hdr_to_byte(color.r());
+    bytes[1] = hdr_to_byte(color.g());
+    bytes[2] = hdr_to_byte(color.b());
+  }
+}
+
+} // namespace detail
+
+// Write image to a raw file at the given path, in the given pixel format.
+//
+// The file is written one row at a time, each with one pwrite; rgb_float32
+// rows are written straight from the image without conversion.
+//
+// The given image must be non-empty.
+//
+// Returns true on success and false on I/O error.
+bool write_raw(const hdr_image& image,
+               const std::string& path,
+               raw_pixel_format format = raw_pixel_format::rgb_float32) {
+  assert(!image.is_empty());
+
+  detail::unique_fd file(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                              0644));
+  if (file.get() < 0) {
+    return false;
+  }
+
+  raw_header header = detail::make_raw_header(image.width(), image.height(),
+                                              format);
+  bool ok = detail::pwrite_fully(file.get(), &header, sizeof(header), 0);
+
+  std::vector<unsigned char> converted;
+  if (format != raw_pixel_format::rgb_float32) {
+    converted.resize(header.row_bytes);
+  }
+  for (size_t y = 0; ok && (y < image.height()); ++y) {
+    const void* row = &image.pixel(0, y);
+    if (format != raw_pixel_format::rgb_float32) {
+      for (size_t x = 0; x < image.width(); ++x) {
+        detail::encode_raw_pixel(image.pixel(x, y), format,
+                                 &converted[x * raw_pixel_bytes(format)]);
+      }
+      row = converted.data();
+    }
+    ok = detail::pwrite_fully(file.get(), row, header.row_bytes,
+                              off_t(sizeof(header) + (y * header.row_bytes)));
+  }
+  return ok;
+}
+
+// A raw file mapped into memory. Pixels are read, and optionally written,
+// directly in the file's pages; nothing is decoded or copied when the file
+// is opened, and the operating system loads only the pages that are used.
+//
+// Create one with map_raw. A mapped_raw_image can be moved but not copied;
+// the mapping is released when it is destroyed.
+//
+// Since nothing is decoded when mapping, map_raw does not check that
+// rgb_float32 pixels are valid intensities. pixel() and to_image() require
+// valid pixels; for a file that might be corrupt or foreign, call
+// are_pixels_valid() first, or use read_raw, which does.
+class mapped_raw_image {
+private:
+  int fd_;
+  void* mapping_;
+  size_t mapping_bytes_;
+  bool writable_;
+  raw_header header_;
+
+  unsigned char* pixel_address(size_t x, size_t y) const {
+    return (static_cast<unsigned char*>(mapping_)
+            + sizeof(raw_header)
+            + (y * header_.row_bytes)
+            + (x * raw_pixel_bytes(header_.format)));
+  }
+
+  void release() {
+    if (mapping_) {
+      munmap(mapping_, mapping_bytes_);
+      mapping_ = nullptr;
+    }
+    if (fd_ >= 0) {
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+
+  mapped_raw_image(int fd,
+                   void* mapping,
+                   size_t mapping_bytes,
+                   bool writable,
+                   const raw_header& header)
+  : fd_(fd),
+    mapping_(mapping),
+    mapping_bytes_(mapping_bytes),
+    writable_(writable),
+    header_(header) { }
+
+  // Copy every pixel into target, which must have the same dimensions,
+  // and return true iff every pixel holds valid intensities. An
+  // rgb_float32 row is checked and then copied with one memcpy, while it is
+  // still in cache, so the file is read in a single pass. When this returns
+  // false, the rows from the first invalid one on are not copied.
+  bool copy_pixels(hdr_image& target) const {
+    assert((target.width() == width()) && (target.height() == height()));
+    if (format() != raw_pixel_format::rgb_float32) {
+      for (size_t y = 0; y < height(); ++y) {
+        for (size_t x = 0; x < width(); ++x) {
+          target.pixel(x, y, detail::decode_raw_pixel(pixel_address(x, y),
+                                                      format()));
+        }
+      }
+      return true;
+    }
+
+    static_assert(sizeof(hdr_rgb) == 12, "hdr_rgb must be three floats");
+    for (size_t y = 0; y < height(); ++y) {
+      const unsigned char* row = row_data(y);
+      bool valid = true;
+      for (size_t i = 0; i < header_.row_bytes; i += sizeof(float)) {
+        float intensity;
+        std::memcpy(&intensity, row + i, sizeof(intensity));
+        valid &= is_hdr_intensity_valid(intensity);
+      }
+      if (!valid) {
+        return false;
+      }
+      target.assign_row(y, row);
+    }
+    return true;
+  }
+
+  friend std::optional<mapped_raw_image> map_raw(const std::string&, bool);
+  friend std::optional<hdr_image> read_raw(const std::string&);
+
+public:
+
+  mapped_raw_image(const mapped_raw_image&) = delete;
+  mapped_raw_image& operator=(const mapped_raw_image&) = delete;
+
+  mapped_raw_image(mapped_raw_image&& other)
+  : fd_(other.fd_),
+    mapping_(other.mapping_),
+    mapping_bytes_(other.mapping_bytes_),
+    writable_(other.writable_),
+    header_(other.header_) {
+    other.fd_ = -1;
+    other.mapping_ = nullptr;
+  }
+
+  mapped_raw_image& operator=(mapped_raw_image&& other) {
+    if (this != &other) {
+      release();
+      fd_ = other.fd_;
+      mapping_ = other.mapping_;
+      mapping_bytes_ = other.mapping_bytes_;
+      writable_ = other.writable_;
+      header_ = other.header_;
+      other.fd_ = -1;
+      other.mapping_ = nullptr;
+    }
+    return *this;
+  }
+
+  ~mapped_raw_image() { release(); }
+
+  // Return true iff every pixel holds valid intensities, according to
+  // detail::is_raw_pixel_valid. This reads every pixel of an rgb_float32
+  // file, and none of an rgb_uint8 file.
+  bool are_pixels_valid() const {
+    if (format() != raw_pixel_format::rgb_float32) {
+      return true;
+    }
+    for (size_t y = 0; y < height(); ++y) {
+      for (size_t x = 0; x < width(); ++x) {
+        if (!detail::is_raw_pixel_valid(pixel_address(x, y), format())) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  // Assign every pixel (x, y) with x in [x_begin, x_end) to new_value. The
+  // mapping must be writable, y must be a valid coordinate, and
+  // x_begin <= x_end <= width().
+  void fill_span(size_t x_begin, size_t x_end, size_t y,
+                 const hdr_rgb& new_value) {
+    assert(is_writable());
+    assert(is_y(y));
+    assert(x_begin <= x_end);
+    assert(x_end <= width());
+    unsigned char encoded[12];
+    detail::encode_raw_pixel(new_value, format(), encoded);
+    size_t pixel_bytes = raw_pixel_bytes(format());
+    unsigned char* address = pixel_address(x_begin, y);
+    for (size_t x = x_begin; x < x_end; ++x, address += pixel_bytes) {
+      std::memcpy(address, encoded, pixel_bytes);
+    }
+  }
+
+  // Write modified pages back to the file now, rather than whenever the
+  // operating system chooses. Returns true on success.
+  bool flush() {
+    return !writable_ || (msync(mapping_, mapping_bytes_, MS_SYNC) == 0);
+  }
+
+  // Return the pixel format of the file.
+  raw_pixel_format format() const { return header_.format; }
+
+  // Return the height of the image, which is always positive.
+  size_t height() const { return header_.height; }
+
+  // Return false; a mapped raw image is never empty.
+  bool is_empty() const { return false; }
+
+  // Return true iff pixels may be written.
+  bool is_writable() const { return writable_; }
+
+  // Return true when x or y is a valid coordinate for this image.
+  bool is_x(size_t x) const { return x < width();  }
+  bool is_y(size_t y) const { return y < height(); }
+  bool is_xy(size_t x, size_t y) const {
+    return is_x(x) && is_y(y);
+  }
+
+  // Return the pixel color at (x, y), which must be a valid coordinate,
+  // and hold valid intensities.
+  hdr_rgb pixel(size_t x, size_t y) const {
+    assert(is_xy(x, y));
+    return detail::decode_raw_pixel(pixel_address(x, y), format());
+  }
+
+  // Assign the pixel at (x, y) to new_value. The mapping must be writable,
+  // and (x, y) must be a valid coordinate.
+  void pixel(size_t x, size_t y, const hdr_rgb& new_value) {
+    assert(is_writable());
+    assert(is_xy(x, y));
+    detail::encode_raw_pixel(new_value, format(), pixel_address(x, y));
+  }
+
+  // Return the address of the first byte of row y, which must be a valid
+  // coordinate. The row is width() pixels in format().
+  const unsigned char* row_data(size_t y) const {
+    assert(is_y(y));
+    return pixel_address(0, y);
+  }
+
+  // Return a copy of the mapped pixels as an hdr_image. Every pixel must
+  // hold valid intensities.
+  hdr_image to_image() const {
+    assert(are_pixels_valid());
+    hdr_image result(width(), height(), BLACK);
+    copy_pixels(result);
+    return result;
+  }
+
+  // Return the width of the image, which is always positive.
+  size_t width() const { return header_.width; }
+};
+
+// Map the raw file at the given path into memory. When writable is true,
+// pixels may also be assigned, and changes are written back to the file.
+//
+// On success, returns a non-empty optional containing the mapping.
+//
+// On I/O error, or when the file is not a valid raw file, returns an empty
+// optional object.
+std::optional<mapped_raw_image> map_raw(const std::string& path,
+                                        bool writable = false) {
+  int fd = open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+  if (fd < 0) {
+    return std::nullopt;
+  }
+
+  struct stat status;
+  raw_header header;
+  if ((fstat(fd, &status) != 0) ||
+      (status.st_size < off_t(sizeof(raw_header))) ||
+      (pread(fd, &header, sizeof(header), 0) != ssize_t(sizeof(header))) ||
+      !detail::is_raw_header_valid(header, uint64_t(status.st_size))) {
+    close(fd);
+    return std::nullopt;
+  }
+
+  size_t bytes = size_t(status.st_size);
+  void* mapping = mmap(nullptr,
+                       bytes,
+                       writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+                       MAP_SHARED,
+                       fd,
+                       0);
+  if (mapping == MAP_FAILED) {
+    close(fd);
+    return std::nullopt;
+  }
+
+  return mapped_raw_image(fd, mapping, bytes, writable, header);
+}
+
+// Read a raw file at the given path into an hdr_image.
+//
+// On success, returns a non-empty optional<hdr_image> containing the
+// hdr_image with the contents of the image file.
+//
+// On I/O error, or when the file is not a valid raw file, including when
+// any pixel holds an invalid intensity, returns an empty optional object.
+//
+// Pixels are checked as they are copied, so the file is read only once.
+std::optional<hdr_image> read_raw(const std::string& path) {
+  auto mapped = map_raw(path);
+  if (!mapped) {
+    return std::nullopt;
+  }
+  hdr_image result(mapped->width(), mapped->height(), BLACK);
+  if (!mapped->copy_pixels(result)) {
+    return std::nullopt;
+  }
+  return result;
+}
+
+} // namespace gfx
@@ -0,0 +1,338 @@
+
+///////////////////////////////////////////////////////////////////////////////
+// gfxspatial.hpp
+//
+// A spatial index over line segments, for hit testing and region queries.
+//
+// A segment_grid divides the image into square cells, and lists, for each
+// cell, the segments with at least one pixel in it. Pixels are those that
+// rasterize_line_segment draws, computed in closed form rather than by
+// stepping: after i steps along its major axis, a segment has taken
+//
+//   floor((2 * minor * i + major - 1 + tie_bias) / (2 * major))
+//
+// steps along its minor axis, where tie_bias is as in line_pixels. So
+// binning a segment costs time in proportion to the number of cells it
+// crosses, not its length, and exact tests against one pixel or one
+// rectangle take constant time.
+//
+// This file builds upon gfxrasterize.hpp, so you may want to familiarize
+// yourself with that header before diving into this one.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "gfxrasterize.hpp"
+
+namespace gfx {
+
+// Default width and height, in pixels, of the cells of a segment_grid.
+const size_t DEFAULT_GRID_CELL_SIZE = 32;
+
+namespace detail {
+
+// The stepping of a line segment, as in line_pixels, in a form that gives
+// the pixel at any step directly.
+struct segment_steps {
+  int major_start, minor_start, major_sign, minor_sign, major, minor,
+      tie_bias;
+  bool x_major;
+
+  explicit segment_steps(const line_segment& segment) {
+    int x0 = int(segment.x0), y0 = int(segment.y0),
+        x1 = int(segment.x1), y1 = int(segment.y1),
+        dx = std::abs(x1 - x0), dy = std::abs(y1 - y0),
+        sx = (x0 < x1) ? 1 : -1, sy = (y0 < y1) ? 1 : -1;
+    x_major = (dx >= dy);
+    major_start = x_major ? x0 : y0;
+    minor_start = x_major ? y0 : x0;
+    major_sign = x_major ? sx : sy;
+    minor_sign = x_major ? sy : sx;
+    major = x_major ? dx : dy;
+    minor = x_major ? dy : dx;
+    tie_bias = (minor_sign < 0) ? 1 : 0;
+  }
+
+  // Return the minor coordinate of the pixel at step i, 0 <= i <= major.
+  int minor_at(int i) const {
+    if (major == 0) {
+      return minor_start;
+    }
+    int64_t taken = ((2 * int64_t(minor) * i) + major - 1 + tie_bias)
+                    / (2 * int64_t(major));
+    return minor_start + (minor_sign * int(taken));
+  }
+
+  // Return the step at which the major coordinate is major_coordinate; the
+  // result is outside [0, major] when the segment does not reach it.
+  int step_at(int major_coordinate) const {
+    return (major_coordinate - major_start) * major_sign;
+  }
+};
+
+} // namespace detail
+
+// Return true iff rasterize_line_segment would draw segment over the pixel
+// at (x, y).
+bool line_segment_covers(const line_segment& segment, int x, int y) {
+  detail::segment_steps steps(segment);
+  int i = steps.step_at(steps.x_major ? x : y);
+  if ((i < 0) || (i > steps.major)) {
+    return false;
+  }
+  return steps.minor_at(i) == (steps.x_major ? y : x);
+}
+
+// Return true iff rasterize_line_segment would draw at least one pixel of
+// segment inside rect.
+bool line_segment_crosses(const line_segment& segment,
+                          const raster_rect& rect) {
+  if (rect.is_empty()) {
+    return false;
+  }
+  detail::segment_steps steps(segment);
+  int major_min = steps.x_major ? rect.x_min : rect.y_min,
+      major_max = (steps.x_major ? rect.x_max : rect.y_max) - 1,
+      minor_min = steps.x_major ? rect.y_min : rect.x_min,
+      minor_max = (steps.x_major ? rect.y_max : rect.x_max) - 1;
+
+  // the steps whose major coordinate is inside rect
+  int first = steps.step_at(major_min), last = steps.step_at(major_max);
+  if (first > last) {
+    std::swap(first, last);
+  }
+  first = std::max(first, 0);
+  last = std::min(last, steps.major);
+  if (first > last) {
+    return false;
+  }
+
+  // the minor coordinate moves monotonically, and by at most one per step,
+  // so the pixels of those steps cover every minor coordinate in between
+  int a = steps.minor_at(first), b = steps.minor_at(last);
+  return (std::max(a, b) >= minor_min) && (std::min(a, b) <= minor_max);
+}
+
+// A uniform grid index over a fixed list of line segments.
+//
+// Segments are identified by their index in the list. Every query returns
+// indices in ascending order, which is the order they would be drawn in.
+class segment_grid {
+private:
+
+    size_t width_ = 0, height_ = 0, cell_size_ = DEFAULT_GRID_CELL_SIZE,
+           cells_across_ = 0, cells_down_ = 0;
+    std::vector<line_segment> segments_;
+
+    // the segments of cell c are entries_[starts_[c]] through
+    // entries_[starts_[c + 1] - 1]
+    std::vector<size_t> starts_;
+    std::vector<uint32_t> entries_;
+
+    size_t cell_index(size_t cell_x, size_t cell_y) const {
+      return (cell_y * cells_across_) + cell_x;
+    }
+
+    // Call visit(cell) once for every cell containing a pixel of segment.
+    template <typename visitor_type>
+    void for_each_cell(const line_segment& segment,
+                       visitor_type visit) const {
+      detail::segment_steps steps(segment);
+      int size = int(cell_size_);
+      // walk the major axis one cell at a time; steps first through last
+      // share a major cell
+      for (int first = 0; first <= steps.major; ) {
+        int major_coordinate = steps.major_start
+                               + (steps.major_sign * first),
+            major_cell = major_coordinate / size,
+            boundary = (steps.major_sign > 0)
+                       ? (((major_cell + 1) * size) - 1)
+                       : (major_cell * size),
+            last = std::min(steps.major, steps.step_at(boundary));
+        int a = steps.minor_at(first), b = steps.minor_at(last);
+        for (int minor_cell = std::min(a, b) / size;
+             minor_cell <= (std::max(a, b) / size);
+             ++minor_cell) {
+          visit(steps.x_major ? cell_index(major_cell, minor_cell)
+                              : cell_index(minor_cell, major_cell));
+        }
+        first = last + 1;
+      }
+    }
+
+    // Run work(begin, end) over [0, count) in chunks of chunk, each on its
+    // own thread.
+    template <typename work_type>
+    static void parallel_for(size_t count, size_t chunk, work_type work) {
+      std::vector<std::thread> threads;
+      for (size_t begin = chunk; begin < count; begin += chunk) {
+        threads.emplace_back(work, begin, std::min(count, begin + chunk));
+      }
+      work(0, std::min(count, chunk));
+      for (auto& thread : threads) {
+        thread.join();
+      }
+    }
+
+public:
+
+  // Create an empty index.
+  segment_grid() { }
+
+  // Index segments, whose endpoints must all be valid coordinates in a
+  // width by height image, with cells of cell_size pixels on a side.
+  //
+  // The index is built with a parallel counting sort on thread_count
+  // threads: each thread counts the cells of its share of the segments,
+  // the counts are summed into cell offsets, and then each thread writes
+  // its entries into place. Entries within a cell stay in segment order,
+  // so the result does not depend on thread_count.
+  segment_grid(size_t width,
+               size_t height,
+               std::vector<line_segment> segments,
+               size_t cell_size = DEFAULT_GRID_CELL_SIZE,
+               unsigned thread_count = 1)
+  : width_(width),
+    height_(height),
+    cell_size_(cell_size),
+    cells_across_((width + cell_size - 1) / cell_size),
+    cells_down_((height + cell_size - 1) / cell_size),
+    segments_(std::move(segments)) {
+    assert(width > 0);
+    assert(height > 0);
+    assert(cell_size > 0);
+    assert(thread_count > 0);
+    assert(segments_.size() <= UINT32_MAX);
+    for (auto& segment : segments_) {
+      assert((segment.x0 < width) && (segment.y0 < height));
+      assert((segment.x1 < width) && (segment.y1 < height));
+    }
+
+    // per-thread counts of entries in each cell
+    size_t cell_count = cells_across_ * cells_down_,
+           count = segments_.size(),
+           chunk = std::max(size_t(1),
+                            (count + thread_count - 1) / thread_count),
+           chunk_count = std::max(size_t(1), (count + chunk - 1) / chunk);
+    std::vector<std::vector<size_t>> offsets(chunk_count,
+                                             std::vector<size_t>(cell_count));
+    parallel_for(count, chunk, [&](size_t begin, size_t end) {
+        auto& counts = offsets[begin / chunk];
+        for (size_t i = begin; i < end; ++i) {
+          for_each_cell(segments_[i], [&](size_t cell) { ++counts[cell]; });
+        }
+      });
+
+    // turn the counts into each chunk's first position in each cell
+    starts_.assign(cell_count + 1, 0);
+    size_t position = 0;
+    for (size_t cell = 0; cell < cell_count; ++cell) {
+      starts_[cell] = position;
+      for (auto& chunk_offsets : offsets) {
+        size_t n = chunk_offsets[cell];
+        chunk_offsets[cell] = position;
+        position += n;
+      }
+    }
+    starts_[cell_count] = position;
+
+    entries_.resize(position);
+    parallel_for(count, chunk, [&](size_t begin, size_t end) {
+        auto& next = offsets[begin / chunk];
+        for (size_t i = begin; i < end; ++i) {
+          for_each_cell(segments_[i], [&](size_t cell) {
+              entries_[next[cell]++] = uint32_t(i);
+            });
+        }
+      });
+  }
+
+  // Return the width and height of cells.
+  size_t cell_size() const { return cell_size_; }
+
+  // Return the number of (cell, segment) entries in the index.
+  size_t entry_count() const { return entries_.size(); }
+
+  // Return the height of the indexed area.
+  size_t height() const { return height_; }
+
+  // Return the indices of the segments that rasterize_line_segment would
+  // draw over the pixel at (x, y), which must be inside the indexed area.
+  std::vector<size_t> hit_test(size_t x, size_t y) const {
+    assert((x < width_) && (y < height_));
+    std::vector<size_t> result;
+    size_t cell = cell_index(x / cell_size_, y / cell_size_);
+    for (size_t i = starts_[cell]; i < starts_[cell + 1]; ++i) {
+      if (line_segment_covers(segments_[entries_[i]], int(x), int(y))) {
+        result.push_back(entries_[i]);
+      }
+    }
+    return result;
+  }
+
+  // Return the indices of the segments that rasterize_line_segment would
+  // draw at least one pixel of inside rect.
+  std::vector<size_t> query(const raster_rect& rect) const {
+    std::vector<size_t> result;
+    raster_rect bounds = rect.intersection(raster_rect{0, 0, int(width_),
+                                                       int(height_)});
+    if (bounds.is_empty()) {
+      return result;
+    }
+    size_t cell_x_min = bounds.x_min / cell_size_,
+           cell_y_min = bounds.y_min / cell_size_,
+           cell_x_max = (bounds.x_max - 1) / cell_size_,
+           cell_y_max = (bounds.y_max - 1) / cell_size_;
+    for (size_t cell_y = cell_y_min; cell_y <= cell_y_max; ++cell_y) {
+      for (size_t cell_x = cell_x_min; cell_x <= cell_x_max; ++cell_x) {
+        size_t cell = cell_index(cell_x, cell_y);
+        for (size_t i = starts_[cell]; i < starts_[cell + 1]; ++i) {
+          result.push_back(entries_[i]);
+        }
+      }
+    }
+
+    // a segment is listed once in each of its cells
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    result.erase(std::remove_if(result.begin(), result.end(),
+                                [&](size_t index) {
+                                  return !line_segment_crosses(
+                                    segments_[index], bounds);
+                                }),
+                 result.end());
+    return result;
+  }
+
+  // Redraw the part of the indexed scene inside rect: draw every segment
+  // crossing rect, in index order, with color, clipped to rect. Pixels of
+  // target inside rect end up as they would if every segment were drawn
+  // over the same background, and pixels outside rect are untouched.
+  template <typename image_type>
+  void redraw(image_type& target, const raster_rect& rect,
+              const hdr_rgb& color) const {
+    for (size_t index : query(rect)) {
+      auto& segment = segments_[index];
+      rasterize_line_segment(target,
+                             raster_point{int(segment.x0), int(segment.y0)},
+                             raster_point{int(segment.x1), int(segment.y1)},
+                             color,
+                             rect);
+    }
+  }
+
+  // Return the indexed segments.
+  const std::vector<line_segment>& segments() const { return segments_; }
+
+  // Return the width of the indexed area.
+  size_t width() const { return width_; }
+};
+
+} // namespace gfx
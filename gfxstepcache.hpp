@@ -0,0 +1,327 @@
+
+///////////////////////////////////////////////////////////////////////////////
+// gfxstepcache.hpp
+//
+// A cache of line step patterns, for scenes with many repeated segments.
+//
+// The pixels that step_line visits depend only on the segment's octant and
+// its (dx, dy) delta, not on where it starts. Moreover, when dx and dy share
+// a common factor g, the steps are the steps of (dx / g, dy / g) repeated g
+// times, because the exact line passes through the same fractional positions
+// in every repetition. So grids, hatching, and glyph outlines, which repeat
+// a few deltas many times, can precompute each reduced pattern once, and
+// replay it from any starting pixel.
+//
+// This file builds upon gfxrasterize.hpp, so you may want to familiarize
+// yourself with that header before diving into this one.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <list>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+
+#include "gfxrasterize.hpp"
+
+namespace gfx {
+
+// Default budget of bytes held by a step_pattern_cache.
+const size_t DEFAULT_STEP_CACHE_BYTES = size_t(1) << 20;
+
+// Counters of step_pattern_cache activity.
+//
+// table_hits: segments whose reduced delta is small enough for the
+//             compile-time table, which bypasses the cache
+// hits:       segments replayed from a cached pattern
+// misses:     segments whose pattern had to be computed
+// evictions:  patterns dropped to stay within the memory budget
+// bytes:      bytes currently held by cached patterns
+struct step_cache_stats {
+  size_t table_hits = 0;
+  size_t hits = 0;
+  size_t misses = 0;
+  size_t evictions = 0;
+  size_t bytes = 0;
+};
+
+namespace detail {
+
+// Reduced deltas up to this size, on the major axis, are looked up in
+// STEP_TABLE instead of the cache. This covers every segment of
+// write_line_segment_cases.
+const int STEP_TABLE_MAX_MAJOR = 5;
+
+// Return the minor-axis steps of the first count major-axis steps of a line
+// with the given major and minor deltas, major >= minor >= 0, and the tie
+// bias of step_line: bit i is set iff the minor coordinate advances along
+// with the major coordinate at step i. count must be at most 64.
+constexpr uint64_t minor_step_bits(int major, int minor, int tie_bias,
+                                   int first, int count) {
+  uint64_t bits = 0;
+  int d = (2 * minor) - major + tie_bias;
+  for (int i = 0; i < (first + count); ++i) {
+    if (d > 0) {
+      if (i >= first) {
+        bits |= uint64_t(1) << (i - first);
+      }
+      d -= 2 * major;
+    }
+    d += 2 * minor;
+  }
+  return bits;
+}
+
+// Minor step bits of every reduced delta with major <= STEP_TABLE_MAX_MAJOR,
+// indexed by [tie_bias][major][minor], computed at compile time.
+using step_table_type
+  = std::array<std::array<std::array<uint8_t, STEP_TABLE_MAX_MAJOR + 1>,
+                          STEP_TABLE_MAX_MAJOR + 1>,
+               2>;
+
+constexpr step_table_type make_step_table() {
+  step_table_type table{};
+  for (int bias = 0; bias < 2; ++bias) {
+    for (int major = 1; major <= STEP_TABLE_MAX_MAJOR; ++major) {
+      for (int minor = 0; minor <= major; ++minor) {
+        table[bias][major][minor]
+          = uint8_t(minor_step_bits(major, minor, bias, 0, major));
+      }
+    }
+  }
+  return table;
+}
+
+constexpr step_table_type STEP_TABLE = make_step_table();
+
+} // namespace detail
+
+// A bounded, least-recently-used cache of reduced line step patterns.
+//
+// A pattern is keyed by the tie direction of its octant, which together
+// with the reduced (major, minor) delta determines every minor-axis step;
+// the other octant bits only choose the signs and axes used when it is
+// replayed. So one cached pattern serves four of the eight octants.
+//
+// A cache is not thread-safe; give each drawing thread its own.
+class step_pattern_cache {
+private:
+
+    struct entry {
+      uint64_t key;
+      std::vector<uint64_t> bits;
+    };
+
+    using entry_list = std::list<entry>;
+
+    size_t max_bytes_;
+    entry_list entries_;
+    std::unordered_map<uint64_t, entry_list::iterator> index_;
+    step_cache_stats stats_;
+
+    // A direct-mapped memo of recent unreduced deltas, so repeated
+    // segments skip both the gcd and the hash lookup. Slots point into
+    // entries_, and are all invalidated on any eviction; a hit still moves
+    // its entry to the front, so the memo does not hide recent use.
+    struct recent_slot {
+      uint64_t key = UINT64_MAX;
+      int period = 0;
+      entry_list::iterator entry;
+    };
+
+    static constexpr size_t RECENT_SLOTS = 64;
+    std::array<recent_slot, RECENT_SLOTS> recent_;
+
+    void forget_recent() { recent_.fill(recent_slot()); }
+
+    static uint64_t make_key(int tie_bias, int major, int minor) {
+      return (uint64_t(tie_bias) << 62)
+             | (uint64_t(uint32_t(major)) << 31)
+             | uint64_t(uint32_t(minor));
+    }
+
+    static size_t entry_bytes(const entry& e) {
+      return sizeof(entry) + (e.bits.size() * sizeof(uint64_t));
+    }
+
+    // Return the entry of a reduced delta, computing and caching its step
+    // bits if necessary. The entry is moved to the front of entries_.
+    entry_list::iterator lookup(int tie_bias, int major, int minor) {
+      uint64_t key = make_key(tie_bias, major, minor);
+      auto found = index_.find(key);
+      if (found != index_.end()) {
+        ++stats_.hits;
+        entries_.splice(entries_.begin(), entries_, found->second);
+        return found->second;
+      }
+
+      ++stats_.misses;
+      entry e{key, std::vector<uint64_t>((major + 63) / 64)};
+      for (size_t word = 0; word < e.bits.size(); ++word) {
+        int first = int(word * 64);
+        e.bits[word] = detail::minor_step_bits(major, minor, tie_bias, first,
+                                               std::min(64, major - first));
+      }
+      size_t bytes = entry_bytes(e);
+      while (!entries_.empty() && ((stats_.bytes + bytes) > max_bytes_)) {
+        stats_.bytes -= entry_bytes(entries_.back());
+        index_.erase(entries_.back().key);
+        entries_.pop_back();
+        ++stats_.evictions;
+        forget_recent();
+      }
+      // a pattern larger than the whole budget is still used, but only
+      // until the next miss
+      entries_.push_front(std::move(e));
+      index_[key] = entries_.begin();
+      stats_.bytes += bytes;
+      return entries_.begin();
+    }
+
+    // Take major steps from (x, y), after visiting it, along the x axis if
+    // x_major is true and the y axis otherwise, advancing the minor axis as
+    // bits says, and visit each pixel stepped to.
+    template <bool x_major, typename visitor_type>
+    static void replay(int x, int y, int sx, int sy, int major, int period,
+                       const uint64_t* bits, visitor_type& visit) {
+      // most patterns fit in one word, which is kept in a register, since
+      // visit may write memory that bits could alias
+      const uint64_t first_word = bits[0];
+      const bool one_word = (period <= 64);
+      int phase = 0;
+      for (int i = 0; i < major; ++i) {
+        bool minor_step = (one_word ? (first_word >> phase)
+                                    : (bits[phase / 64] >> (phase % 64))) & 1;
+        if (x_major) {
+          x += sx;
+          y += minor_step ? sy : 0;
+        } else {
+          x += minor_step ? sx : 0;
+          y += sy;
+        }
+        phase = ((phase + 1) == period) ? 0 : (phase + 1);
+        visit(x, y);
+      }
+    }
+
+public:
+
+  explicit step_pattern_cache(size_t max_bytes = DEFAULT_STEP_CACHE_BYTES)
+  : max_bytes_(max_bytes) { }
+
+  // Drop every cached pattern. Statistics other than bytes are kept.
+  void clear() {
+    entries_.clear();
+    index_.clear();
+    stats_.bytes = 0;
+    forget_recent();
+  }
+
+  // Return the memory budget, in bytes.
+  size_t max_bytes() const { return max_bytes_; }
+
+  // Zero the activity counters. bytes is not a counter, and is not
+  // affected.
+  void reset_stats() {
+    size_t bytes = stats_.bytes;
+    stats_ = step_cache_stats();
+    stats_.bytes = bytes;
+  }
+
+  // Return the number of cached patterns.
+  size_t size() const { return entries_.size(); }
+
+  // Return the counters.
+  const step_cache_stats& stats() const { return stats_; }
+
+  // Step along the line segment from (x0, y0) to (x1, y1), calling
+  // visit(x, y) for exactly the pixels, and in the same order, as
+  // detail::step_line.
+  template <typename visitor_type>
+  void step(int x0, int y0, int x1, int y1, visitor_type visit) {
+    const int dx = std::abs(x1 - x0),
+              dy = std::abs(y1 - y0),
+              sx = (x0 < x1) ? 1 : -1,
+              sy = (y0 < y1) ? 1 : -1;
+    const bool x_major = (dx >= dy);
+    const int major = x_major ? dx : dy,
+              minor = x_major ? dy : dx,
+              tie_bias = ((x_major ? sy : sx) < 0) ? 1 : 0;
+
+    visit(x0, y0);
+    if (major == 0) {
+      return;
+    }
+
+    int period;
+    uint64_t small_bits;
+    const uint64_t* bits;
+    uint64_t key = make_key(tie_bias, major, minor);
+    recent_slot& slot = recent_[(key ^ (key >> 29)) % RECENT_SLOTS];
+    if (slot.key == key) {
+      ++stats_.hits;
+      entries_.splice(entries_.begin(), entries_, slot.entry);
+      period = slot.period;
+      bits = slot.entry->bits.data();
+    } else {
+      period = major / std::gcd(major, minor);
+      int reduced_minor = minor / (major / period);
+      if (period <= detail::STEP_TABLE_MAX_MAJOR) {
+        ++stats_.table_hits;
+        small_bits = detail::STEP_TABLE[tie_bias][period][reduced_minor];
+        bits = &small_bits;
+      } else {
+        slot.entry = lookup(tie_bias, period, reduced_minor);
+        slot.key = key;
+        slot.period = period;
+        bits = slot.entry->bits.data();
+      }
+    }
+
+    if (x_major) {
+      replay<true>(x0, y0, sx, sy, major, period, bits, visit);
+    } else {
+      replay<false>(x0, y0, sx, sy, major, period, bits, visit);
+    }
+  }
+};
+
+// Draw a line segment as rasterize_line_segment does, replaying its steps
+// from cache. The pixels are identical.
+template <typename image_type>
+void rasterize_line_segment(image_type& target,
+                            unsigned x0, unsigned y0,
+                            unsigned x1, unsigned y1,
+                            const hdr_rgb& color,
+                            step_pattern_cache& cache) {
+  assert(!target.is_empty());
+  assert(target.is_xy(x0, y0));
+  assert(target.is_xy(x1, y1));
+
+  cache.step(int(x0), int(y0), int(x1), int(y1),
+             [&](int x, int y) { target.pixel(x, y, color); });
+}
+
+// Draw every segment in segments, in order, as rasterize_line_segments
+// does, replaying their steps from cache. The pixels are identical.
+template <typename image_type>
+void rasterize_line_segments(image_type& target,
+                             const std::vector<line_segment>& segments,
+                             const hdr_rgb& color,
+                             step_pattern_cache& cache) {
+  assert(!target.is_empty());
+  for (auto& segment : segments) {
+    assert(target.is_xy(segment.x0, segment.y0));
+    assert(target.is_xy(segment.x1, segment.y1));
+    cache.step(int(segment.x0), int(segment.y0),
+               int(segment.x1), int(segment.y1),
+               [&](int x, int y) { target.pixel(x, y, color); });
+  }
+}
+
+} // namespace gfx
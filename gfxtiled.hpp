@@ -0,0 +1,439 @@
+
+///////////////////////////////////////////////////////////////////////////////
+// gfxtiled.hpp
+//
+// Out-of-core images, for canvases too large to fit in memory. A
+// tiled_image is divided into square tiles that are paged to a backing file,
+// and only a bounded number of recently-used tiles are kept in memory.
+//
+// This file builds upon gfxfile.hpp, gfximage.hpp, and gfxrasterize.hpp, so
+// you may want to familiarize yourself with those headers before diving into
+// this one.
+//
+// This code uses the POSIX file system calls.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <list>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "gfxfile.hpp"
+#include "gfximage.hpp"
+#include "gfxrasterize.hpp"
+
+namespace gfx {
+
+// Default memory budget of a tiled_image: 256 MiB of resident tiles.
+const size_t DEFAULT_TILE_MEMORY_BUDGET = size_t(256) << 20;
+
+// Default width and height of a tile, in pixels.
+const size_t DEFAULT_TILE_SIZE = 256;
+
+// Counters of tile cache activity.
+//
+// hits:        pixel accesses whose tile was already in memory
+// misses:      pixel accesses whose tile had to be paged in
+// loads:       tiles read from the backing file
+// write_backs: modified tiles written to the backing file
+// evictions:   tiles dropped from memory to stay within the budget
+struct tile_cache_stats {
+  size_t hits = 0;
+  size_t misses = 0;
+  size_t loads = 0;
+  size_t write_backs = 0;
+  size_t evictions = 0;
+};
+
+// An image whose pixels live in a backing file, divided into square tiles of
+// tile_size() x tile_size() pixels. Tiles are paged into memory on demand,
+// and a least-recently-used cache keeps as many of them resident as fit in
+// the memory budget. A modified tile is written back to the file when it is
+// evicted, on flush(), and on destruction.
+//
+// A tiled_image has the same pixel and fill_span interface as hdr_image,
+// except that pixel(x, y) returns a copy, since the tile holding the pixel
+// may be evicted at any later access. So it can be passed to
+// rasterize_line_segment and rasterize_line_segments.
+//
+// Tiles that have never been written back are not read from the file;
+// they are initialized to the fill color instead, so a new image costs no
+// I/O until it is drawn on.
+//
+// Create one with make_tiled_image. A tiled_image can be moved but not
+// copied.
+class tiled_image {
+private:
+
+    struct cache_entry {
+      std::vector<hdr_rgb> pixels;
+      bool dirty = false;
+      std::list<size_t>::iterator lru_position;
+    };
+
+    detail::unique_fd file_;
+    size_t width_, height_, tile_size_, tiles_x_, tiles_y_, max_resident_;
+    hdr_rgb fill_color_;
+
+    // paging state, which changes even when pixels are only read; stored_
+    // marks the tiles that have been written to the file
+    mutable bool io_error_ = false;
+    mutable std::vector<bool> stored_;
+    mutable std::list<size_t> lru_; // most-recently-used first
+    mutable std::unordered_map<size_t, cache_entry> resident_;
+    mutable size_t last_tile_ = SIZE_MAX;
+    mutable cache_entry* last_entry_ = nullptr;
+    mutable tile_cache_stats stats_;
+
+    size_t tile_pixels() const { return tile_size_ * tile_size_; }
+
+    off_t tile_offset(size_t tile) const {
+      return off_t(tile) * off_t(tile_pixels() * sizeof(hdr_rgb));
+    }
+
+    bool write_back(size_t tile, cache_entry& entry) const {
+      if (!entry.dirty) {
+        return true;
+      }
+      bool ok = detail::pwrite_fully(file_.get(),
+                                     entry.pixels.data(),
+                                     entry.pixels.size() * sizeof(hdr_rgb),
+                                     tile_offset(tile));
+      ++stats_.write_backs;
+      if (ok) {
+        entry.dirty = false;
+        stored_[tile] = true;
+      } else {
+        io_error_ = true;
+      }
+      return ok;
+    }
+
+    // Return the cache entry of tile, paging it in, and evicting the
+    // least-recently-used tile if necessary.
+    cache_entry& entry(size_t tile) const {
+      if (tile == last_tile_) {
+        ++stats_.hits;
+        return *last_entry_;
+      }
+
+      auto found = resident_.find(tile);
+      if (found != resident_.end()) {
+        ++stats_.hits;
+        lru_.splice(lru_.begin(), lru_, found->second.lru_position);
+        last_tile_ = tile;
+        last_entry_ = &found->second;
+        return found->second;
+      }
+
+      ++stats_.misses;
+
+      // reuse the evicted tile's buffer, to avoid an allocation per miss; a
+      // victim whose write-back fails stays resident, over the budget, so
+      // its pixels are not lost and a later flush() can retry it
+      std::vector<hdr_rgb> pixels;
+      if (resident_.size() >= max_resident_) {
+        size_t victim = lru_.back();
+        auto evicted = resident_.find(victim);
+        if (write_back(victim, evicted->second)) {
+          pixels.swap(evicted->second.pixels);
+          resident_.erase(evicted);
+          lru_.pop_back();
+          ++stats_.evictions;
+        }
+      }
+      pixels.resize(tile_pixels());
+
+      if (stored_[tile]) {
+        ++stats_.loads;
+        if (!detail::pread_fully(file_.get(),
+                                 pixels.data(),
+                                 pixels.size() * sizeof(hdr_rgb),
+                                 tile_offset(tile))) {
+          io_error_ = true;
+          std::fill(pixels.begin(), pixels.end(), fill_color_);
+        }
+      } else {
+        std::fill(pixels.begin(), pixels.end(), fill_color_);
+      }
+
+      lru_.push_front(tile);
+      cache_entry& result = resident_[tile];
+      result.pixels.swap(pixels);
+      result.lru_position = lru_.begin();
+      last_tile_ = tile;
+      last_entry_ = &result;
+      return result;
+    }
+
+    size_t tile_of(size_t x, size_t y) const {
+      return ((y / tile_size_) * tiles_x_) + (x / tile_size_);
+    }
+
+    size_t index_in_tile(size_t x, size_t y) const {
+      return ((y % tile_size_) * tile_size_) + (x % tile_size_);
+    }
+
+    tiled_image(detail::unique_fd&& file,
+                size_t width,
+                size_t height,
+                size_t tile_size,
+                size_t memory_budget,
+                const hdr_rgb& fill_color)
+    : file_(std::move(file)),
+      width_(width),
+      height_(height),
+      tile_size_(tile_size),
+      tiles_x_((width + tile_size - 1) / tile_size),
+      tiles_y_((height + tile_size - 1) / tile_size),
+      max_resident_(std::max<size_t>(1, memory_budget
+                                        / (tile_size * tile_size
+                                           * sizeof(hdr_rgb)))),
+      fill_color_(fill_color),
+      stored_(tiles_x_ * tiles_y_, false) { }
+
+    friend std::optional<tiled_image> make_tiled_image(const std::string&,
+                                                       size_t, size_t,
+                                                       const hdr_rgb&,
+                                                       size_t, size_t);
+
+public:
+
+  tiled_image(const tiled_image&) = delete;
+  tiled_image& operator=(const tiled_image&) = delete;
+
+  tiled_image(tiled_image&& other)
+  : file_(std::move(other.file_)),
+    width_(other.width_),
+    height_(other.height_),
+    tile_size_(other.tile_size_),
+    tiles_x_(other.tiles_x_),
+    tiles_y_(other.tiles_y_),
+    max_resident_(other.max_resident_),
+    fill_color_(other.fill_color_),
+    io_error_(other.io_error_),
+    stored_(std::move(other.stored_)),
+    lru_(std::move(other.lru_)),
+    resident_(std::move(other.resident_)),
+    stats_(other.stats_) {
+    other.resident_.clear();
+    other.lru_.clear();
+    other.last_tile_ = SIZE_MAX;
+    other.last_entry_ = nullptr;
+  }
+
+  tiled_image& operator=(tiled_image&& other) {
+    if (this != &other) {
+      flush();
+      file_ = std::move(other.file_);
+      width_ = other.width_;
+      height_ = other.height_;
+      tile_size_ = other.tile_size_;
+      tiles_x_ = other.tiles_x_;
+      tiles_y_ = other.tiles_y_;
+      max_resident_ = other.max_resident_;
+      fill_color_ = other.fill_color_;
+      io_error_ = other.io_error_;
+      stored_ = std::move(other.stored_);
+      lru_ = std::move(other.lru_);
+      resident_ = std::move(other.resident_);
+      last_tile_ = SIZE_MAX;
+      last_entry_ = nullptr;
+      stats_ = other.stats_;
+      other.resident_.clear();
+      other.lru_.clear();
+      other.last_tile_ = SIZE_MAX;
+      other.last_entry_ = nullptr;
+    }
+    return *this;
+  }
+
+  ~tiled_image() {
+    if (file_.get() >= 0) {
+      flush();
+    }
+  }
+
+  // Assign every pixel (x, y) with x in [x_begin, x_end) to new_value.
+  //
+  // y must be a valid coordinate, and x_begin <= x_end <= width(). Each
+  // tile the span crosses is looked up once.
+  void fill_span(size_t x_begin, size_t x_end, size_t y,
+                 const hdr_rgb& new_value) {
+    assert(is_y(y));
+    assert(x_begin <= x_end);
+    assert(x_end <= width());
+    size_t x = x_begin;
+    while (x < x_end) {
+      size_t tile_end = std::min(x_end, ((x / tile_size_) + 1) * tile_size_);
+      cache_entry& tile = entry(tile_of(x, y));
+      auto first = tile.pixels.begin() + index_in_tile(x, y);
+      std::fill(first, first + (tile_end - x), new_value);
+      tile.dirty = true;
+      x = tile_end;
+    }
+  }
+
+  // Write every modified resident tile back to the file. Tiles stay in
+  // memory, and a tile whose write fails stays modified, so a later flush
+  // retries it. Returns false if this, or any earlier paging, failed.
+  bool flush() {
+    // write back in file order, so the writes are sequential
+    std::vector<size_t> dirty;
+    for (auto& [tile, cached] : resident_) {
+      if (cached.dirty) {
+        dirty.push_back(tile);
+      }
+    }
+    std::sort(dirty.begin(), dirty.end());
+    for (size_t tile : dirty) {
+      write_back(tile, resident_[tile]);
+    }
+    return !io_error_;
+  }
+
+  // Return true iff any read or write of the backing file has failed.
+  bool has_io_error() const { return io_error_; }
+
+  // Return the height of the image, which is always positive.
+  size_t height() const { return height_; }
+
+  // Return false; a tiled image is never empty.
+  bool is_empty() const { return false; }
+
+  // Return true when x or y is a valid coordinate for this image.
+  bool is_x(size_t x) const { return x < width();  }
+  bool is_y(size_t y) const { return y < height(); }
+  bool is_xy(size_t x, size_t y) const {
+    return is_x(x) && is_y(y);
+  }
+
+  // Return the maximum number of tiles kept in memory at once.
+  size_t max_resident_tiles() const { return max_resident_; }
+
+  // Return a copy of the pixel color at (x, y), which must be a valid
+  // coordinate.
+  hdr_rgb pixel(size_t x, size_t y) const {
+    assert(is_xy(x, y));
+    return entry(tile_of(x, y)).pixels[index_in_tile(x, y)];
+  }
+
+  // Assign the pixel at (x, y) to new_value; (x, y) must be a valid
+  // coordinate.
+  void pixel(size_t x, size_t y, const hdr_rgb& new_value) {
+    assert(is_xy(x, y));
+    cache_entry& tile = entry(tile_of(x, y));
+    tile.pixels[index_in_tile(x, y)] = new_value;
+    tile.dirty = true;
+  }
+
+  // Zero the cache counters.
+  void reset_stats() { stats_ = tile_cache_stats(); }
+
+  // Return the number of tiles currently in memory.
+  size_t resident_tiles() const { return resident_.size(); }
+
+  // Return the cache counters.
+  const tile_cache_stats& stats() const { return stats_; }
+
+  // Return the number of tiles in each row and column of tiles.
+  size_t tile_columns() const { return tiles_x_; }
+  size_t tile_rows() const { return tiles_y_; }
+
+  // Return the width and height of a tile, in pixels. Tiles along the
+  // right and bottom edges may extend past the image.
+  size_t tile_size() const { return tile_size_; }
+
+  // Return the width of the image, which is always positive.
+  size_t width() const { return width_; }
+};
+
+// Create a tiled_image of the given dimensions, backed by a new file at the
+// given path, with every pixel initialized to fill_color. Any existing file
+// at path is replaced. The file is not removed when the image is destroyed.
+//
+// At most memory_budget bytes of tiles are kept in memory, and at least one
+// tile. width, height, and tile_size must be positive.
+//
+// On success, returns a non-empty optional containing the image.
+//
+// On I/O error, returns an empty optional object.
+std::optional<tiled_image> make_tiled_image(
+    const std::string& path,
+    size_t width,
+    size_t height,
+    const hdr_rgb& fill_color = BLACK,
+    size_t tile_size = DEFAULT_TILE_SIZE,
+    size_t memory_budget = DEFAULT_TILE_MEMORY_BUDGET) {
+  assert(width > 0);
+  assert(height > 0);
+  assert(tile_size > 0);
+
+  detail::unique_fd file(open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644));
+  if (file.get() < 0) {
+    return std::nullopt;
+  }
+  return tiled_image(std::move(file), width, height, tile_size, memory_budget,
+                     fill_color);
+}
+
+namespace detail {
+
+// Interleave the bits of x and y, giving the position of (x, y) along a
+// Z-order (Morton) curve. Nearby cells have nearby keys in both directions.
+constexpr uint64_t morton_key(uint32_t x, uint32_t y) {
+  uint64_t key = 0;
+  for (unsigned bit = 0; bit < 32; ++bit) {
+    key |= (uint64_t((x >> bit) & 1) << (2 * bit))
+           | (uint64_t((y >> bit) & 1) << (2 * bit + 1));
+  }
+  return key;
+}
+
+} // namespace detail
+
+// Draw every segment in segments, all with color, visiting the segments in
+// Z-order of the tiles holding their midpoints, rather than in the given
+// order. Segments in the same or neighbouring tiles are then drawn
+// together, so each tile is paged in about once, rather than once per
+// segment that touches it.
+//
+// Since every segment has the same color, the result is identical to the
+// generic rasterize_line_segments.
+//
+// Every endpoint must be a valid coordinate in target.
+void rasterize_line_segments(tiled_image& target,
+                             const std::vector<line_segment>& segments,
+                             const hdr_rgb& color) {
+  std::vector<std::pair<uint64_t, size_t>> order(segments.size());
+  for (size_t i = 0; i < segments.size(); ++i) {
+    auto& segment = segments[i];
+    assert(target.is_xy(segment.x0, segment.y0));
+    assert(target.is_xy(segment.x1, segment.y1));
+    uint32_t tile_x = ((size_t(segment.x0) + segment.x1) / 2)
+                      / target.tile_size(),
+             tile_y = ((size_t(segment.y0) + segment.y1) / 2)
+                      / target.tile_size();
+    order[i] = {detail::morton_key(tile_x, tile_y), i};
+  }
+  std::sort(order.begin(), order.end());
+
+  for (auto& [key, i] : order) {
+    auto& segment = segments[i];
+    detail::step_line(int(segment.x0), int(segment.y0),
+                      int(segment.x1), int(segment.y1),
+                      [&](int x, int y) { target.pixel(x, y, color); });
+  }
+}
+
+} // namespace gfx
@@ -0,0 +1,473 @@
+
+///////////////////////////////////////////////////////////////////////////////
+// gfxtransform.hpp
+//
+// Geometric transforms, and batch transformation of points and line
+// segments from real coordinates to the integer pixel coordinates that the
+// rasterizers expect.
+//
+// Batches are stored as structures of arrays, one array per coordinate, and
+// transformed 16 points at a time with AVX-512, 8 at a time with AVX, or one
+// at a time otherwise, depending on the instruction sets the code is
+// compiled for (for example with -mavx or -march=native). Every path gives
+// identical results.
+//
+// This file builds upon gfxrasterize.hpp, so you may want to familiarize
+// yourself with that header before diving into this one.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#if defined(__AVX__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "gfxrasterize.hpp"
+
+namespace gfx {
+
+// A 2D affine transform, mapping (x, y) to
+//
+//   (xx * x + xy * y + tx,  yx * x + yy * y + ty).
+struct affine_transform {
+  float xx = 1.0f, xy = 0.0f, tx = 0.0f,
+        yx = 0.0f, yy = 1.0f, ty = 0.0f;
+
+  // Return the transform that leaves every point where it is.
+  static affine_transform identity() { return affine_transform(); }
+
+  // Return the transform that moves every point by (dx, dy).
+  static affine_transform translation(float dx, float dy) {
+    affine_transform result;
+    result.tx = dx;
+    result.ty = dy;
+    return result;
+  }
+
+  // Return the transform that scales about the origin by sx and sy.
+  static affine_transform scaling(float sx, float sy) {
+    affine_transform result;
+    result.xx = sx;
+    result.yy = sy;
+    return result;
+  }
+
+  // Return the transform that rotates about the origin by radians. Since y
+  // grows downward, positive angles turn clockwise on screen.
+  static affine_transform rotation(float radians) {
+    affine_transform result;
+    float c = std::cos(radians), s = std::sin(radians);
+    result.xx = c;
+    result.xy = -s;
+    result.yx = s;
+    result.yy = c;
+    return result;
+  }
+
+  // Return the composition that applies rhs first, then this transform.
+  affine_transform operator*(const affine_transform& rhs) const {
+    affine_transform result;
+    result.xx = (xx * rhs.xx) + (xy * rhs.yx);
+    result.xy = (xx * rhs.xy) + (xy * rhs.yy);
+    result.tx = (xx * rhs.tx) + (xy * rhs.ty) + tx;
+    result.yx = (yx * rhs.xx) + (yy * rhs.yx);
+    result.yy = (yx * rhs.xy) + (yy * rhs.yy);
+    result.ty = (yx * rhs.tx) + (yy * rhs.ty) + ty;
+    return result;
+  }
+
+  // Return the image of point p.
+  curve_point apply(const curve_point& p) const {
+    return curve_point{(xx * p.x) + (xy * p.y) + tx,
+                       (yx * p.x) + (yy * p.y) + ty};
+  }
+
+  // Return true iff axis-aligned rectangles stay axis-aligned.
+  bool is_axis_aligned() const { return (xy == 0.0f) && (yx == 0.0f); }
+};
+
+// A 2D projective transform, mapping (x, y) to (X / W, Y / W), where
+//
+//   X = m[0][0] * x + m[0][1] * y + m[0][2]
+//   Y = m[1][0] * x + m[1][1] * y + m[1][2]
+//   W = m[2][0] * x + m[2][1] * y + m[2][2].
+struct projective_transform {
+  float m[3][3] = {{1.0f, 0.0f, 0.0f},
+                   {0.0f, 1.0f, 0.0f},
+                   {0.0f, 0.0f, 1.0f}};
+
+  // Return the projective transform equivalent to affine.
+  static projective_transform from_affine(const affine_transform& affine) {
+    projective_transform result;
+    result.m[0][0] = affine.xx;
+    result.m[0][1] = affine.xy;
+    result.m[0][2] = affine.tx;
+    result.m[1][0] = affine.yx;
+    result.m[1][1] = affine.yy;
+    result.m[1][2] = affine.ty;
+    return result;
+  }
+};
+
+// How transformed coordinates are rounded to integers.
+//
+// nearest_even: to the nearest integer, and ties to even
+// nearest_up:   to the nearest integer, and ties up; floor(x + 0.5)
+// down:         toward negative infinity; floor(x)
+// up:           toward positive infinity; ceil(x)
+// toward_zero:  toward zero; trunc(x)
+enum class rounding_mode {
+  nearest_even,
+  nearest_up,
+  down,
+  up,
+  toward_zero
+};
+
+// How transform_points turns real coordinates into integers: the rounding
+// mode, and an inclusive range that rounded coordinates are clamped to. The
+// range bounds should be at most 2^24 in magnitude, where every integer is
+// exactly representable as a float. NaN coordinates become the maximum.
+struct quantize_options {
+  rounding_mode rounding = rounding_mode::nearest_even;
+  int x_min = -(1 << 24), y_min = -(1 << 24),
+      x_max = 1 << 24, y_max = 1 << 24;
+
+  // Return options that clamp coordinates to the pixels of rect, which
+  // must be non-empty.
+  static quantize_options clamped_to(const raster_rect& rect,
+                                     rounding_mode rounding
+                                       = rounding_mode::nearest_even) {
+    assert(!rect.is_empty());
+    quantize_options result;
+    result.rounding = rounding;
+    result.x_min = rect.x_min;
+    result.y_min = rect.y_min;
+    result.x_max = rect.x_max - 1;
+    result.y_max = rect.y_max - 1;
+    return result;
+  }
+};
+
+namespace detail {
+
+// Round one coordinate with mode, then clamp it to [low, high].
+int quantize(float coordinate, rounding_mode mode, float low, float high) {
+  float rounded;
+  switch (mode) {
+  case rounding_mode::nearest_even: rounded = std::nearbyint(coordinate);
+                                    break;
+  case rounding_mode::nearest_up:   rounded = std::floor(coordinate + 0.5f);
+                                    break;
+  case rounding_mode::down:         rounded = std::floor(coordinate);  break;
+  case rounding_mode::up:           rounded = std::ceil(coordinate);   break;
+  default:                          rounded = std::trunc(coordinate);  break;
+  }
+  // written so that NaN becomes high, as with the vector min and max
+  rounded = (rounded < high) ? rounded : high;
+  rounded = (rounded > low) ? rounded : low;
+  return int(rounded);
+}
+
+#if defined(__AVX512F__)
+
+// Round and clamp 16 coordinates, as quantize does.
+__m512i quantize16(__m512 coordinates, rounding_mode mode,
+                   __m512 low, __m512 high) {
+  __m512 rounded;
+  switch (mode) {
+  case rounding_mode::nearest_even:
+    rounded = _mm512_roundscale_ps(coordinates, _MM_FROUND_TO_NEAREST_INT
+                                                | _MM_FROUND_NO_EXC);
+    break;
+  case rounding_mode::nearest_up:
+    rounded = _mm512_roundscale_ps(_mm512_add_ps(coordinates,
+                                                 _mm512_set1_ps(0.5f)),
+                                   _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    break;
+  case rounding_mode::down:
+    rounded = _mm512_roundscale_ps(coordinates, _MM_FROUND_TO_NEG_INF
+                                                | _MM_FROUND_NO_EXC);
+    break;
+  case rounding_mode::up:
+    rounded = _mm512_roundscale_ps(coordinates, _MM_FROUND_TO_POS_INF
+                                                | _MM_FROUND_NO_EXC);
+    break;
+  default:
+    rounded = _mm512_roundscale_ps(coordinates, _MM_FROUND_TO_ZERO
+                                                | _MM_FROUND_NO_EXC);
+    break;
+  }
+  return _mm512_cvttps_epi32(_mm512_max_ps(_mm512_min_ps(rounded, high),
+                                           low));
+}
+
+#elif defined(__AVX__)
+
+// Round and clamp 8 coordinates, as quantize does.
+__m256i quantize8(__m256 coordinates, rounding_mode mode,
+                  __m256 low, __m256 high) {
+  __m256 rounded;
+  switch (mode) {
+  case rounding_mode::nearest_even:
+    rounded = _mm256_round_ps(coordinates, _MM_FROUND_TO_NEAREST_INT
+                                           | _MM_FROUND_NO_EXC);
+    break;
+  case rounding_mode::nearest_up:
+    rounded = _mm256_floor_ps(_mm256_add_ps(coordinates,
+                                            _mm256_set1_ps(0.5f)));
+    break;
+  case rounding_mode::down:
+    rounded = _mm256_floor_ps(coordinates);
+    break;
+  case rounding_mode::up:
+    rounded = _mm256_ceil_ps(coordinates);
+    break;
+  default:
+    rounded = _mm256_round_ps(coordinates, _MM_FROUND_TO_ZERO
+                                           | _MM_FROUND_NO_EXC);
+    break;
+  }
+  return _mm256_cvttps_epi32(_mm256_max_ps(_mm256_min_ps(rounded, high),
+                                           low));
+}
+
+#endif
+
+} // namespace detail
+
+// Transform count points, with coordinates xs[i] and ys[i], by transform,
+// and quantize the results into pixel_xs[i] and pixel_ys[i] according to
+// options.
+//
+// The multiply and add of the transform are not fused, on any path, so
+// the results are identical whichever instruction set is used.
+void transform_points(const affine_transform& transform,
+                      const float* xs,
+                      const float* ys,
+                      size_t count,
+                      int* pixel_xs,
+                      int* pixel_ys,
+                      const quantize_options& options = quantize_options()) {
+  const float x_low = float(options.x_min), x_high = float(options.x_max),
+              y_low = float(options.y_min), y_high = float(options.y_max);
+  size_t i = 0;
+
+#if defined(__AVX512F__)
+  const __m512 xx = _mm512_set1_ps(transform.xx),
+               xy = _mm512_set1_ps(transform.xy),
+               tx = _mm512_set1_ps(transform.tx),
+               yx = _mm512_set1_ps(transform.yx),
+               yy = _mm512_set1_ps(transform.yy),
+               ty = _mm512_set1_ps(transform.ty),
+               x_low16 = _mm512_set1_ps(x_low),
+               x_high16 = _mm512_set1_ps(x_high),
+               y_low16 = _mm512_set1_ps(y_low),
+               y_high16 = _mm512_set1_ps(y_high);
+  for (; (i + 16) <= count; i += 16) {
+    __m512 x = _mm512_loadu_ps(xs + i), y = _mm512_loadu_ps(ys + i);
+    __m512 tx16 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(xx, x),
+                                              _mm512_mul_ps(xy, y)),
+                                tx),
+           ty16 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(yx, x),
+                                              _mm512_mul_ps(yy, y)),
+                                ty);
+    _mm512_storeu_si512(pixel_xs + i,
+                        detail::quantize16(tx16, options.rounding,
+                                           x_low16, x_high16));
+    _mm512_storeu_si512(pixel_ys + i,
+                        detail::quantize16(ty16, options.rounding,
+                                           y_low16, y_high16));
+  }
+#elif defined(__AVX__)
+  const __m256 xx = _mm256_set1_ps(transform.xx),
+               xy = _mm256_set1_ps(transform.xy),
+               tx = _mm256_set1_ps(transform.tx),
+               yx = _mm256_set1_ps(transform.yx),
+               yy = _mm256_set1_ps(transform.yy),
+               ty = _mm256_set1_ps(transform.ty),
+               x_low8 = _mm256_set1_ps(x_low),
+               x_high8 = _mm256_set1_ps(x_high),
+               y_low8 = _mm256_set1_ps(y_low),
+               y_high8 = _mm256_set1_ps(y_high);
+  for (; (i + 8) <= count; i += 8) {
+    __m256 x = _mm256_loadu_ps(xs + i), y = _mm256_loadu_ps(ys + i);
+    __m256 tx8 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(xx, x),
+                                             _mm256_mul_ps(xy, y)),
+                               tx),
+           ty8 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(yx, x),
+                                             _mm256_mul_ps(yy, y)),
+                               ty);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(pixel_xs + i),
+                        detail::quantize8(tx8, options.rounding,
+                                          x_low8, x_high8));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(pixel_ys + i),
+                        detail::quantize8(ty8, options.rounding,
+                                          y_low8, y_high8));
+  }
+#endif
+
+  // the scalar path, for the remainder of a vector path
+  for (; i < count; ++i) {
+    float x = xs[i], y = ys[i];
+    float product_xx = transform.xx * x, product_xy = transform.xy * y,
+          product_yx = transform.yx * x, product_yy = transform.yy * y;
+    pixel_xs[i] = detail::quantize((product_xx + product_xy) + transform.tx,
+                                   options.rounding, x_low, x_high);
+    pixel_ys[i] = detail::quantize((product_yx + product_yy) + transform.ty,
+                                   options.rounding, y_low, y_high);
+  }
+}
+
+// Transform count points by a projective transform, as above. Points that
+// map to infinity, where W is zero, are clamped like any other.
+void transform_points(const projective_transform& transform,
+                      const float* xs,
+                      const float* ys,
+                      size_t count,
+                      int* pixel_xs,
+                      int* pixel_ys,
+                      const quantize_options& options = quantize_options()) {
+  const float x_low = float(options.x_min), x_high = float(options.x_max),
+              y_low = float(options.y_min), y_high = float(options.y_max);
+  const auto& m = transform.m;
+  size_t i = 0;
+
+#if defined(__AVX512F__)
+  const __m512 x_low16 = _mm512_set1_ps(x_low),
+               x_high16 = _mm512_set1_ps(x_high),
+               y_low16 = _mm512_set1_ps(y_low),
+               y_high16 = _mm512_set1_ps(y_high);
+  auto row = [](const float* coefficients, __m512 x, __m512 y) {
+    return _mm512_add_ps(
+      _mm512_add_ps(_mm512_mul_ps(_mm512_set1_ps(coefficients[0]), x),
+                    _mm512_mul_ps(_mm512_set1_ps(coefficients[1]), y)),
+      _mm512_set1_ps(coefficients[2]));
+  };
+  for (; (i + 16) <= count; i += 16) {
+    __m512 x = _mm512_loadu_ps(xs + i), y = _mm512_loadu_ps(ys + i);
+    __m512 w = row(m[2], x, y);
+    _mm512_storeu_si512(pixel_xs + i,
+                        detail::quantize16(_mm512_div_ps(row(m[0], x, y), w),
+                                           options.rounding,
+                                           x_low16, x_high16));
+    _mm512_storeu_si512(pixel_ys + i,
+                        detail::quantize16(_mm512_div_ps(row(m[1], x, y), w),
+                                           options.rounding,
+                                           y_low16, y_high16));
+  }
+#elif defined(__AVX__)
+  const __m256 x_low8 = _mm256_set1_ps(x_low),
+               x_high8 = _mm256_set1_ps(x_high),
+               y_low8 = _mm256_set1_ps(y_low),
+               y_high8 = _mm256_set1_ps(y_high);
+  auto row = [](const float* coefficients, __m256 x, __m256 y) {
+    return _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(coefficients[0]), x),
+                    _mm256_mul_ps(_mm256_set1_ps(coefficients[1]), y)),
+      _mm256_set1_ps(coefficients[2]));
+  };
+  for (; (i + 8) <= count; i += 8) {
+    __m256 x = _mm256_loadu_ps(xs + i), y = _mm256_loadu_ps(ys + i);
+    __m256 w = row(m[2], x, y);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(pixel_xs + i),
+                        detail::quantize8(_mm256_div_ps(row(m[0], x, y), w),
+                                          options.rounding,
+                                          x_low8, x_high8));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(pixel_ys + i),
+                        detail::quantize8(_mm256_div_ps(row(m[1], x, y), w),
+                                          options.rounding,
+                                          y_low8, y_high8));
+  }
+#endif
+
+  for (; i < count; ++i) {
+    float x = xs[i], y = ys[i];
+    auto row = [&](const float* coefficients) {
+      float product_x = coefficients[0] * x, product_y = coefficients[1] * y;
+      return (product_x + product_y) + coefficients[2];
+    };
+    float w = row(m[2]);
+    pixel_xs[i] = detail::quantize(row(m[0]) / w,
+                                   options.rounding, x_low, x_high);
+    pixel_ys[i] = detail::quantize(row(m[1]) / w,
+                                   options.rounding, y_low, y_high);
+  }
+}
+
+// A batch of line segments with real coordinates, stored as a structure of
+// arrays: segment i runs from (x0[i], y0[i]) to (x1[i], y1[i]).
+struct segment_batch {
+  std::vector<float> x0, y0, x1, y1;
+
+  // Append a segment.
+  void push_back(float from_x, float from_y, float to_x, float to_y) {
+    x0.push_back(from_x);
+    y0.push_back(from_y);
+    x1.push_back(to_x);
+    y1.push_back(to_y);
+  }
+
+  // Remove every segment.
+  void clear() {
+    x0.clear();
+    y0.clear();
+    x1.clear();
+    y1.clear();
+  }
+
+  // Return true iff there are no segments.
+  bool empty() const { return x0.empty(); }
+
+  // Make room for count segments.
+  void reserve(size_t count) {
+    x0.reserve(count);
+    y0.reserve(count);
+    x1.reserve(count);
+    y1.reserve(count);
+  }
+
+  // Return the number of segments.
+  size_t size() const { return x0.size(); }
+};
+
+// Transform every segment of batch, and quantize the endpoints into
+// segments, replacing its contents, ready for rasterize_line_segments.
+//
+// Endpoints are clamped to rect, which must be non-empty and lie within the
+// target image, so every endpoint is a valid coordinate. transform_type is
+// affine_transform or projective_transform.
+template <typename transform_type>
+void transform_segments(const transform_type& transform,
+                        const segment_batch& batch,
+                        const raster_rect& rect,
+                        std::vector<line_segment>& segments,
+                        rounding_mode rounding = rounding_mode::nearest_even) {
+  assert(rect.x_min >= 0);
+  assert(rect.y_min >= 0);
+  auto options = quantize_options::clamped_to(rect, rounding);
+
+  size_t count = batch.size();
+  std::vector<int> pixels(4 * count);
+  int* x0 = pixels.data();
+  int* y0 = x0 + count;
+  int* x1 = y0 + count;
+  int* y1 = x1 + count;
+  transform_points(transform, batch.x0.data(), batch.y0.data(), count,
+                   x0, y0, options);
+  transform_points(transform, batch.x1.data(), batch.y1.data(), count,
+                   x1, y1, options);
+
+  segments.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    segments[i] = line_segment{unsigned(x0[i]), unsigned(y0[i]),
+                               unsigned(x1[i]), unsigned(y1[i])};
+  }
+}
+
+} // namespace gfx
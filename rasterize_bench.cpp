@@ -0,0 +1,182 @@
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gfxcodec.hpp"
+#include "gfxexport.hpp"
+#include "gfxhalf.hpp"
+#include "gfximage.hpp"
+#include "gfxlayer.hpp"
+#include "gfxload.hpp"
+#include "gfxpool.hpp"
+#include "gfxrasterize.hpp"
+#include "gfxspatial.hpp"
+#include "gfxstepcache.hpp"
+#include "gfxtransform.hpp"
+
+// Run body once to warm up, then iterations more times, and print the
+// average time per iteration and the number of heap allocations made by the
+// image buffer pool in those iterations.
+template <typename body_type>
+void run(const char* name, unsigned iterations, body_type body) {
+  auto& pool = gfx::default_buffer_pool();
+  body();
+  pool.reset_stats();
+
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < iterations; ++i) {
+    body();
+  }
+  std::chrono::duration<double, std::micro> elapsed
+    = std::chrono::steady_clock::now() - start;
+
+  auto stats = pool.stats();
+  std::printf("%-28s %12.2f us/iter %10zu allocations %10zu reuses\n",
+              name,
+              elapsed.count() / iterations,
+              stats.system_allocations,
+              stats.reuses);
+}
+
+int main() {
+  // the canvases of write_line_segment_cases, without the PNG encoding
+  run("line segment cases", 100, [] {
+      for (unsigned end_x = 0; end_x <= 10; ++end_x) {
+        for (unsigned end_y = 0; end_y <= 10; ++end_y) {
+          gfx::hdr_image img(11, 11, gfx::SILVER);
+          gfx::rasterize_line_segment(img, 5, 5, end_x, end_y, gfx::RED);
+        }
+      }
+    });
+
+  // a large frame, copied and resized every iteration
+  run("frame copy and resize", 20, [] {
+      gfx::hdr_image frame(1024, 768, gfx::BLACK);
+      gfx::rasterize_line_segment(frame, 0, 0, 1023, 767, gfx::WHITE);
+      gfx::hdr_image snapshot(frame);
+      snapshot.resize(512, 384);
+    });
+
+  // transform and quantize a batch of segments, then draw them
+  gfx::segment_batch batch;
+  for (unsigned i = 0; i < 100000; ++i) {
+    batch.push_back(float(i % 1000), float(i % 700),
+                    float((i * 7) % 1000), float((i * 13) % 700));
+  }
+  gfx::hdr_image target(1024, 768, gfx::BLACK);
+  std::vector<gfx::line_segment> segments;
+  run("transform 100k segments", 20, [&] {
+      gfx::transform_segments(gfx::affine_transform::rotation(0.1f), batch,
+                              gfx::raster_rect{0, 0, 1024, 768}, segments);
+    });
+  run("draw 100k segments", 2, [&] {
+      gfx::rasterize_line_segments(target, segments, gfx::WHITE);
+    });
+
+  // the same segments on per-thread layers, composited
+  std::vector<gfx::hdr_rgb> colors(segments.size(), gfx::WHITE);
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  run("draw 100k segments layered", 2, [&] {
+      gfx::rasterize_line_segments_layered(target, segments, colors,
+                                           threads);
+    });
+
+  // hatching: many short segments sharing a few deltas, with and without
+  // the step pattern cache
+  std::vector<gfx::line_segment> hatching;
+  for (unsigned i = 0; i < 100000; ++i) {
+    unsigned x = (i * 7) % 1000, y = (i * 3) % 700;
+    hatching.push_back(gfx::line_segment{x, y, x + 13 + (i % 4), y + 9});
+  }
+  run("hatching", 10, [&] {
+      gfx::rasterize_line_segments(target, hatching, gfx::WHITE);
+    });
+  gfx::step_pattern_cache step_cache;
+  run("hatching (step cache)", 10, [&] {
+      gfx::rasterize_line_segments(target, hatching, gfx::WHITE, step_cache);
+    });
+
+  // index the 100k segments, and hit test and redraw through the index
+  gfx::segment_grid grid;
+  run("index 100k segments", 5, [&] {
+      grid = gfx::segment_grid(1024, 768, segments,
+                               gfx::DEFAULT_GRID_CELL_SIZE, threads);
+    });
+  run("hit test 1k pixels", 5, [&] {
+      for (unsigned i = 0; i < 1000; ++i) {
+        grid.hit_test((i * 37) % 1024, (i * 11) % 768);
+      }
+    });
+  run("redraw 64x64 viewport", 5, [&] {
+      grid.redraw(target, gfx::raster_rect{300, 200, 364, 264}, gfx::WHITE);
+    });
+
+  // encode and decode the drawn frame with each codec, in memory
+  std::string png_bytes = *gfx::encode_png(target),
+              qoi_bytes = gfx::encode_qoi(target),
+              ppm_bytes = gfx::encode_ppm(target);
+  std::printf("frame size: png %zu, png indexed %zu, qoi %zu, ppm %zu "
+              "bytes\n",
+              png_bytes.size(),
+              gfx::encode_png(target, gfx::png_color_mode::automatic)->size(),
+              qoi_bytes.size(), ppm_bytes.size());
+  run("encode frame png", 5, [&] { gfx::encode_png(target); });
+  run("encode frame png indexed", 5, [&] {
+      gfx::encode_png(target, gfx::png_color_mode::automatic);
+    });
+  run("encode frame qoi", 5, [&] { gfx::encode_qoi(target); });
+  run("encode frame ppm", 5, [&] { gfx::encode_ppm(target); });
+  run("decode frame png", 5, [&] { gfx::decode_png(png_bytes); });
+  run("decode frame qoi", 5, [&] { gfx::decode_qoi(qoi_bytes); });
+  run("decode frame ppm", 5, [&] { gfx::decode_ppm(ppm_bytes); });
+
+  // store the drawn frame as halves, and convert it back
+  gfx::half_image half_frame(target);
+  run("frame to half", 5, [&] { gfx::half_image converted(target); });
+  run("half frame to hdr", 5, [&] { half_frame.to_hdr(); });
+
+  // encode the images of write_line_segment_cases, truecolor and indexed
+  std::vector<gfx::hdr_image> cases;
+  for (unsigned end_x = 0; end_x <= 10; ++end_x) {
+    for (unsigned end_y = 0; end_y <= 10; ++end_y) {
+      cases.emplace_back(11, 11, gfx::SILVER);
+      gfx::rasterize_line_segment(cases.back(), 5, 5, end_x, end_y,
+                                  gfx::RED);
+    }
+  }
+  size_t truecolor_bytes = 0, indexed_bytes = 0;
+  for (auto& image : cases) {
+    truecolor_bytes += gfx::encode_png(image)->size();
+    indexed_bytes
+      += gfx::encode_png(image, gfx::png_color_mode::automatic)->size();
+  }
+  std::printf("line segment cases size: png %zu, png indexed %zu bytes\n",
+              truecolor_bytes, indexed_bytes);
+  run("encode cases png", 10, [&] {
+      for (auto& image : cases) {
+        gfx::encode_png(image);
+      }
+    });
+  run("encode cases png indexed", 10, [&] {
+      for (auto& image : cases) {
+        gfx::encode_png(image, gfx::png_color_mode::automatic);
+      }
+    });
+
+  // the same, with per-thread caches
+  gfx::default_buffer_pool().set_thread_caching(true);
+  run("line segment cases (cached)", 100, [] {
+      for (unsigned end_x = 0; end_x <= 10; ++end_x) {
+        for (unsigned end_y = 0; end_y <= 10; ++end_y) {
+          gfx::hdr_image img(11, 11, gfx::SILVER);
+          gfx::rasterize_line_segment(img, 5, 5, end_x, end_y, gfx::RED);
+        }
+      }
+    });
+
+  return 0;
+}
@@ -1,11 +1,28 @@
 
 #include <cassert>
+#include <algorithm>
 #include <cstdio> // for remove()
 
 #include "gtest/gtest.h"
 
+#include "gfxband.hpp"
+#include "gfxcanvas.hpp"
+#include "gfxcodec.hpp"
+#include "gfxconcurrent.hpp"
+#include "gfxcow.hpp"
+#include "gfxdisplay.hpp"
+#include "gfxexport.hpp"
+#include "gfxfile.hpp"
+#include "gfxhalf.hpp"
 #include "gfximage.hpp"
+#include "gfxlayer.hpp"
+#include "gfxload.hpp"
 #include "gfxrasterize.hpp"
+#include "gfxraw.hpp"
+#include "gfxspatial.hpp"
+#include "gfxstepcache.hpp"
+#include "gfxtiled.hpp"
+#include "gfxtransform.hpp"
 
 using namespace gfx;
 
@@ -739,6 +756,2259 @@ TEST_F(RasterizeLineGeneralSlope, EntireSouthEastQuadrant) {
   ASSERT_TRUE(png_equal("expected-9-10.png", "got-9-10.png"));
   ASSERT_TRUE(png_equal("expected-10-10.png", "got-10-10.png"));
 }
+// Count the pixels of image that are == to color.
+size_t count_pixels(const hdr_image& image, const hdr_rgb& color) {
+  size_t count = 0;
+  for (size_t y = 0; y < image.height(); ++y) {
+    for (size_t x = 0; x < image.width(); ++x) {
+      count += (image.pixel(x, y) == color);
+    }
+  }
+  return count;
+}
+
+TEST(GfxPolygonTest, FillSpan) {
+  hdr_image img(5, 2, SILVER);
+  img.fill_span(1, 4, 1, RED);
+  EXPECT_EQ(3, count_pixels(img, RED));
+  EXPECT_EQ(SILVER, img.pixel(0, 1));
+  EXPECT_EQ(RED, img.pixel(1, 1));
+  EXPECT_EQ(RED, img.pixel(3, 1));
+  EXPECT_EQ(SILVER, img.pixel(4, 1));
+  img.fill_span(2, 2, 0, RED); // empty span
+  EXPECT_EQ(3, count_pixels(img, RED));
+}
+
+TEST(GfxPolygonTest, FillRectangle) {
+  hdr_image img(10, 10, SILVER);
+  fill_polygon(img, {{2, 3}, {6, 3}, {6, 8}, {2, 8}}, RED);
+  EXPECT_EQ(4 * 5, count_pixels(img, RED));
+  for (unsigned y = 3; y < 8; ++y) {
+    for (unsigned x = 2; x < 6; ++x) {
+      EXPECT_EQ(RED, img.pixel(x, y));
+    }
+  }
+
+  // adjacent rectangle sharing an edge must not overlap
+  fill_polygon(img, {{6, 3}, {9, 3}, {9, 8}, {6, 8}}, BLUE);
+  EXPECT_EQ(4 * 5, count_pixels(img, RED));
+  EXPECT_EQ(3 * 5, count_pixels(img, BLUE));
+}
+
+TEST(GfxPolygonTest, FillConcave) {
+  // a "U" shape, open at the top
+  hdr_image img(10, 10, SILVER);
+  fill_polygon(img,
+               {{0, 0}, {3, 0}, {3, 6}, {7, 6}, {7, 0}, {10, 0},
+                {10, 10}, {0, 10}},
+               RED);
+  EXPECT_EQ(SILVER, img.pixel(5, 2));
+  EXPECT_EQ(RED, img.pixel(1, 2));
+  EXPECT_EQ(RED, img.pixel(8, 2));
+  EXPECT_EQ(RED, img.pixel(5, 8));
+  EXPECT_EQ(100 - 4 * 6, count_pixels(img, RED));
+}
+
+TEST(GfxPolygonTest, FillRules) {
+  // two overlapping squares with the same orientation
+  std::vector<std::vector<raster_point>> contours{
+    {{0, 0}, {6, 0}, {6, 6}, {0, 6}},
+    {{3, 3}, {9, 3}, {9, 9}, {3, 9}}
+  };
+
+  hdr_image even_odd(10, 10, SILVER);
+  fill_polygon(even_odd, contours, RED, fill_rule::even_odd);
+  EXPECT_EQ(SILVER, even_odd.pixel(4, 4));
+  EXPECT_EQ(RED, even_odd.pixel(1, 1));
+  EXPECT_EQ(RED, even_odd.pixel(7, 7));
+  EXPECT_EQ(36 + 36 - 2 * 9, count_pixels(even_odd, RED));
+
+  hdr_image non_zero(10, 10, SILVER);
+  fill_polygon(non_zero, contours, RED, fill_rule::non_zero);
+  EXPECT_EQ(RED, non_zero.pixel(4, 4));
+  EXPECT_EQ(36 + 36 - 9, count_pixels(non_zero, RED));
+
+  // reversing the second contour punches a hole under non_zero
+  std::reverse(contours[1].begin(), contours[1].end());
+  non_zero.fill(SILVER);
+  fill_polygon(non_zero, contours, RED, fill_rule::non_zero);
+  EXPECT_EQ(SILVER, non_zero.pixel(4, 4));
+}
+
+TEST(GfxPolygonTest, FillClipped) {
+  hdr_image img(10, 10, SILVER);
+  fill_polygon(img, {{-20, -20}, {30, -20}, {30, 30}, {-20, 30}}, RED);
+  EXPECT_TRUE(img.is_every_pixel(RED));
+
+  img.fill(SILVER);
+  fill_polygon(img, {{-5, 5}, {5, 5}, {5, 50}, {-5, 50}}, RED);
+  EXPECT_EQ(5 * 5, count_pixels(img, RED));
+
+  img.fill(SILVER);
+  fill_polygon(img, {{20, 20}, {30, 20}, {30, 30}}, RED);
+  EXPECT_TRUE(img.is_every_pixel(SILVER));
+}
+
+TEST(GfxPolygonTest, FillTriangle) {
+  // right triangle; pixel (x, y) is inside iff x < y
+  hdr_image img(8, 8, SILVER);
+  fill_polygon(img, {{0, 0}, {8, 8}, {0, 8}}, RED);
+  for (unsigned y = 0; y < 8; ++y) {
+    for (unsigned x = 0; x < 8; ++x) {
+      EXPECT_EQ((x < y) ? RED : SILVER, img.pixel(x, y));
+    }
+  }
+}
+
+// Return true iff image is unchanged by mirroring it about its center row,
+// center column, and (when square) its diagonal.
+bool is_symmetric(const hdr_image& image) {
+  for (size_t y = 0; y < image.height(); ++y) {
+    for (size_t x = 0; x < image.width(); ++x) {
+      auto& color = image.pixel(x, y);
+      if (!(color == image.pixel(image.width() - 1 - x, y)) ||
+          !(color == image.pixel(x, image.height() - 1 - y))) {
+        return false;
+      }
+      if ((image.width() == image.height()) && !(color == image.pixel(y, x))) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Return true iff every pixel == to color in inner is also == to color in
+// outer, and the color pixels of each row of outer are contiguous.
+bool is_filled_outline(const hdr_image& inner, const hdr_image& outer,
+                       const hdr_rgb& color) {
+  for (size_t y = 0; y < outer.height(); ++y) {
+    size_t runs = 0;
+    for (size_t x = 0; x < outer.width(); ++x) {
+      if ((inner.pixel(x, y) == color) && !(outer.pixel(x, y) == color)) {
+        return false;
+      }
+      if ((outer.pixel(x, y) == color) &&
+          ((x == 0) || !(outer.pixel(x - 1, y) == color))) {
+        ++runs;
+      }
+    }
+    if (runs > 1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+TEST(GfxCircleTest, Circle) {
+  hdr_image img(11, 11, SILVER);
+  rasterize_circle(img, 5, 5, 0, RED);
+  EXPECT_EQ(1, count_pixels(img, RED));
+  EXPECT_EQ(RED, img.pixel(5, 5));
+
+  for (unsigned radius = 1; radius <= 5; ++radius) {
+    img.fill(SILVER);
+    rasterize_circle(img, 5, 5, radius, RED);
+    EXPECT_TRUE(is_symmetric(img));
+    EXPECT_EQ(RED, img.pixel(5, 5 - radius));
+    EXPECT_EQ(RED, img.pixel(5 + radius, 5));
+    EXPECT_EQ(SILVER, img.pixel(5, 5));
+  }
+
+  // radius 3 has the classic midpoint shape
+  img.fill(SILVER);
+  rasterize_circle(img, 5, 5, 3, RED);
+  EXPECT_EQ(16, count_pixels(img, RED));
+  EXPECT_EQ(RED, img.pixel(6, 2));
+  EXPECT_EQ(RED, img.pixel(7, 3));
+  EXPECT_EQ(SILVER, img.pixel(7, 2));
+}
+
+TEST(GfxCircleTest, FillCircle) {
+  for (unsigned radius = 0; radius <= 5; ++radius) {
+    hdr_image outline(11, 11, SILVER), filled(outline, SILVER);
+    rasterize_circle(outline, 5, 5, radius, RED);
+    fill_circle(filled, 5, 5, radius, RED);
+    EXPECT_TRUE(is_symmetric(filled));
+    EXPECT_TRUE(is_filled_outline(outline, filled, RED));
+    EXPECT_EQ(RED, filled.pixel(5, 5));
+    if (radius < 5) {
+      EXPECT_EQ(SILVER, filled.pixel(5, 4 - radius));
+    }
+  }
+}
+
+TEST(GfxCircleTest, Ellipse) {
+  hdr_image img(11, 11, SILVER);
+  rasterize_ellipse(img, 5, 5, 4, 2, RED);
+  EXPECT_EQ(RED, img.pixel(1, 5));
+  EXPECT_EQ(RED, img.pixel(9, 5));
+  EXPECT_EQ(RED, img.pixel(5, 3));
+  EXPECT_EQ(RED, img.pixel(5, 7));
+  EXPECT_EQ(SILVER, img.pixel(0, 5));
+  EXPECT_EQ(SILVER, img.pixel(5, 2));
+  EXPECT_EQ(SILVER, img.pixel(5, 5));
+
+  // degenerate ellipses are lines
+  img.fill(SILVER);
+  rasterize_ellipse(img, 5, 5, 4, 0, RED);
+  EXPECT_EQ(9, count_pixels(img, RED));
+  img.fill(SILVER);
+  rasterize_ellipse(img, 5, 5, 0, 3, RED);
+  EXPECT_EQ(7, count_pixels(img, RED));
+  EXPECT_EQ(RED, img.pixel(5, 2));
+}
+
+TEST(GfxCircleTest, FillEllipse) {
+  for (unsigned rx = 0; rx <= 5; ++rx) {
+    for (unsigned ry = 0; ry <= 5; ++ry) {
+      hdr_image outline(11, 11, SILVER), filled(outline, SILVER);
+      rasterize_ellipse(outline, 5, 5, rx, ry, RED);
+      fill_ellipse(filled, 5, 5, rx, ry, RED);
+      EXPECT_TRUE(is_filled_outline(outline, filled, RED));
+      EXPECT_EQ(RED, filled.pixel(5, 5));
+      EXPECT_EQ(RED, filled.pixel(5 - rx, 5));
+      EXPECT_EQ(RED, filled.pixel(5, 5 + ry));
+      EXPECT_EQ(filled.pixel(5 - rx + 1, 4), filled.pixel(5 + rx - 1, 6));
+    }
+  }
+}
+
+TEST(GfxCircleTest, Clipped) {
+  hdr_image img(11, 11, SILVER);
+  rasterize_circle(img, 0, 0, 4, RED);
+  EXPECT_EQ(RED, img.pixel(4, 0));
+  EXPECT_EQ(RED, img.pixel(0, 4));
+  fill_circle(img, 100, 100, 4, BLUE);
+  fill_ellipse(img, -3, 12, 6, 4, BLUE);
+  rasterize_ellipse(img, 12, -3, 6, 4, BLUE);
+  EXPECT_EQ(SILVER, img.pixel(5, 5));
+  EXPECT_EQ(BLUE, img.pixel(0, 10));
+  fill_circle(img, 5, 5, 20, GREEN);
+  EXPECT_TRUE(img.is_every_pixel(GREEN));
+}
+
+TEST(GfxLineTest, AllOctants) {
+  // every case of write_line_segment_cases
+  for (unsigned end_x = 0; end_x <= 10; ++end_x) {
+    for (unsigned end_y = 0; end_y <= 10; ++end_y) {
+      hdr_image forward(11, 11, SILVER), backward(forward, SILVER);
+      rasterize_line_segment(forward, 5, 5, end_x, end_y, RED);
+      rasterize_line_segment(backward, end_x, end_y, 5, 5, RED);
+
+      // endpoint order does not matter
+      EXPECT_EQ(forward, backward);
+
+      // both endpoints are drawn, with one pixel per step of the major axis
+      EXPECT_EQ(RED, forward.pixel(5, 5));
+      EXPECT_EQ(RED, forward.pixel(end_x, end_y));
+      unsigned dx = (end_x > 5) ? (end_x - 5) : (5 - end_x),
+               dy = (end_y > 5) ? (end_y - 5) : (5 - end_y);
+      EXPECT_EQ(std::max(dx, dy) + 1, count_pixels(forward, RED));
+    }
+  }
+
+  // a shallow slope, and an exact midpoint tie
+  hdr_image img(11, 11, SILVER);
+  rasterize_line_segment(img, 0, 0, 10, 3, RED);
+  EXPECT_EQ(RED, img.pixel(0, 0));
+  EXPECT_EQ(RED, img.pixel(1, 0));
+  EXPECT_EQ(RED, img.pixel(2, 1));
+  EXPECT_EQ(RED, img.pixel(5, 1));
+  EXPECT_EQ(RED, img.pixel(6, 2));
+  EXPECT_EQ(RED, img.pixel(9, 3));
+  img.fill(SILVER);
+  rasterize_line_segment(img, 2, 3, 0, 2, RED);
+  EXPECT_EQ(RED, img.pixel(1, 2));
+}
+
+TEST(GfxLineTest, Batch) {
+  std::vector<line_segment> segments{{0, 0, 9, 9}, {9, 0, 0, 9}, {4, 0, 4, 9}};
+  hdr_image batched(10, 10, SILVER), serial(batched, SILVER);
+  rasterize_line_segments(batched, segments, RED);
+  for (auto& s : segments) {
+    rasterize_line_segment(serial, s.x0, s.y0, s.x1, s.y1, RED);
+  }
+  EXPECT_EQ(serial, batched);
+}
+
+TEST(GfxLineTest, ClippedStepping) {
+  // every segment between points of a 9x9 grid, against rectangles that
+  // cut it on each side, compared with stepping everything and testing
+  // each pixel
+  std::vector<raster_rect> clips{{0, 0, 9, 9}, {2, 3, 7, 5}, {4, 0, 5, 9},
+                                 {0, 4, 9, 5}, {-3, -3, 2, 12}, {6, 6, 6, 8},
+                                 {8, 8, 20, 20}, UNCLIPPED};
+  for (auto& clip : clips) {
+    for (int p = 0; p < 81; ++p) {
+      for (int q = 0; q < 81; ++q) {
+        int x0 = p % 9, y0 = p / 9, x1 = q % 9, y1 = q / 9;
+        std::vector<std::pair<int, int>> expected, clipped;
+        detail::step_line(x0, y0, x1, y1, [&](int x, int y) {
+            if (clip.contains(x, y)) {
+              expected.emplace_back(x, y);
+            }
+          });
+        detail::step_line_clipped(x0, y0, x1, y1, clip, [&](int x, int y) {
+            clipped.emplace_back(x, y);
+          });
+        EXPECT_EQ(expected, clipped);
+      }
+    }
+  }
+
+  // a long segment mostly outside a small rectangle
+  std::vector<std::pair<int, int>> expected, clipped;
+  raster_rect clip{500, 400, 510, 600};
+  detail::step_line(-1000, 37, 3001, 1212, [&](int x, int y) {
+      if (clip.contains(x, y)) {
+        expected.emplace_back(x, y);
+      }
+    });
+  detail::step_line_clipped(-1000, 37, 3001, 1212, clip, [&](int x, int y) {
+      clipped.emplace_back(x, y);
+    });
+  EXPECT_EQ(10u, expected.size());
+  EXPECT_EQ(expected, clipped);
+}
+
+TEST(GfxLineTest, Polyline) {
+  hdr_image img(10, 10, SILVER), expected(img, SILVER);
+  std::vector<raster_point> points{{1, 1}, {8, 1}, {8, 8}, {1, 8}, {1, 1}};
+  rasterize_polyline(img, points, RED);
+  for (size_t i = 1; i < points.size(); ++i) {
+    rasterize_line_segment(expected,
+                           points[i - 1].x, points[i - 1].y,
+                           points[i].x, points[i].y,
+                           RED);
+  }
+  EXPECT_EQ(expected, img);
+  EXPECT_EQ(28, count_pixels(img, RED));
+
+  // clipped
+  img.fill(SILVER);
+  rasterize_polyline(img, {{-5, 5}, {14, 5}, {14, -20}}, RED);
+  EXPECT_EQ(10, count_pixels(img, RED));
+}
+
+TEST(GfxBezierTest, Flatten) {
+  // a straight curve needs only one segment
+  std::vector<curve_point> points;
+  flatten_quadratic_bezier({0, 0}, {5, 5}, {10, 10}, 0.25, points);
+  ASSERT_EQ(1, points.size());
+  EXPECT_EQ(10.0, points[0].x);
+  EXPECT_EQ(10.0, points[0].y);
+
+  // a tighter tolerance or a longer curve needs more segments
+  auto count = [](double scale, double tolerance) {
+    std::vector<curve_point> points;
+    flatten_cubic_bezier({0, 0}, {0, scale}, {scale, scale}, {scale, 0},
+                         tolerance, points);
+    return points.size();
+  };
+  EXPECT_LT(count(10, 1.0), count(10, 0.1));
+  EXPECT_LT(count(10, 0.25), count(1000, 0.25));
+  EXPECT_LE(count(1000, 0.25), 64);
+
+  // every flattened point is on the curve, and every chord is within
+  // tolerance of the curve
+  points.clear();
+  curve_point p0{0, 0}, p1{40, 90}, p2{80, -30}, p3{100, 50};
+  flatten_cubic_bezier(p0, p1, p2, p3, 0.25, points);
+  auto at = [&](double t) {
+    double s = 1.0 - t;
+    return curve_point{s*s*s*p0.x + 3*s*s*t*p1.x + 3*s*t*t*p2.x + t*t*t*p3.x,
+                       s*s*s*p0.y + 3*s*s*t*p1.y + 3*s*t*t*p2.y + t*t*t*p3.y};
+  };
+  EXPECT_EQ(100.0, points.back().x);
+  EXPECT_EQ(50.0, points.back().y);
+  for (int i = 0; i <= 1000; ++i) {
+    curve_point c = at(i / 1000.0);
+    double nearest = DOUBLE_INFINITY;
+    curve_point previous = p0;
+    for (auto& p : points) {
+      double dx = p.x - previous.x, dy = p.y - previous.y;
+      double t = std::clamp(((c.x - previous.x) * dx + (c.y - previous.y) * dy)
+                            / (dx * dx + dy * dy), 0.0, 1.0);
+      nearest = std::min(nearest, std::hypot(c.x - previous.x - t * dx,
+                                             c.y - previous.y - t * dy));
+      previous = p;
+    }
+    EXPECT_LE(nearest, 0.25 + 1e-9);
+  }
+}
+
+TEST(GfxBezierTest, Rasterize) {
+  // a straight curve draws the same pixels as a line segment
+  hdr_image curve(11, 11, SILVER), line(curve, SILVER);
+  rasterize_quadratic_bezier(curve, {1, 2}, {5, 5}, {9, 8}, RED);
+  rasterize_line_segment(line, 1, 2, 9, 8, RED);
+  EXPECT_EQ(line, curve);
+
+  // curved, with the endpoints drawn, and clipped
+  curve.fill(SILVER);
+  rasterize_cubic_bezier(curve, {0, 10}, {0, 0}, {10, 0}, {10, 10}, RED);
+  EXPECT_EQ(RED, curve.pixel(0, 10));
+  EXPECT_EQ(RED, curve.pixel(10, 10));
+  EXPECT_EQ(SILVER, curve.pixel(5, 10));
+  EXPECT_EQ(SILVER, curve.pixel(5, 1));
+  EXPECT_TRUE((curve.pixel(5, 2) == RED) || (curve.pixel(5, 3) == RED));
+  for (unsigned y = 3; y <= 10; ++y) {
+    unsigned on_row = 0;
+    for (unsigned x = 0; x <= 10; ++x) {
+      on_row += (curve.pixel(x, y) == RED);
+    }
+    EXPECT_GE(on_row, 1);
+  }
+  rasterize_quadratic_bezier(curve, {-50, 5}, {5, 30}, {60, 5}, BLUE);
+}
+
+// Record a scene exercising every display_list command.
+display_list make_scene(bool covered) {
+  display_list list;
+  list.set_color(SILVER);
+  list.fill_rect({0, 0, 100, 80});
+  list.set_color(RED);
+  for (int i = 0; i < 100; i += 7) {
+    list.line_segment({i, 0}, {99 - i, 79});
+  }
+  list.set_color(BLUE);
+  list.fill_polygon({{10, 10}, {90, 20}, {50, 70}, {30, 5}}, fill_rule::non_zero);
+  list.circle(20, 60, 15);
+  list.set_color(GREEN);
+  list.fill_circle(80, 20, 12);
+  list.ellipse(50, 40, 45, 30);
+  list.fill_ellipse(-5, 85, 30, 20);
+  list.set_color(YELLOW);
+  list.fill_rect({60, 50, 130, 90});
+  if (covered) {
+    list.line_segment({-10, 40}, {110, 41});
+  }
+  return list;
+}
+
+TEST(GfxDisplayListTest, Record) {
+  display_list list;
+  EXPECT_TRUE(list.is_empty());
+  auto revision = list.revision();
+  list.set_color(RED);
+  list.line_segment({0, 0}, {5, 5});
+  list.line_segment({1, 0}, {5, 6});
+  list.set_color(BLUE);
+  list.fill_polygon({{0, 0}, {4, 0}, {4, 4}});
+  EXPECT_EQ(3, list.size());
+  EXPECT_NE(revision, list.revision());
+
+  // consecutive commands of one color share a color table entry
+  EXPECT_EQ(2, list.colors().size());
+  EXPECT_EQ(0, list.header(1).color);
+  EXPECT_EQ(draw_opcode::fill_polygon, list.header(2).opcode);
+  std::vector<raster_point> vertices;
+  EXPECT_EQ(fill_rule::even_odd, list.polygon_vertices(2, vertices));
+  ASSERT_EQ(3, vertices.size());
+  EXPECT_EQ(4, vertices[2].y);
+  auto segment = list.payload<display_list::segment_payload>(1);
+  EXPECT_EQ(6, segment.p1.y);
+
+  list.clear();
+  EXPECT_TRUE(list.is_empty());
+}
+
+TEST(GfxDisplayListTest, Replay) {
+  display_list list;
+  list.set_color(RED);
+  list.line_segment({1, 2}, {9, 7});
+  list.fill_circle(5, 5, 3);
+  list.set_color(BLUE);
+  list.fill_polygon({{0, 0}, {4, 0}, {0, 4}});
+
+  hdr_image replayed(11, 11, SILVER), direct(replayed, SILVER);
+  replay(list, replayed);
+  rasterize_line_segment(direct, 1, 2, 9, 7, RED);
+  fill_circle(direct, 5, 5, 3, RED);
+  fill_polygon(direct, {{0, 0}, {4, 0}, {0, 4}}, BLUE);
+  EXPECT_EQ(direct, replayed);
+}
+
+TEST(GfxDisplayListTest, ReplayTiled) {
+  for (bool covered : {false, true}) {
+    display_list list = make_scene(covered);
+    hdr_image serial(100, 80, BLACK);
+    replay(list, serial);
+    for (unsigned tile_size : {1u, 7u, 16u, 64u, 200u}) {
+      tile_bins bins(list, 100, 80, tile_size);
+      for (unsigned threads : {1u, 3u}) {
+        hdr_image tiled(100, 80, BLACK);
+        replay_tiled(list, bins, tiled, threads);
+        EXPECT_EQ(serial, tiled);
+        // replaying again reuses the same bins
+        replay_tiled(list, bins, tiled, threads);
+        EXPECT_EQ(serial, tiled);
+      }
+    }
+  }
+}
+
+TEST(GfxDisplayListTest, Culling) {
+  display_list list = make_scene(false);
+  tile_bins bins(list, 100, 80, 10);
+  EXPECT_GT(bins.culled_count(), 0);
+
+  // the yellow rectangle hides everything beneath it
+  raster_rect hidden{60, 50, 100, 80};
+  for (size_t tile = 0; tile < bins.tile_count(); ++tile) {
+    if (hidden.contains(bins.tile_rect(tile))) {
+      ASSERT_EQ(1, bins.commands(tile).size());
+      EXPECT_EQ(draw_opcode::fill_rect,
+                list.header(bins.commands(tile)[0]).opcode);
+    }
+  }
+}
+
+TEST(GfxDirtyTest, Tracking) {
+  hdr_image img(20, 10, SILVER);
+  EXPECT_FALSE(img.is_dirty_tracking());
+  img.pixel(1, 1, RED);
+  EXPECT_FALSE(img.is_dirty());
+
+  img.set_dirty_tracking(true);
+  EXPECT_TRUE(img.is_dirty_tracking());
+  EXPECT_FALSE(img.is_dirty());
+  EXPECT_TRUE(img.dirty_rects().empty());
+  EXPECT_TRUE(img.dirty_bounds().is_empty());
+
+  img.pixel(3, 2, RED);
+  img.fill_span(5, 9, 4, RED);
+  img.fill_span(5, 9, 5, RED);
+  EXPECT_TRUE(img.is_dirty());
+  auto rects = img.dirty_rects();
+  ASSERT_EQ(2, rects.size());
+  EXPECT_EQ(3, rects[0].x_min);
+  EXPECT_EQ(2, rects[0].y_min);
+  EXPECT_EQ(4, rects[0].x_max);
+  EXPECT_EQ(3, rects[0].y_max);
+  EXPECT_EQ(5, rects[1].x_min);
+  EXPECT_EQ(4, rects[1].y_min);
+  EXPECT_EQ(9, rects[1].x_max);
+  EXPECT_EQ(6, rects[1].y_max);
+  auto bounds = img.dirty_bounds();
+  EXPECT_EQ(3, bounds.x_min);
+  EXPECT_EQ(2, bounds.y_min);
+  EXPECT_EQ(9, bounds.x_max);
+  EXPECT_EQ(6, bounds.y_max);
+
+  img.reset_dirty();
+  EXPECT_FALSE(img.is_dirty());
+  img.fill(BLUE);
+  ASSERT_EQ(1, img.dirty_rects().size());
+  EXPECT_EQ(20, img.dirty_rects()[0].x_max);
+  EXPECT_EQ(10, img.dirty_rects()[0].y_max);
+
+  // assign_row writes, and dirties, one whole row
+  img.reset_dirty();
+  std::vector<hdr_rgb> row(20, RED);
+  img.assign_row(7, row.data());
+  EXPECT_EQ(RED, img.pixel(0, 7));
+  EXPECT_EQ(RED, img.pixel(19, 7));
+  EXPECT_EQ(BLUE, img.pixel(5, 6));
+  ASSERT_EQ(1, img.dirty_rects().size());
+  EXPECT_EQ(0, img.dirty_rects()[0].x_min);
+  EXPECT_EQ(7, img.dirty_rects()[0].y_min);
+  EXPECT_EQ(20, img.dirty_rects()[0].x_max);
+  EXPECT_EQ(8, img.dirty_rects()[0].y_max);
+
+  img.set_dirty_tracking(false);
+  img.reset_dirty();
+  img.pixel(0, 0, RED);
+  EXPECT_FALSE(img.is_dirty());
+}
+
+TEST(GfxDirtyTest, Rasterizer) {
+  hdr_image img(20, 20, SILVER);
+  img.set_dirty_tracking(true);
+  rasterize_line_segment(img, 2, 3, 12, 8, RED);
+  fill_circle(img, 15, 15, 2, RED);
+  auto bounds = img.dirty_bounds();
+  EXPECT_EQ(2, bounds.x_min);
+  EXPECT_EQ(3, bounds.y_min);
+  EXPECT_EQ(18, bounds.x_max);
+  EXPECT_EQ(18, bounds.y_max);
+
+  // every written pixel is inside a dirty rectangle, and nothing else is
+  auto rects = img.dirty_rects();
+  for (unsigned y = 0; y < 20; ++y) {
+    for (unsigned x = 0; x < 20; ++x) {
+      bool dirty = std::any_of(rects.begin(), rects.end(), [&](auto& r) {
+          return r.contains(x, y);
+        });
+      EXPECT_EQ(!(img.pixel(x, y) == SILVER), dirty);
+    }
+  }
+
+  // tiled replay reports the bounds of what it drew
+  display_list list;
+  list.set_color(BLUE);
+  list.fill_rect({4, 4, 9, 7});
+  img.reset_dirty();
+  replay_tiled(list, tile_bins(list, 20, 20, 8), img, 2);
+  EXPECT_TRUE(img.is_dirty_tracking());
+  bounds = img.dirty_bounds();
+  EXPECT_EQ(4, bounds.x_min);
+  EXPECT_EQ(4, bounds.y_min);
+  EXPECT_EQ(9, bounds.x_max);
+  EXPECT_EQ(7, bounds.y_max);
+}
+
+TEST(GfxRawTest, RoundTrip) {
+  gfx::hdr_image image(7, 5, gfx::BLACK);
+  for (size_t y = 0; y < image.height(); ++y) {
+    for (size_t x = 0; x < image.width(); ++x) {
+      image.pixel(x, y, gfx::hdr_rgb(x / 7.0f, y / 5.0f, 1.0f / 3.0f));
+    }
+  }
+
+  const char* path = "raw-roundtrip.raw";
+  ASSERT_TRUE(gfx::write_raw(image, path));
+  auto float_result = gfx::read_raw(path);
+  ASSERT_TRUE(float_result);
+  EXPECT_EQ(image, *float_result);
+
+  ASSERT_TRUE(gfx::write_raw(image, path, gfx::raw_pixel_format::rgb_uint8));
+  auto byte_result = gfx::read_raw(path);
+  ASSERT_TRUE(byte_result);
+  ASSERT_EQ(image.width(), byte_result->width());
+  ASSERT_EQ(image.height(), byte_result->height());
+  for (size_t y = 0; y < image.height(); ++y) {
+    for (size_t x = 0; x < image.width(); ++x) {
+      const auto& expected = image.pixel(x, y);
+      EXPECT_EQ(gfx::hdr_rgb::from_bytes(gfx::hdr_to_byte(expected.r()),
+                                         gfx::hdr_to_byte(expected.g()),
+                                         gfx::hdr_to_byte(expected.b())),
+                byte_result->pixel(x, y));
+    }
+  }
+
+  std::remove(path);
+}
+
+TEST(GfxRawTest, Map) {
+  gfx::hdr_image image(6, 4, gfx::BLUE);
+  image.pixel(2, 1, gfx::RED);
+
+  const char* path = "raw-map.raw";
+  ASSERT_TRUE(gfx::write_raw(image, path));
+  {
+    auto mapped = gfx::map_raw(path);
+    ASSERT_TRUE(mapped);
+    EXPECT_FALSE(mapped->is_writable());
+    EXPECT_EQ(gfx::raw_pixel_format::rgb_float32, mapped->format());
+    EXPECT_EQ(6, mapped->width());
+    EXPECT_EQ(4, mapped->height());
+    EXPECT_EQ(gfx::RED, mapped->pixel(2, 1));
+    EXPECT_EQ(gfx::BLUE, mapped->pixel(3, 1));
+  }
+
+  // changes through a writable mapping reach the file
+  {
+    auto mapped = gfx::map_raw(path, true);
+    ASSERT_TRUE(mapped);
+    mapped->pixel(0, 0, gfx::WHITE);
+    mapped->fill_span(1, 5, 3, gfx::GREEN);
+    EXPECT_TRUE(mapped->flush());
+  }
+  image.pixel(0, 0, gfx::WHITE);
+  image.fill_span(1, 5, 3, gfx::GREEN);
+  auto result = gfx::read_raw(path);
+  ASSERT_TRUE(result);
+  EXPECT_EQ(image, *result);
+
+  // pixels that are not valid intensities are rejected by read_raw, and
+  // reported by the mapped view
+  for (float bad : {std::nanf(""), 2.0f, -0.5f}) {
+    std::FILE* file = std::fopen(path, "r+b");
+    ASSERT_NE(nullptr, file);
+    ASSERT_EQ(0, std::fseek(file, sizeof(gfx::raw_header) + (12 * 9) + 4,
+                            SEEK_SET));
+    ASSERT_EQ(1u, std::fwrite(&bad, sizeof(bad), 1, file));
+    std::fclose(file);
+    EXPECT_FALSE(gfx::read_raw(path));
+    auto mapped = gfx::map_raw(path);
+    ASSERT_TRUE(mapped);
+    EXPECT_FALSE(mapped->are_pixels_valid());
+  }
+  {
+    auto mapped = gfx::map_raw(path, true);
+    ASSERT_TRUE(mapped);
+    mapped->pixel(3, 1, gfx::BLUE);
+    EXPECT_TRUE(mapped->are_pixels_valid());
+  }
+  EXPECT_TRUE(gfx::read_raw(path));
+
+  // including the very last intensity in the file
+  {
+    std::FILE* file = std::fopen(path, "r+b");
+    ASSERT_NE(nullptr, file);
+    ASSERT_EQ(0, std::fseek(file, -4, SEEK_END));
+    float bad = 1.5f;
+    ASSERT_EQ(1u, std::fwrite(&bad, sizeof(bad), 1, file));
+    std::fclose(file);
+  }
+  EXPECT_FALSE(gfx::read_raw(path));
+  {
+    auto mapped = gfx::map_raw(path, true);
+    ASSERT_TRUE(mapped);
+    mapped->pixel(5, 3, gfx::BLUE);
+  }
+  result = gfx::read_raw(path);
+  ASSERT_TRUE(result);
+  image.pixel(5, 3, gfx::BLUE);
+  EXPECT_EQ(image, *result);
+
+  // truncated and missing files are rejected
+  {
+    std::FILE* file = std::fopen(path, "r+b");
+    ASSERT_NE(nullptr, file);
+    ASSERT_EQ(0, ftruncate(fileno(file), 100));
+    std::fclose(file);
+  }
+  EXPECT_FALSE(gfx::map_raw(path));
+  std::remove(path);
+  EXPECT_FALSE(gfx::read_raw(path));
+}
+
+TEST(GfxFileTest, WholeFiles) {
+  const char* path = "whole-file.bin";
+  std::string bytes("raw\0bytes", 9), read_back;
+  ASSERT_TRUE(gfx::detail::write_file(path, bytes));
+  ASSERT_TRUE(gfx::detail::read_file(path, read_back));
+  EXPECT_EQ(bytes, read_back);
+
+  // writing replaces the whole file
+  ASSERT_TRUE(gfx::detail::write_file(path, "ab"));
+  ASSERT_TRUE(gfx::detail::read_file(path, read_back));
+  EXPECT_EQ("ab", read_back);
+  ASSERT_TRUE(gfx::detail::write_file(path, ""));
+  ASSERT_TRUE(gfx::detail::read_file(path, read_back));
+  EXPECT_TRUE(read_back.empty());
+  std::remove(path);
+
+  EXPECT_FALSE(gfx::detail::read_file(path, read_back));
+  EXPECT_FALSE(gfx::detail::write_file("no-such-dir/whole-file.bin", bytes));
+}
+
+TEST(GfxTiledTest, Paging) {
+  const char* path = "tiled-paging.tiles";
+  {
+    // 3 x 2 tiles of 4 x 4 pixels, and room for only 2 of them
+    auto tiled = gfx::make_tiled_image(path, 10, 7, gfx::GRAY, 4,
+                                       2 * 4 * 4 * sizeof(gfx::hdr_rgb));
+    ASSERT_TRUE(tiled);
+    EXPECT_EQ(10, tiled->width());
+    EXPECT_EQ(7, tiled->height());
+    EXPECT_EQ(3, tiled->tile_columns());
+    EXPECT_EQ(2, tiled->tile_rows());
+    EXPECT_EQ(2, tiled->max_resident_tiles());
+
+    gfx::hdr_image expected(10, 7, gfx::GRAY);
+    for (size_t y = 0; y < 7; ++y) {
+      tiled->fill_span(y, 10, y, gfx::RED);
+      expected.fill_span(y, 10, y, gfx::RED);
+    }
+    tiled->pixel(9, 6, gfx::BLUE);
+    expected.pixel(9, 6, gfx::BLUE);
+    EXPECT_LE(tiled->resident_tiles(), 2);
+    EXPECT_GT(tiled->stats().evictions, 0);
+    EXPECT_GT(tiled->stats().write_backs, 0);
+
+    // read back in an order that pages tiles in and out of the file
+    for (size_t x = 0; x < 10; ++x) {
+      for (size_t y = 0; y < 7; ++y) {
+        EXPECT_EQ(expected.pixel(x, y), tiled->pixel(x, y));
+      }
+    }
+    EXPECT_GT(tiled->stats().loads, 0);
+    EXPECT_TRUE(tiled->flush());
+    EXPECT_FALSE(tiled->has_io_error());
+
+    // moving takes the resident tiles, and leaves nothing cached behind
+    tiled->pixel(0, 0, gfx::BLUE);
+    expected.pixel(0, 0, gfx::BLUE);
+    gfx::tiled_image moved(std::move(*tiled));
+    EXPECT_EQ(0, tiled->resident_tiles());
+    EXPECT_LE(moved.resident_tiles(), 2);
+    for (size_t x = 0; x < 10; ++x) {
+      for (size_t y = 0; y < 7; ++y) {
+        EXPECT_EQ(expected.pixel(x, y), moved.pixel(x, y));
+      }
+    }
+    EXPECT_TRUE(moved.flush());
+  }
+  std::remove(path);
+}
+
+TEST(GfxTiledTest, WriteBackFailure) {
+  // every write to /dev/full fails, so modified tiles can never be evicted
+  auto tiled = gfx::make_tiled_image("/dev/full", 8, 4, gfx::GRAY, 4,
+                                     4 * 4 * sizeof(gfx::hdr_rgb));
+  if (!tiled) {
+    GTEST_SKIP() << "/dev/full is not available";
+  }
+  tiled->pixel(0, 0, gfx::RED);
+  tiled->pixel(4, 0, gfx::BLUE);
+  EXPECT_TRUE(tiled->has_io_error());
+  EXPECT_EQ(2, tiled->resident_tiles());
+  EXPECT_EQ(0, tiled->stats().evictions);
+  EXPECT_EQ(gfx::RED, tiled->pixel(0, 0));
+  EXPECT_EQ(gfx::BLUE, tiled->pixel(4, 0));
+
+  // both tiles stay modified, so every flush retries them
+  size_t write_backs = tiled->stats().write_backs;
+  EXPECT_FALSE(tiled->flush());
+  EXPECT_EQ(write_backs + 2, tiled->stats().write_backs);
+  EXPECT_FALSE(tiled->flush());
+  EXPECT_EQ(write_backs + 4, tiled->stats().write_backs);
+}
+
+TEST(GfxTiledTest, Rasterize) {
+  const char* path = "tiled-rasterize.tiles";
+  {
+    auto tiled = gfx::make_tiled_image(path, 40, 30, gfx::BLACK, 8,
+                                       3 * 8 * 8 * sizeof(gfx::hdr_rgb));
+    ASSERT_TRUE(tiled);
+    gfx::hdr_image expected(40, 30, gfx::BLACK);
+
+    gfx::rasterize_line_segment(*tiled, 0, 0, 39, 29, gfx::WHITE);
+    gfx::rasterize_line_segment(expected, 0, 0, 39, 29, gfx::WHITE);
+
+    std::vector<gfx::line_segment> segments;
+    for (unsigned i = 0; i < 40; ++i) {
+      segments.push_back({(i * 7) % 40, (i * 11) % 30,
+                          (i * 13) % 40, (i * 3) % 30});
+    }
+    // drawing in tile order pages in fewer tiles than drawing in the given
+    // order
+    tiled->reset_stats();
+    gfx::rasterize_line_segments<gfx::tiled_image>(*tiled, segments,
+                                                   gfx::GREEN);
+    size_t unsorted_misses = tiled->stats().misses;
+    tiled->reset_stats();
+    gfx::rasterize_line_segments(*tiled, segments, gfx::RED);
+    EXPECT_LT(tiled->stats().misses, unsorted_misses);
+    gfx::rasterize_line_segments(expected, segments, gfx::RED);
+
+    for (size_t y = 0; y < 30; ++y) {
+      for (size_t x = 0; x < 40; ++x) {
+        EXPECT_EQ(expected.pixel(x, y), tiled->pixel(x, y));
+      }
+    }
+  }
+  std::remove(path);
+}
+
+TEST(GfxBandTest, Segments) {
+  std::vector<gfx::line_segment> segments;
+  for (unsigned i = 0; i < 30; ++i) {
+    segments.push_back({(i * 7) % 37, (i * 11) % 23,
+                        (i * 13) % 37, (i * 5) % 23});
+  }
+  gfx::hdr_image expected(37, 23, gfx::NAVY);
+  gfx::rasterize_line_segments(expected, segments, gfx::YELLOW);
+
+  for (size_t band_height : {1, 4, 10, 23, 100}) {
+    const char* path = "band-segments.png";
+    ASSERT_TRUE(gfx::write_png_banded_segments(path, 37, 23, segments,
+                                               gfx::YELLOW, gfx::NAVY,
+                                               band_height));
+    auto result = gfx::read_png(path);
+    ASSERT_TRUE(result);
+    EXPECT_EQ(expected, *result);
+    std::remove(path);
+  }
+}
+
+TEST(GfxBandTest, Render) {
+  const char* path = "band-render.png";
+  std::vector<std::pair<size_t, size_t>> bands;
+  auto render = [&](gfx::hdr_image& band, size_t y_offset) {
+    bands.emplace_back(y_offset, band.height());
+    for (size_t y = 0; y < band.height(); ++y) {
+      if ((y_offset + y) % 2 == 0) {
+        band.fill_span(0, band.width(), y, gfx::WHITE);
+      }
+    }
+  };
+  ASSERT_TRUE(gfx::write_png_banded(path, 5, 10, render, gfx::BLACK, 4));
+  std::vector<std::pair<size_t, size_t>> expected_bands{{0, 4}, {4, 4},
+                                                        {8, 2}};
+  EXPECT_EQ(expected_bands, bands);
+
+  auto result = gfx::read_png(path);
+  ASSERT_TRUE(result);
+  for (size_t y = 0; y < 10; ++y) {
+    EXPECT_EQ((y % 2 == 0) ? gfx::WHITE : gfx::BLACK, result->pixel(3, y));
+  }
+
+  // exceptions from the render function are reported as failure
+  EXPECT_FALSE(gfx::write_png_banded(path, 5, 10,
+                                     [](gfx::hdr_image&, size_t) {
+                                       throw std::runtime_error("render");
+                                     }));
+  std::remove(path);
+}
+
+TEST(GfxPoolTest, Reuse) {
+  gfx::buffer_pool pool;
+  void* first = pool.acquire(1000);
+  ASSERT_NE(nullptr, first);
+  EXPECT_EQ(0, reinterpret_cast<uintptr_t>(first) % 64);
+  pool.release(first, 1000);
+  EXPECT_EQ(1, pool.stats().system_allocations);
+  EXPECT_GE(pool.stats().cached_bytes, 1000);
+
+  // a request in the same size class reuses the block
+  void* second = pool.acquire(980);
+  EXPECT_EQ(first, second);
+  EXPECT_EQ(1, pool.stats().system_allocations);
+  EXPECT_EQ(1, pool.stats().reuses);
+  pool.release(second, 980);
+
+  // but not one in a different class
+  void* other = pool.acquire(5000);
+  EXPECT_EQ(2, pool.stats().system_allocations);
+  pool.release(other, 5000);
+
+  pool.trim();
+  EXPECT_EQ(0, pool.stats().cached_bytes);
+  EXPECT_EQ(2, pool.stats().system_frees);
+
+  // nothing is cached beyond the budget
+  pool.set_max_cached_bytes(0);
+  pool.release(pool.acquire(100), 100);
+  EXPECT_EQ(0, pool.stats().cached_bytes);
+  EXPECT_EQ(3, pool.stats().system_frees);
+}
+
+TEST(GfxPoolTest, Images) {
+  auto& pool = gfx::default_buffer_pool();
+  auto make_case = [] {
+    gfx::hdr_image canvas(11, 11, gfx::SILVER);
+    gfx::rasterize_line_segment(canvas, 5, 5, 10, 3, gfx::RED);
+    gfx::hdr_image copy(canvas);
+    copy.resize(20, 20);
+    return copy.is_every_pixel(gfx::SILVER);
+  };
+
+  // after the first case, images recycle each other's storage
+  make_case();
+  pool.reset_stats();
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_FALSE(make_case());
+  }
+  EXPECT_EQ(0, pool.stats().system_allocations);
+  EXPECT_EQ(30, pool.stats().reuses);
+
+  pool.set_thread_caching(true);
+  make_case();
+  pool.reset_stats();
+  make_case();
+  EXPECT_EQ(0, pool.stats().system_allocations);
+  EXPECT_EQ(3, pool.stats().thread_cache_hits);
+  pool.set_thread_caching(false);
+
+  // moving transfers storage without allocating
+  gfx::hdr_image source(4, 4, gfx::RED);
+  pool.reset_stats();
+  gfx::hdr_image moved(std::move(source));
+  EXPECT_TRUE(source.is_empty());
+  EXPECT_TRUE(moved.is_every_pixel(gfx::RED));
+  source = std::move(moved);
+  EXPECT_TRUE(moved.is_empty());
+  EXPECT_TRUE(source.is_every_pixel(gfx::RED));
+  EXPECT_EQ(0, pool.stats().system_allocations + pool.stats().reuses);
+}
+
+TEST(GfxImageLifecycleTest, Resize) {
+  // resizing in place keeps the same pixels as resizing into new storage
+  auto numbered = [](size_t width, size_t height) {
+    gfx::hdr_image image(width, height, gfx::BLACK);
+    for (size_t y = 0; y < height; ++y) {
+      for (size_t x = 0; x < width; ++x) {
+        image.pixel(x, y, gfx::hdr_rgb(x / 16.0f, y / 16.0f, 0.0f));
+      }
+    }
+    return image;
+  };
+  for (auto [width, height] : std::vector<std::pair<size_t, size_t>>{
+           {3, 2}, {8, 8}, {5, 9}, {9, 5}, {1, 1}, {10, 3}}) {
+    gfx::hdr_image image = numbered(7, 6);
+    image.reserve(100);
+    size_t capacity = image.capacity();
+    image.resize(width, height, gfx::RED);
+    EXPECT_EQ(capacity, image.capacity());
+    ASSERT_EQ(width, image.width());
+    ASSERT_EQ(height, image.height());
+    for (size_t y = 0; y < height; ++y) {
+      for (size_t x = 0; x < width; ++x) {
+        auto expected = ((x < 7) && (y < 6))
+                        ? gfx::hdr_rgb(x / 16.0f, y / 16.0f, 0.0f)
+                        : gfx::RED;
+        EXPECT_EQ(expected, image.pixel(x, y));
+      }
+    }
+  }
+}
+
+TEST(GfxImageLifecycleTest, Allocations) {
+  auto& pool = gfx::default_buffer_pool();
+  auto acquires = [&] {
+    return pool.stats().system_allocations + pool.stats().reuses;
+  };
+
+  // returning through an optional moves the frame
+  auto decode = [] {
+    gfx::hdr_image frame(64, 48, gfx::BLUE);
+    return std::optional<gfx::hdr_image>(std::move(frame));
+  };
+  pool.reset_stats();
+  auto decoded = decode();
+  ASSERT_TRUE(decoded);
+  EXPECT_EQ(1, acquires());
+
+  // growing a container of frames moves them
+  std::vector<gfx::hdr_image> frames;
+  for (int i = 0; i < 10; ++i) {
+    frames.emplace_back(16, 16, gfx::RED);
+  }
+  pool.reset_stats();
+  for (int i = 0; i < 100; ++i) {
+    frames.push_back(std::move(frames[i]));
+  }
+  EXPECT_EQ(0, acquires());
+
+  // reshape and copy assignment reuse capacity
+  gfx::hdr_image canvas;
+  canvas.reserve(32 * 32);
+  EXPECT_TRUE(canvas.is_empty());
+  EXPECT_GE(canvas.capacity(), 32 * 32);
+  pool.reset_stats();
+  canvas.reshape(32, 32, gfx::WHITE);
+  canvas.reshape(16, 8, gfx::RED);
+  EXPECT_TRUE(canvas.is_every_pixel(gfx::RED));
+  canvas.reshape(20, 50, gfx::GREEN);
+  EXPECT_EQ(20, canvas.width());
+  EXPECT_EQ(50, canvas.height());
+  EXPECT_TRUE(canvas.is_every_pixel(gfx::GREEN));
+  canvas = frames.back();
+  EXPECT_EQ(frames.back(), canvas);
+  canvas.clear();
+  EXPECT_TRUE(canvas.is_empty());
+  canvas.resize(30, 30, gfx::RED);
+  EXPECT_EQ(0, acquires());
+
+  // shrink_to_fit releases excess capacity
+  canvas.resize(2, 2);
+  canvas.shrink_to_fit();
+  EXPECT_LT(canvas.capacity(), 30 * 30);
+  EXPECT_TRUE(canvas.is_every_pixel(gfx::RED));
+  canvas.clear();
+  canvas.shrink_to_fit();
+  EXPECT_EQ(0, canvas.capacity());
+}
+
+TEST(GfxCowTest, Snapshots) {
+  gfx::cow_image image(10, 35, gfx::WHITE, 8);
+  EXPECT_EQ(5, image.block_count());
+  EXPECT_TRUE(image.to_image().is_every_pixel(gfx::WHITE));
+
+  // snapshots share every block until one of them writes
+  gfx::cow_image snapshot(image);
+  EXPECT_EQ(image, snapshot);
+  EXPECT_EQ(0, image.owned_block_count());
+
+  gfx::hdr_image expected(10, 35, gfx::WHITE);
+  image.pixel(3, 17, gfx::RED);
+  expected.pixel(3, 17, gfx::RED);
+  gfx::rasterize_line_segment(image, 0, 0, 9, 5, gfx::BLUE);
+  gfx::rasterize_line_segment(expected, 0, 0, 9, 5, gfx::BLUE);
+  image.fill_span(2, 7, 34, gfx::GREEN);
+  expected.fill_span(2, 7, 34, gfx::GREEN);
+
+  // only the three written blocks were duplicated
+  EXPECT_EQ(3, image.owned_block_count());
+  EXPECT_EQ(expected, image.to_image());
+  EXPECT_TRUE(snapshot.to_image().is_every_pixel(gfx::WHITE));
+  EXPECT_FALSE(image == snapshot);
+
+  // round trip through an hdr_image
+  gfx::cow_image copied(expected, 4);
+  EXPECT_EQ(9, copied.block_count());
+  EXPECT_EQ(9, copied.owned_block_count());
+  EXPECT_EQ(image, copied);
+  EXPECT_EQ(expected, copied.to_image());
+
+  snapshot = image;
+  snapshot.fill(gfx::BLACK);
+  EXPECT_TRUE(snapshot.to_image().is_every_pixel(gfx::BLACK));
+  EXPECT_EQ(expected, image.to_image());
+
+  gfx::cow_image moved(std::move(image));
+  EXPECT_TRUE(image.is_empty());
+  EXPECT_EQ(expected, moved.to_image());
+}
+
+TEST(GfxLineTest, Gradient) {
+  // same pixels as a solid line, in every direction
+  for (unsigned end_x = 0; end_x <= 10; ++end_x) {
+    for (unsigned end_y = 0; end_y <= 10; ++end_y) {
+      gfx::hdr_image solid(11, 11, gfx::BLACK),
+                     gradient(11, 11, gfx::BLACK);
+      gfx::rasterize_line_segment(solid, 5, 5, end_x, end_y, gfx::WHITE);
+      gfx::rasterize_gradient_line_segment(gradient, 5, 5, end_x, end_y,
+                                           gfx::RED, gfx::BLUE);
+      for (size_t y = 0; y < 11; ++y) {
+        for (size_t x = 0; x < 11; ++x) {
+          EXPECT_EQ(solid.pixel(x, y) == gfx::WHITE,
+                    !(gradient.pixel(x, y) == gfx::BLACK));
+        }
+      }
+      EXPECT_EQ(gfx::RED, gradient.pixel(5, 5));
+      if ((end_x != 5) || (end_y != 5)) {
+        EXPECT_EQ(gfx::BLUE, gradient.pixel(end_x, end_y));
+      }
+    }
+  }
+
+  // colors are interpolated along the major axis
+  gfx::hdr_image image(11, 4, gfx::BLACK);
+  gfx::hdr_rgb start(0.2f, 1.0f, 0.0f), end(0.7f, 0.0f, 1.0f);
+  gfx::rasterize_gradient_line_segment(image, 0, 0, 10, 3, start, end);
+  for (int x = 0; x <= 10; ++x) {
+    // ties round toward the smaller y
+    int y = int(std::ceil((x * 0.3) - 0.5));
+    float t = x / 10.0f;
+    EXPECT_NEAR(0.2f + 0.5f * t, image.pixel(x, y).r(), 1e-6);
+    EXPECT_NEAR(1.0f - t, image.pixel(x, y).g(), 1e-6);
+    EXPECT_NEAR(t, image.pixel(x, y).b(), 1e-6);
+  }
+
+  // clipping keeps the colors of the whole segment
+  gfx::hdr_image clipped(11, 4, gfx::BLACK);
+  gfx::rasterize_gradient_line_segment(clipped, {0, 0}, {10, 3}, start, end,
+                                       gfx::raster_rect{4, 0, 8, 4});
+  for (int y = 0; y < 4; ++y) {
+    for (int x = 0; x < 11; ++x) {
+      EXPECT_EQ(((x >= 4) && (x < 8)) ? image.pixel(x, y) : gfx::BLACK,
+                clipped.pixel(x, y));
+    }
+  }
+}
+
+TEST(GfxLineTest, Patterned) {
+  auto dashes = gfx::line_pattern::from_dashes({3, 2});
+  EXPECT_EQ(5, dashes.period());
+  auto mask = gfx::line_pattern::from_mask(0b00111, 5);
+  for (size_t phase = 0; phase < 12; ++phase) {
+    EXPECT_EQ((phase % 5) < 3, dashes.is_on(phase));
+    EXPECT_EQ(dashes.is_on(phase), mask.is_on(phase));
+  }
+
+  // a solid pattern matches rasterize_line_segment
+  gfx::hdr_image solid(11, 11, gfx::BLACK), patterned(11, 11, gfx::BLACK);
+  gfx::rasterize_line_segment(solid, 1, 2, 10, 7, gfx::WHITE);
+  EXPECT_EQ(0, gfx::rasterize_patterned_line_segment(
+                 patterned, {1, 2}, {10, 7}, gfx::WHITE,
+                 gfx::line_pattern::solid()));
+  EXPECT_EQ(solid, patterned);
+
+  // dashes along a row, starting part way into the pattern
+  gfx::hdr_image row(12, 1, gfx::BLACK);
+  EXPECT_EQ((2 + 12) % 5,
+            gfx::rasterize_patterned_line_segment(row, {0, 0}, {11, 0},
+                                                  gfx::WHITE, dashes, 2));
+  for (int x = 0; x < 12; ++x) {
+    EXPECT_EQ(dashes.is_on(x + 2) ? gfx::WHITE : gfx::BLACK,
+              row.pixel(x, 0));
+  }
+
+  // the phase carries around the corners of a polyline, and each joint
+  // advances the pattern once
+  gfx::hdr_image image(8, 8, gfx::BLACK);
+  std::vector<gfx::raster_point> points{{0, 0}, {7, 0}, {7, 7}, {0, 7}};
+  EXPECT_EQ(22 % 5, gfx::rasterize_patterned_polyline(image, points,
+                                                      gfx::WHITE, dashes));
+  size_t phase = 0;
+  auto expect = [&](int x, int y) {
+    EXPECT_EQ(dashes.is_on(phase++) ? gfx::WHITE : gfx::BLACK,
+              image.pixel(x, y));
+  };
+  for (int x = 0; x <= 7; ++x) {
+    expect(x, 0);
+  }
+  for (int y = 1; y <= 7; ++y) {
+    expect(7, y);
+  }
+  for (int x = 6; x >= 0; --x) {
+    expect(x, 7);
+  }
+}
+
+TEST(GfxCanvasTest, Lines) {
+  gfx::hdr_image image(20, 20, gfx::BLACK), expected(20, 20, gfx::BLACK);
+  {
+    gfx::canvas canvas(image);
+    canvas.set_color(gfx::RED);
+    canvas.translate(2, 3);
+    canvas.scale(2, 2);
+    canvas.line(0, 0, 4, 1);
+    canvas.line(1, 5, 1, 1);
+    EXPECT_EQ(2, canvas.queued());
+    EXPECT_TRUE(image.is_every_pixel(gfx::BLACK));
+
+    // changing state draws the queue with the old state
+    canvas.set_color(gfx::BLUE);
+    EXPECT_EQ(0, canvas.queued());
+    gfx::rasterize_line_segment(expected, 2, 3, 10, 5, gfx::RED);
+    gfx::rasterize_line_segment(expected, 4, 13, 4, 5, gfx::RED);
+    EXPECT_EQ(expected, image);
+
+    // clipped, and partly outside the image
+    canvas.save();
+    canvas.set_transform(gfx::affine_transform::identity());
+    canvas.set_clip(gfx::raster_rect{5, 0, 30, 12});
+    canvas.line(-5, 8, 25, 8);
+    canvas.line(0, 0, 3, 3);
+    canvas.line(-3, 23, 26, 1);
+    canvas.line(14, -9, 7, 30);
+    canvas.restore();
+    gfx::rasterize_line_segment(expected, {-5, 8}, {25, 8}, gfx::BLUE,
+                                gfx::raster_rect{5, 0, 20, 12});
+    gfx::rasterize_line_segment(expected, {-3, 23}, {26, 1}, gfx::BLUE,
+                                gfx::raster_rect{5, 0, 20, 12});
+    gfx::rasterize_line_segment(expected, {14, -9}, {7, 30}, gfx::BLUE,
+                                gfx::raster_rect{5, 0, 20, 12});
+    EXPECT_EQ(20, canvas.clip().x_max - canvas.clip().x_min);
+    EXPECT_EQ(20, canvas.clip().y_max - canvas.clip().y_min);
+
+    // restored state applies again
+    canvas.line(0, 7, 1, 7);
+  }
+  gfx::rasterize_line_segment(expected, 2, 17, 4, 17, gfx::BLUE);
+  EXPECT_EQ(expected, image);
+}
+
+TEST(GfxCanvasTest, FillsAndBlending) {
+  gfx::hdr_image image(16, 16, gfx::BLACK), expected(16, 16, gfx::BLACK);
+  {
+    gfx::canvas canvas(image);
+    canvas.set_color(gfx::hdr_rgb(0.5f, 0.25f, 0.0f));
+    canvas.translate(1, 1);
+    canvas.fill_rect(0, 0, 4, 3);
+    gfx::fill_rect(expected, gfx::raster_rect{1, 1, 5, 4},
+                   gfx::hdr_rgb(0.5f, 0.25f, 0.0f));
+    EXPECT_EQ(expected, image);
+
+    // overlapping fills add up
+    canvas.set_blend(gfx::blend_mode::add);
+    canvas.fill_rect(2, 0, 4, 3);
+    canvas.line(0, 5, 5, 5);
+    canvas.line(0, 5, 2, 5);
+  }
+  EXPECT_EQ(gfx::hdr_rgb(0.5f, 0.25f, 0.0f), image.pixel(2, 1));
+  EXPECT_EQ(gfx::hdr_rgb(1.0f, 0.5f, 0.0f), image.pixel(3, 1));
+  EXPECT_EQ(gfx::hdr_rgb(0.5f, 0.25f, 0.0f), image.pixel(6, 3));
+  EXPECT_EQ(gfx::hdr_rgb(1.0f, 0.5f, 0.0f), image.pixel(2, 6));
+  EXPECT_EQ(gfx::hdr_rgb(0.5f, 0.25f, 0.0f), image.pixel(5, 6));
+
+  EXPECT_EQ(gfx::hdr_rgb(0.25f, 0.5f, 1.0f),
+            gfx::blend_colors(gfx::hdr_rgb(0.5f, 1.0f, 1.0f),
+                              gfx::hdr_rgb(0.5f, 0.5f, 1.0f),
+                              gfx::blend_mode::multiply));
+  EXPECT_EQ(gfx::hdr_rgb(0.75f, 1.0f, 0.5f),
+            gfx::blend_colors(gfx::hdr_rgb(0.5f, 1.0f, 0.0f),
+                              gfx::hdr_rgb(0.5f, 0.0f, 0.5f),
+                              gfx::blend_mode::screen));
+
+  // a rotated rectangle is filled as a polygon
+  gfx::hdr_image rotated(16, 16, gfx::BLACK), polygon(16, 16, gfx::BLACK);
+  {
+    gfx::canvas canvas(rotated);
+    canvas.translate(8, 2);
+    canvas.rotate(float(M_PI / 4));
+    canvas.fill_rect(0, 0, 8, 8);
+  }
+  gfx::fill_polygon(polygon,
+                    std::vector<gfx::raster_point>{{8, 2}, {14, 8},
+                                                   {8, 13}, {2, 8}},
+                    gfx::WHITE);
+  EXPECT_EQ(polygon, rotated);
+}
+
+TEST(GfxTransformTest, Quantize) {
+  using gfx::rounding_mode;
+  using gfx::detail::quantize;
+  const float lo = -100.0f, hi = 100.0f;
+  EXPECT_EQ(2, quantize(2.5f, rounding_mode::nearest_even, lo, hi));
+  EXPECT_EQ(3, quantize(2.5f, rounding_mode::nearest_up, lo, hi));
+  EXPECT_EQ(-2, quantize(-2.5f, rounding_mode::nearest_up, lo, hi));
+  EXPECT_EQ(-3, quantize(-2.5f, rounding_mode::down, lo, hi));
+  EXPECT_EQ(-2, quantize(-2.5f, rounding_mode::up, lo, hi));
+  EXPECT_EQ(-2, quantize(-2.5f, rounding_mode::toward_zero, lo, hi));
+  EXPECT_EQ(100, quantize(1e30f, rounding_mode::nearest_even, lo, hi));
+  EXPECT_EQ(-100, quantize(-INFINITY, rounding_mode::nearest_even, lo, hi));
+  EXPECT_EQ(100, quantize(NAN, rounding_mode::down, lo, hi));
+}
+
+TEST(GfxTransformTest, BatchMatchesScalar) {
+  // enough points to exercise every vector width and a scalar remainder
+  const size_t count = 16 * 3 + 5;
+  std::vector<float> xs(count), ys(count);
+  for (size_t i = 0; i < count; ++i) {
+    xs[i] = (float(i) * 0.75f) - 20.0f;
+    ys[i] = (float(i) * -1.25f) + 0.5f;
+  }
+  xs[7] = NAN;
+  ys[9] = 1e20f;
+
+  auto affine = gfx::affine_transform::translation(3.5f, -2.0f)
+                * gfx::affine_transform::rotation(0.3f);
+  auto projective = gfx::projective_transform::from_affine(affine);
+  projective.m[2][0] = 0.001f;
+  projective.m[2][1] = 0.002f;
+
+  for (auto mode : {gfx::rounding_mode::nearest_even,
+                    gfx::rounding_mode::nearest_up,
+                    gfx::rounding_mode::down,
+                    gfx::rounding_mode::up,
+                    gfx::rounding_mode::toward_zero}) {
+    gfx::quantize_options options;
+    options.rounding = mode;
+    options.x_min = -30;
+    options.x_max = 40;
+    options.y_min = -50;
+    options.y_max = 10;
+
+    std::vector<int> pixel_xs(count), pixel_ys(count);
+    gfx::transform_points(affine, xs.data(), ys.data(), count,
+                          pixel_xs.data(), pixel_ys.data(), options);
+    for (size_t i = 0; i < count; ++i) {
+      // one point at a time always takes the scalar path
+      int x, y;
+      gfx::transform_points(affine, &xs[i], &ys[i], 1, &x, &y, options);
+      EXPECT_EQ(x, pixel_xs[i]);
+      EXPECT_EQ(y, pixel_ys[i]);
+      EXPECT_TRUE((x >= -30) && (x <= 40));
+      EXPECT_TRUE((y >= -50) && (y <= 10));
+    }
+
+    gfx::transform_points(projective, xs.data(), ys.data(), count,
+                          pixel_xs.data(), pixel_ys.data(), options);
+    for (size_t i = 0; i < count; ++i) {
+      int x, y;
+      gfx::transform_points(projective, &xs[i], &ys[i], 1, &x, &y, options);
+      EXPECT_EQ(x, pixel_xs[i]);
+      EXPECT_EQ(y, pixel_ys[i]);
+    }
+  }
+
+  // NaN clamps to the maximum
+  int x, y;
+  gfx::transform_points(affine, &xs[7], &ys[7], 1, &x, &y,
+                        gfx::quantize_options::clamped_to(
+                          gfx::raster_rect{0, 0, 41, 41}));
+  EXPECT_EQ(40, x);
+}
+
+TEST(GfxTransformTest, Segments) {
+  gfx::segment_batch batch;
+  for (unsigned i = 0; i < 20; ++i) {
+    batch.push_back(float(i), 0.0f, float(i), 5.0f);
+  }
+  batch.push_back(-50.0f, 2.0f, 500.0f, 2.0f);
+  ASSERT_EQ(21u, batch.size());
+
+  std::vector<gfx::line_segment> segments;
+  gfx::transform_segments(gfx::affine_transform::scaling(0.5f, 2.0f), batch,
+                          gfx::raster_rect{0, 0, 16, 16}, segments,
+                          gfx::rounding_mode::down);
+  ASSERT_EQ(21u, segments.size());
+  EXPECT_EQ(9u, segments[19].x0);
+  EXPECT_EQ(0u, segments[19].y0);
+  EXPECT_EQ(10u, segments[19].y1);
+  EXPECT_EQ(0u, segments[20].x0);
+  EXPECT_EQ(15u, segments[20].x1);
+  EXPECT_EQ(4u, segments[20].y1);
+
+  gfx::hdr_image image(16, 16, gfx::BLACK), expected(16, 16, gfx::BLACK);
+  gfx::rasterize_line_segments(image, segments, gfx::WHITE);
+  for (unsigned x = 0; x < 10; ++x) {
+    gfx::rasterize_line_segment(expected, x, 0, x, 10, gfx::WHITE);
+  }
+  gfx::rasterize_line_segment(expected, 0, 4, 15, 4, gfx::WHITE);
+  EXPECT_EQ(expected, image);
+
+  batch.clear();
+  EXPECT_TRUE(batch.empty());
+}
+
+TEST(GfxConcurrentTest, HighestSequenceWins) {
+  gfx::concurrent_image image(8, 8, gfx::BLACK);
+  EXPECT_EQ(1u, image.palette_size());
+  EXPECT_EQ(0u, image.sequence(3, 3));
+
+  auto late = image.writer(5), early = image.writer(2);
+  late.pixel(3, 3, gfx::RED);
+  early.pixel(3, 3, gfx::BLUE);
+  early.fill_span(0, 8, 4, gfx::BLUE);
+  EXPECT_EQ(gfx::RED, image.pixel(3, 3));
+  EXPECT_EQ(5u, image.sequence(3, 3));
+  EXPECT_EQ(gfx::BLUE, image.pixel(7, 4));
+  EXPECT_EQ(3u, image.palette_size());
+  EXPECT_EQ(image.intern(gfx::RED), image.intern(gfx::hdr_rgb(1, 0, 0)));
+
+  gfx::hdr_image expected(8, 8, gfx::BLACK);
+  expected.fill_span(0, 8, 4, gfx::BLUE);
+  expected.pixel(3, 3, gfx::RED);
+  EXPECT_EQ(expected, image.to_image());
+}
+
+TEST(GfxConcurrentTest, MatchesSerialDrawing) {
+  const unsigned width = 64, height = 48;
+  const size_t count = 4000;
+  const gfx::hdr_rgb colors[] = {gfx::RED, gfx::LIME, gfx::BLUE, gfx::WHITE,
+                                 gfx::hdr_rgb(0.5f, 0.25f, 0.75f)};
+  std::vector<gfx::line_segment> segments;
+  for (unsigned i = 0; i < count; ++i) {
+    segments.push_back(gfx::line_segment{(i * 37) % width, (i * 11) % height,
+                                         (i * 53) % width, (i * 29) % height});
+  }
+
+  gfx::hdr_image serial(width, height, gfx::SILVER);
+  for (size_t i = 0; i < count; ++i) {
+    auto& s = segments[i];
+    gfx::rasterize_line_segment(serial, s.x0, s.y0, s.x1, s.y1,
+                                colors[i % 5]);
+  }
+
+  // four threads take interleaved segments, so overlaps race constantly
+  gfx::concurrent_image image(width, height, gfx::SILVER);
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t] {
+        auto out = image.writer(1);
+        for (size_t i = t; i < count; i += 4) {
+          auto& s = segments[i];
+          out.set_sequence(uint32_t(i + 1));
+          gfx::rasterize_line_segment(out, s.x0, s.y0, s.x1, s.y1,
+                                      colors[i % 5]);
+        }
+      });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(serial, image.to_image());
+  EXPECT_EQ(6u, image.palette_size());
+
+  // one color, drawn in parallel over the previous result
+  for (size_t i = 0; i < 100; ++i) {
+    auto& s = segments[i];
+    gfx::rasterize_line_segment(serial, s.x0, s.y0, s.x1, s.y1, gfx::BLACK);
+  }
+  gfx::rasterize_line_segments(image,
+                               std::vector<gfx::line_segment>(
+                                 segments.begin(), segments.begin() + 100),
+                               gfx::BLACK, count + 1, 3);
+  EXPECT_EQ(serial, image.to_image());
+}
+
+TEST(GfxConcurrentTest, GradientsFromManyThreads) {
+  // every pixel of a gradient has its own color, so the writers' caches
+  // miss constantly and the threads add to the palette at the same time
+  const unsigned width = 64, height = 48;
+  const size_t count = 600;
+  const gfx::hdr_rgb colors[] = {gfx::RED, gfx::LIME, gfx::BLUE, gfx::WHITE,
+                                 gfx::hdr_rgb(0.5f, 0.25f, 0.75f)};
+  std::vector<gfx::line_segment> segments;
+  for (unsigned i = 0; i < count; ++i) {
+    segments.push_back(gfx::line_segment{(i * 37) % width, (i * 11) % height,
+                                         (i * 53) % width, (i * 29) % height});
+  }
+
+  gfx::hdr_image serial(width, height, gfx::SILVER);
+  for (size_t i = 0; i < count; ++i) {
+    auto& s = segments[i];
+    gfx::rasterize_gradient_line_segment(serial, s.x0, s.y0, s.x1, s.y1,
+                                         colors[i % 5], colors[(i + 2) % 5]);
+  }
+
+  gfx::concurrent_image image(width, height, gfx::SILVER);
+  EXPECT_EQ(gfx::DEFAULT_PALETTE_CAPACITY, image.palette_capacity());
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t] {
+        auto out = image.writer(1);
+        for (size_t i = t; i < count; i += 4) {
+          auto& s = segments[i];
+          out.set_sequence(uint32_t(i + 1));
+          gfx::rasterize_gradient_line_segment(out, s.x0, s.y0, s.x1, s.y1,
+                                               colors[i % 5],
+                                               colors[(i + 2) % 5]);
+        }
+      });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(serial, image.to_image());
+
+  // each distinct color is in the palette exactly once, and there are more
+  // of them than a writer caches
+  std::vector<gfx::hdr_rgb> distinct;
+  for (size_t i = 0; i < count; ++i) {
+    auto& s = segments[i];
+    gfx::hdr_image one(width, height, gfx::SILVER);
+    gfx::rasterize_gradient_line_segment(one, s.x0, s.y0, s.x1, s.y1,
+                                         colors[i % 5], colors[(i + 2) % 5]);
+    for (size_t y = 0; y < height; ++y) {
+      for (size_t x = 0; x < width; ++x) {
+        if (std::find(distinct.begin(), distinct.end(), one.pixel(x, y))
+            == distinct.end()) {
+          distinct.push_back(one.pixel(x, y));
+        }
+      }
+    }
+  }
+  EXPECT_EQ(distinct.size(), image.palette_size());
+  EXPECT_GT(image.palette_size(), 64u);
+}
+
+TEST(GfxLayerTest, SparseLayer) {
+  gfx::sparse_layer layer(100, 50, 16);
+  EXPECT_EQ(7u * 4u, layer.tile_count());
+  EXPECT_EQ(0u, layer.allocated_tile_count());
+  EXPECT_FALSE(layer.covers(5, 5));
+
+  layer.set_sequence(3);
+  gfx::rasterize_line_segment(layer, 0, 0, 20, 0, gfx::RED);
+  EXPECT_EQ(2u, layer.allocated_tile_count());
+  EXPECT_EQ(gfx::RED, layer.pixel(20, 0));
+  EXPECT_EQ(3u, layer.sequence(20, 0));
+
+  // a lower sequence number does not overwrite
+  layer.set_sequence(2);
+  layer.pixel(20, 0, gfx::BLUE);
+  EXPECT_EQ(gfx::RED, layer.pixel(20, 0));
+
+  layer.clear();
+  EXPECT_FALSE(layer.covers(20, 0));
+  EXPECT_EQ(2u, layer.allocated_tile_count());
+}
+
+TEST(GfxLayerTest, CompositeMatchesSerial) {
+  const size_t width = 97, height = 61, count = 3000;
+  const gfx::hdr_rgb palette[] = {gfx::RED, gfx::LIME, gfx::BLUE,
+                                  gfx::hdr_rgb(0.5f, 0.25f, 0.75f)};
+  std::vector<gfx::line_segment> segments;
+  std::vector<gfx::hdr_rgb> colors;
+  for (unsigned i = 0; i < count; ++i) {
+    // most segments crowd into one corner, so tile work is unbalanced
+    unsigned span = (i % 10) ? 12 : width;
+    segments.push_back(gfx::line_segment{(i * 37) % span,
+                                         (i * 11) % std::min(span, 61u),
+                                         (i * 53) % span,
+                                         (i * 29) % std::min(span, 61u)});
+    colors.push_back(palette[i % 4]);
+  }
+
+  gfx::hdr_image serial(width, height, gfx::SILVER);
+  for (size_t i = 0; i < count; ++i) {
+    auto& s = segments[i];
+    gfx::rasterize_line_segment(serial, s.x0, s.y0, s.x1, s.y1, colors[i]);
+  }
+
+  for (unsigned threads : {1u, 3u, 8u}) {
+    gfx::hdr_image layered(width, height, gfx::SILVER);
+    gfx::rasterize_line_segments_layered(layered, segments, colors, threads,
+                                         16);
+    EXPECT_EQ(serial, layered);
+  }
+}
+
+TEST(GfxLayerTest, DirtyTracking) {
+  // one segment in the top left tile, and one across two tiles of the
+  // partial bottom row of tiles
+  std::vector<gfx::line_segment> segments{{1, 1, 10, 3}, {70, 50, 90, 58}};
+  std::vector<gfx::hdr_rgb> colors{gfx::RED, gfx::BLUE};
+  gfx::hdr_image serial(97, 61, gfx::SILVER);
+  for (size_t i = 0; i < segments.size(); ++i) {
+    auto& s = segments[i];
+    gfx::rasterize_line_segment(serial, s.x0, s.y0, s.x1, s.y1, colors[i]);
+  }
+
+  for (unsigned threads : {1u, 4u}) {
+    gfx::hdr_image layered(97, 61, gfx::SILVER);
+    layered.set_dirty_tracking(true);
+    layered.reset_dirty();
+    gfx::rasterize_line_segments_layered(layered, segments, colors, threads,
+                                         16);
+    EXPECT_EQ(serial, layered);
+    EXPECT_TRUE(layered.is_dirty_tracking());
+
+    // each composited tile is dirty as a whole, clipped to the image
+    std::vector<gfx::raster_rect> expected{{0, 0, 16, 16}, {64, 48, 96, 61}};
+    auto rects = layered.dirty_rects();
+    ASSERT_EQ(expected.size(), rects.size());
+    for (size_t i = 0; i < rects.size(); ++i) {
+      EXPECT_EQ(expected[i].x_min, rects[i].x_min);
+      EXPECT_EQ(expected[i].y_min, rects[i].y_min);
+      EXPECT_EQ(expected[i].x_max, rects[i].x_max);
+      EXPECT_EQ(expected[i].y_max, rects[i].y_max);
+    }
+  }
+}
+
+TEST(GfxStepCacheTest, MatchesStepLine) {
+  // a small budget, so patterns are evicted along the way
+  gfx::step_pattern_cache cache(4096);
+  for (int dx = -70; dx <= 70; ++dx) {
+    for (int dy = -70; dy <= 70; ++dy) {
+      std::vector<gfx::raster_point> expected, got;
+      gfx::detail::step_line(100, 200, 100 + dx, 200 + dy, [&](int x, int y) {
+          expected.push_back(gfx::raster_point{x, y});
+        });
+      cache.step(100, 200, 100 + dx, 200 + dy, [&](int x, int y) {
+          got.push_back(gfx::raster_point{x, y});
+        });
+      ASSERT_EQ(expected.size(), got.size());
+      for (size_t i = 0; i < expected.size(); ++i) {
+        ASSERT_EQ(expected[i].x, got[i].x);
+        ASSERT_EQ(expected[i].y, got[i].y);
+      }
+    }
+  }
+  auto& stats = cache.stats();
+  EXPECT_GT(stats.hits, 0u);
+  EXPECT_GT(stats.evictions, 0u);
+  EXPECT_LE(stats.bytes, 4096u);
+
+  // 200-pixel segments are 64-pixel patterns, and beyond
+  gfx::hdr_image image(300, 300, gfx::BLACK), expected(300, 300, gfx::BLACK);
+  gfx::rasterize_line_segment(image, 0, 0, 299, 130, gfx::RED, cache);
+  gfx::rasterize_line_segment(expected, 0, 0, 299, 130, gfx::RED);
+  gfx::rasterize_line_segment(image, 0, 299, 130, 0, gfx::RED, cache);
+  gfx::rasterize_line_segment(expected, 0, 299, 130, 0, gfx::RED);
+  EXPECT_EQ(expected, image);
+}
+
+TEST(GfxStepCacheTest, RepeatedSegments) {
+  gfx::step_pattern_cache cache;
+
+  // the case grid of write_line_segment_cases never touches the cache
+  for (unsigned end_x = 0; end_x <= 10; ++end_x) {
+    for (unsigned end_y = 0; end_y <= 10; ++end_y) {
+      gfx::hdr_image image(11, 11, gfx::SILVER), expected(image);
+      gfx::rasterize_line_segment(image, 5, 5, end_x, end_y, gfx::RED, cache);
+      gfx::rasterize_line_segment(expected, 5, 5, end_x, end_y, gfx::RED);
+      EXPECT_EQ(expected, image);
+    }
+  }
+  EXPECT_EQ(120u, cache.stats().table_hits);
+  EXPECT_EQ(0u, cache.size());
+
+  // hatching: one delta, and its multiples, share one pattern
+  std::vector<gfx::line_segment> hatching;
+  for (unsigned i = 0; i < 40; ++i) {
+    hatching.push_back(gfx::line_segment{i, 0, i + 7 * (1 + i % 3),
+                                         11 * (1 + i % 3)});
+  }
+  gfx::hdr_image image(100, 40, gfx::BLACK), expected(100, 40, gfx::BLACK);
+  gfx::rasterize_line_segments(image, hatching, gfx::WHITE, cache);
+  gfx::rasterize_line_segments(expected, hatching, gfx::WHITE);
+  EXPECT_EQ(expected, image);
+  EXPECT_EQ(1u, cache.size());
+  EXPECT_EQ(1u, cache.stats().misses);
+  EXPECT_EQ(39u, cache.stats().hits);
+
+  cache.reset_stats();
+  EXPECT_EQ(0u, cache.stats().hits);
+  EXPECT_GT(cache.stats().bytes, 0u);
+  cache.clear();
+  EXPECT_EQ(0u, cache.stats().bytes);
+}
+
+TEST(GfxStepCacheTest, RecentHitsAreRecentlyUsed) {
+  // three patterns of one word each, with room for only two
+  auto step_a = [](gfx::step_pattern_cache& cache) {
+    cache.step(0, 0, 7, 3, [](int, int) { });
+  };
+  auto step_b = [](gfx::step_pattern_cache& cache) {
+    cache.step(0, 0, 11, 4, [](int, int) { });
+  };
+  auto step_c = [](gfx::step_pattern_cache& cache) {
+    cache.step(0, 0, 13, 5, [](int, int) { });
+  };
+  gfx::step_pattern_cache sizing;
+  step_a(sizing);
+  gfx::step_pattern_cache cache(2 * sizing.stats().bytes);
+
+  // repeating a, which is answered from the memo of recent deltas, makes
+  // b the least recently used, so c evicts b and a stays cached
+  step_a(cache);
+  step_b(cache);
+  step_a(cache);
+  EXPECT_EQ(1u, cache.stats().hits);
+  step_c(cache);
+  EXPECT_EQ(1u, cache.stats().evictions);
+  step_a(cache);
+  EXPECT_EQ(2u, cache.stats().hits);
+  EXPECT_EQ(3u, cache.stats().misses);
+}
+
+TEST(GfxLinePixelsTest, MatchesDrawing) {
+  for (unsigned end_x = 0; end_x <= 10; ++end_x) {
+    for (unsigned end_y = 0; end_y <= 10; ++end_y) {
+      gfx::hdr_image drawn(11, 11, gfx::BLACK), visited(11, 11, gfx::BLACK);
+      gfx::rasterize_line_segment(drawn, 5, 5, end_x, end_y, gfx::WHITE);
+
+      gfx::line_pixels line(5, 5, end_x, end_y);
+      size_t count = 0;
+      for (gfx::raster_point p : line) {
+        EXPECT_EQ(gfx::BLACK, visited.pixel(p.x, p.y)); // each pixel once
+        visited.pixel(p.x, p.y, gfx::WHITE);
+        ++count;
+      }
+      EXPECT_EQ(drawn, visited);
+      EXPECT_EQ(line.size(), count);
+      EXPECT_EQ(5, (*line.begin()).x);
+    }
+  }
+}
+
+TEST(GfxLinePixelsTest, ForwardRange) {
+  gfx::line_pixels line(-3, 2, 4, -1);
+  EXPECT_EQ(8u, line.size());
+  EXPECT_EQ(8, std::distance(line.begin(), line.end()));
+
+  // a hit test with a standard algorithm, and multiple passes
+  auto hit = std::find_if(line.begin(), line.end(), [](gfx::raster_point p) {
+      return (p.x == 0) && (p.y == 1);
+    });
+  ASSERT_TRUE(hit != line.end());
+  auto after = hit;
+  ++after;
+  EXPECT_EQ(1, (*after).x);
+  EXPECT_EQ(0, (*after).y);
+  EXPECT_EQ(4, std::count_if(line.begin(), line.end(),
+                             [](gfx::raster_point p) { return p.x >= 1; }));
+  auto last = line.begin();
+  std::advance(last, 7);
+  EXPECT_EQ(4, (*last).x);
+  EXPECT_EQ(-1, (*last).y);
+  EXPECT_TRUE(++last == line.end());
+
+  gfx::line_pixels point(7, 7, 7, 7);
+  EXPECT_EQ(1u, point.size());
+}
+
+TEST(GfxSpatialTest, ClosedFormMatchesStepping) {
+  for (int dx = -40; dx <= 40; ++dx) {
+    for (int dy = -40; dy <= 40; ++dy) {
+      gfx::line_segment segment{50, 60, unsigned(50 + dx), unsigned(60 + dy)};
+      gfx::hdr_image image(100, 110, gfx::BLACK);
+      gfx::rasterize_line_segment(image, segment.x0, segment.y0,
+                                  segment.x1, segment.y1, gfx::WHITE);
+      for (int y = 15; y < 105; ++y) {
+        for (int x = 5; x < 95; ++x) {
+          ASSERT_EQ(image.pixel(x, y) == gfx::WHITE,
+                    gfx::line_segment_covers(segment, x, y));
+        }
+      }
+      // a rectangle around one pixel is crossed iff the pixel is covered
+      EXPECT_EQ(image.pixel(52, 61) == gfx::WHITE,
+                gfx::line_segment_crosses(segment,
+                                          gfx::raster_rect{52, 61, 53, 62}));
+    }
+  }
+}
+
+TEST(GfxSpatialTest, QueriesMatchBruteForce) {
+  const unsigned width = 200, height = 150;
+  std::vector<gfx::line_segment> segments;
+  for (unsigned i = 0; i < 500; ++i) {
+    unsigned x0 = (i * 37) % width, y0 = (i * 11) % height;
+    unsigned length = (i % 7) ? 10 : 150;
+    segments.push_back(gfx::line_segment{
+        x0, y0,
+        std::min(width - 1, x0 + (i * 13) % length),
+        (i % 2) ? std::min(height - 1, y0 + (i * 5) % length)
+                : y0 - std::min(y0, (i * 3) % length)});
+  }
+
+  gfx::segment_grid grid(width, height, segments, 16);
+  gfx::segment_grid parallel(width, height, segments, 16, 4);
+  EXPECT_EQ(grid.entry_count(), parallel.entry_count());
+
+  for (unsigned y = 0; y < height; y += 3) {
+    for (unsigned x = 0; x < width; x += 2) {
+      std::vector<size_t> expected;
+      for (size_t i = 0; i < segments.size(); ++i) {
+        for (gfx::raster_point p : gfx::line_pixels(segments[i].x0,
+                                                    segments[i].y0,
+                                                    segments[i].x1,
+                                                    segments[i].y1)) {
+          if ((p.x == int(x)) && (p.y == int(y))) {
+            expected.push_back(i);
+            break;
+          }
+        }
+      }
+      ASSERT_EQ(expected, grid.hit_test(x, y));
+      ASSERT_EQ(expected, parallel.hit_test(x, y));
+    }
+  }
+
+  gfx::raster_rect rect{40, 30, 75, 52};
+  std::vector<size_t> expected;
+  for (size_t i = 0; i < segments.size(); ++i) {
+    for (gfx::raster_point p : gfx::line_pixels(segments[i].x0,
+                                                segments[i].y0,
+                                                segments[i].x1,
+                                                segments[i].y1)) {
+      if (rect.contains(p.x, p.y)) {
+        expected.push_back(i);
+        break;
+      }
+    }
+  }
+  EXPECT_FALSE(expected.empty());
+  EXPECT_EQ(expected, grid.query(rect));
+  EXPECT_EQ(expected, parallel.query(rect));
+  EXPECT_TRUE(grid.query(gfx::raster_rect{300, 300, 400, 400}).empty());
+
+  // redrawing a dirty viewport restores exactly what was there
+  gfx::hdr_image full(width, height, gfx::BLACK);
+  gfx::rasterize_line_segments(full, segments, gfx::WHITE);
+  gfx::hdr_image damaged(full);
+  gfx::fill_rect(damaged, rect, gfx::BLACK);
+  grid.redraw(damaged, rect, gfx::WHITE);
+  EXPECT_EQ(full, damaged);
+}
+
+TEST(GfxExportTest, AsyncFrames) {
+  std::vector<gfx::hdr_image> expected;
+  std::vector<std::future<bool>> results;
+  {
+    gfx::png_export_queue queue(2, 2);
+    EXPECT_EQ(2u, queue.max_backlog());
+    for (unsigned frame = 0; frame < 6; ++frame) {
+      gfx::hdr_image image(40, 30, gfx::SILVER);
+      gfx::rasterize_line_segment(image, 0, frame, 39, 29 - frame, gfx::RED);
+      expected.push_back(image);
+      results.push_back(queue.submit(std::move(image),
+                                     "export-" + std::to_string(frame)
+                                     + ".png"));
+      EXPECT_LE(queue.backlog(), 2u);
+    }
+
+    // a file that cannot be created fails its own frame only
+    results.push_back(queue.submit(gfx::hdr_image(4, 4, gfx::BLACK),
+                                   "no-such-directory/export.png"));
+    queue.wait();
+    EXPECT_EQ(0u, queue.backlog());
+  }
+
+  for (unsigned frame = 0; frame < 6; ++frame) {
+    EXPECT_TRUE(results[frame].get());
+    std::string path = "export-" + std::to_string(frame) + ".png";
+    auto loaded = gfx::read_png(path);
+    ASSERT_TRUE(loaded);
+    EXPECT_EQ(expected[frame], *loaded);
+    std::remove(path.c_str());
+  }
+  EXPECT_FALSE(results.back().get());
+}
+
+TEST(GfxExportTest, CowSnapshot) {
+  gfx::cow_image canvas(32, 32, gfx::BLACK, 8);
+  gfx::rasterize_line_segment(canvas, 0, 0, 31, 31, gfx::WHITE);
+  gfx::hdr_image before = canvas.to_image();
+
+  std::future<bool> result;
+  {
+    gfx::png_export_queue queue;
+    result = queue.submit(canvas, "export-cow.png");
+    // drawing continues into the live canvas while the snapshot encodes
+    gfx::rasterize_line_segment(canvas, 31, 0, 0, 31, gfx::RED);
+  }
+  EXPECT_TRUE(result.get());
+  auto loaded = gfx::read_png("export-cow.png");
+  ASSERT_TRUE(loaded);
+  EXPECT_EQ(before, *loaded);
+  std::remove("export-cow.png");
+
+  auto bytes = gfx::encode_png(before);
+  ASSERT_TRUE(bytes);
+  EXPECT_EQ(std::string("\x89PNG", 4), bytes->substr(0, 4));
+}
+
+TEST(GfxLoadTest, ReadPngs) {
+  std::vector<gfx::hdr_image> expected;
+  std::vector<std::string> paths;
+  for (unsigned i = 0; i < 7; ++i) {
+    gfx::hdr_image image(5 + i, 3 + i, gfx::BLACK);
+    gfx::rasterize_line_segment(image, 0, 0, 4 + i, 2 + i, gfx::WHITE);
+    std::string path = "load-" + std::to_string(i) + ".png";
+    ASSERT_TRUE(gfx::write_png(image, path));
+    expected.push_back(image);
+    paths.push_back(path);
+  }
+  // errors are reported per file, in place
+  paths.insert(paths.begin() + 3, "<nonexistent>.png");
+  expected.insert(expected.begin() + 3, gfx::hdr_image());
+
+  for (unsigned thread_count : {1u, 2u, 3u, 16u}) {
+    auto results = gfx::read_pngs(paths, thread_count);
+    ASSERT_EQ(paths.size(), results.size());
+    for (size_t i = 0; i < paths.size(); ++i) {
+      if (expected[i].is_empty()) {
+        EXPECT_FALSE(results[i]);
+      } else {
+        ASSERT_TRUE(results[i]);
+        EXPECT_EQ(expected[i], *results[i]);
+        EXPECT_EQ(*gfx::read_png(paths[i]), *results[i]);
+      }
+    }
+  }
+  EXPECT_TRUE(gfx::read_pngs({}, 4).empty());
+  EXPECT_FALSE(gfx::decode_png("not a png"));
+
+  for (auto& path : paths) {
+    std::remove(path.c_str());
+  }
+}
+
+namespace {
+
+// An image that exercises every QOI chunk: long runs, repeated colors,
+// small and medium differences, and unrelated colors.
+gfx::hdr_image make_codec_test_image(size_t width, size_t height) {
+  gfx::hdr_image image(width, height, gfx::BLACK);
+  for (size_t y = 0; y < height; ++y) {
+    for (size_t x = 0; x < width; ++x) {
+      unsigned r = 0, g = 0, b = 0;
+      switch (y % 4) {
+      case 0:  r = g = b = 200; break;                   // runs
+      case 1:  r = x % 3; g = (x % 3) * 2; b = 1; break; // index, diff
+      case 2:  r = 100 + (x * 5) % 40; g = 90 + (x * 7) % 50;
+               b = 80 + (x * 3) % 30; break;              // luma
+      default: r = (x * 97) % 256; g = (x * 31 + y) % 256;
+               b = (x * 211) % 256; break;                // rgb
+      }
+      image.pixel(x, y, gfx::hdr_rgb::from_bytes(r, g, b));
+    }
+  }
+  return image;
+}
+
+} // namespace
+
+TEST(GfxCodecTest, Qoi) {
+  // a single pixel equal to the initial previous color is one run chunk
+  auto bytes = gfx::encode_qoi(gfx::hdr_image(1, 1, gfx::BLACK));
+  EXPECT_EQ(std::string("qoif\0\0\0\1\0\0\0\1\3\0\xc0"
+                        "\0\0\0\0\0\0\0\1", 23),
+            bytes);
+
+  for (size_t width : {1u, 7u, 100u}) {
+    auto image = make_codec_test_image(width, 9);
+    gfx::rgb8_image bytes8(image);
+    EXPECT_EQ(image, bytes8.to_hdr());
+
+    auto encoded = gfx::encode_qoi(image);
+    EXPECT_EQ(encoded, gfx::encode_qoi(bytes8));
+    EXPECT_LT(encoded.size(), 14 + (width * 9 * 3) + 8);
+    auto decoded = gfx::decode_qoi(encoded);
+    ASSERT_TRUE(decoded);
+    EXPECT_EQ(image, *decoded);
+    auto decoded8 = gfx::decode_qoi<gfx::rgb8_image>(encoded);
+    ASSERT_TRUE(decoded8);
+    EXPECT_EQ(bytes8, *decoded8);
+  }
+
+  auto image = make_codec_test_image(64, 64);
+  ASSERT_TRUE(gfx::write_qoi(image, "codec.qoi"));
+  auto read = gfx::read_qoi("codec.qoi");
+  ASSERT_TRUE(read);
+  EXPECT_EQ(image, *read);
+  std::remove("codec.qoi");
+
+  // malformed files
+  EXPECT_FALSE(gfx::read_qoi("<nonexistent>.qoi"));
+  EXPECT_FALSE(gfx::decode_qoi(""));
+  EXPECT_FALSE(gfx::decode_qoi(gfx::encode_ppm(image)));
+  auto truncated = gfx::encode_qoi(image);
+  truncated.erase(truncated.size() - 100, 50);
+  EXPECT_FALSE(gfx::decode_qoi(truncated));
+  auto huge = gfx::encode_qoi(image);
+  huge[4] = '\x7f';
+  EXPECT_FALSE(gfx::decode_qoi(huge));
+}
+
+TEST(GfxCodecTest, Ppm) {
+  gfx::hdr_image two(2, 1, gfx::RED);
+  two.pixel(1, 0, gfx::BLUE);
+  EXPECT_EQ(std::string("P6\n2 1\n255\n\xff\0\0\0\0\xff", 17),
+            gfx::encode_ppm(two));
+
+  auto image = make_codec_test_image(33, 17);
+  gfx::rgb8_image bytes8(image);
+  auto encoded = gfx::encode_ppm(image);
+  EXPECT_EQ(encoded, gfx::encode_ppm(bytes8));
+  EXPECT_EQ(encoded, gfx::encode_ppm(image, 255));
+  auto decoded = gfx::decode_ppm(encoded);
+  ASSERT_TRUE(decoded);
+  EXPECT_EQ(image, *decoded);
+  auto decoded8 = gfx::decode_ppm<gfx::rgb8_image>(encoded);
+  ASSERT_TRUE(decoded8);
+  EXPECT_EQ(bytes8, *decoded8);
+
+  // 16-bit samples keep intensities that 8 bits cannot
+  gfx::hdr_image fine(3, 2, gfx::hdr_rgb(0.1234f, 0.5f, 0.9876f));
+  auto deep = gfx::decode_ppm(gfx::encode_ppm(fine, 65535));
+  ASSERT_TRUE(deep);
+  EXPECT_TRUE(fine.approx_equal(*deep, 1.0f / 65535));
+  EXPECT_FALSE(fine.approx_equal(*gfx::decode_ppm(gfx::encode_ppm(fine)),
+                                 1.0f / 65535));
+  auto deep8 = gfx::decode_ppm<gfx::rgb8_image>(gfx::encode_ppm(fine, 65535));
+  ASSERT_TRUE(deep8);
+  EXPECT_EQ(31, deep8->row(0)[0]);
+  EXPECT_EQ(127, deep8->row(0)[1]);
+  EXPECT_EQ(252, deep8->row(0)[2]);
+
+  // comments and arbitrary whitespace in the header
+  auto commented = gfx::decode_ppm<gfx::rgb8_image>(
+    std::string("P6 # comment\n 1\t1 # another\n15\n\x0f\x00\x05", 34));
+  ASSERT_TRUE(commented);
+  EXPECT_EQ(255, commented->row(0)[0]);
+  EXPECT_EQ(0, commented->row(0)[1]);
+  EXPECT_EQ(85, commented->row(0)[2]);
+
+  ASSERT_TRUE(gfx::write_ppm(image, "codec.ppm"));
+  auto read = gfx::read_ppm("codec.ppm");
+  ASSERT_TRUE(read);
+  EXPECT_EQ(image, *read);
+  std::remove("codec.ppm");
+
+  // malformed files
+  EXPECT_FALSE(gfx::read_ppm("<nonexistent>.ppm"));
+  EXPECT_FALSE(gfx::decode_ppm("P3\n1 1\n255\n0 0 0\n"));
+  EXPECT_FALSE(gfx::decode_ppm("P6\n0 1\n255\n"));
+  EXPECT_FALSE(gfx::decode_ppm("P6\n1 1\n70000\n\0\0\0\0\0\0"));
+  EXPECT_FALSE(gfx::decode_ppm(encoded.substr(0, encoded.size() - 1)));
+  EXPECT_FALSE(gfx::decode_ppm("P6\n99999999999 1\n255\n"));
+}
+
+TEST(GfxHalfTest, Conversion) {
+  auto bits = [](float value) { return gfx::half(value).bits(); };
+  EXPECT_EQ(0x0000, bits(0.0f));
+  EXPECT_EQ(0x8000, bits(-0.0f));
+  EXPECT_EQ(0x3c00, bits(1.0f));
+  EXPECT_EQ(0xc000, bits(-2.0f));
+  EXPECT_EQ(0x3555, bits(1.0f / 3.0f));
+  EXPECT_EQ(0x7bff, bits(65504.0f));
+  EXPECT_EQ(0x7bff, bits(65519.0f));
+  EXPECT_EQ(0x7c00, bits(65520.0f));
+  EXPECT_EQ(0x7c00, bits(1e10f));
+  EXPECT_EQ(0xfc00, bits(-std::numeric_limits<float>::infinity()));
+  EXPECT_EQ(0x7e00, bits(std::numeric_limits<float>::quiet_NaN()));
+  // ties round to even
+  EXPECT_EQ(0x3c00, bits(1.0f + std::ldexp(1.0f, -11)));
+  EXPECT_EQ(0x3c02, bits(1.0f + (3 * std::ldexp(1.0f, -11))));
+  // subnormals
+  EXPECT_EQ(0x0400, bits(std::ldexp(1.0f, -14)));
+  EXPECT_EQ(0x0001, bits(std::ldexp(1.0f, -24)));
+  EXPECT_EQ(0x0000, bits(std::ldexp(1.0f, -25)));
+  EXPECT_EQ(0x0002, bits(std::ldexp(3.0f, -25)));
+  EXPECT_EQ(0x03ff, bits(std::ldexp(1023.0f, -24)));
+
+  // every half converts to a float and back exactly
+  for (uint32_t b = 0; b <= 0xffff; ++b) {
+    gfx::half h = gfx::half::from_bits(uint16_t(b));
+    bool nan = ((b & 0x7c00) == 0x7c00) && (b & 0x3ff);
+    EXPECT_EQ(nan ? (b | 0x200) : b, gfx::half(h.to_float()).bits());
+  }
+
+  // the row conversions agree with the scalar ones, whichever instructions
+  // they use
+  std::vector<float> floats;
+  for (uint64_t b = 0; b <= UINT32_MAX; b += 65521) {
+    floats.push_back(gfx::detail::bits_float(uint32_t(b)));
+  }
+  std::vector<gfx::half> halves(floats.size());
+  gfx::floats_to_halves(floats.data(), halves.data(), floats.size());
+  std::vector<float> back(floats.size());
+  gfx::halves_to_floats(halves.data(), back.data(), halves.size());
+  for (size_t i = 0; i < floats.size(); ++i) {
+    gfx::half expected(floats[i]);
+    ASSERT_EQ(expected.bits(), halves[i].bits()) << floats[i];
+    ASSERT_EQ(gfx::detail::float_bits(expected.to_float()),
+              gfx::detail::float_bits(back[i]));
+  }
+}
+
+TEST(GfxHalfTest, Image) {
+  gfx::hdr_image hdr(37, 5, gfx::SILVER);
+  gfx::rasterize_line_segment(hdr, 0, 0, 36, 4, gfx::RED);
+  gfx::half_image halves(hdr);
+  EXPECT_EQ(37u, halves.width());
+  EXPECT_EQ(5u, halves.height());
+  // intensities in [0.5, 1] are within half of a half's spacing there
+  EXPECT_TRUE(hdr.approx_equal(halves.to_hdr(), 1.0f / 4096));
+  EXPECT_EQ(gfx::RED, halves.to_hdr().pixel(0, 0));
+
+  // drawing into a half_image matches drawing into an hdr_image
+  auto& silver = gfx::SILVER;
+  gfx::half_image drawn(37, 5,
+                        gfx::float_rgb{silver.r(), silver.g(), silver.b()});
+  gfx::rasterize_line_segment(drawn, 0, 0, 36, 4, gfx::RED);
+  EXPECT_EQ(halves, drawn);
+
+  // intensities outside [0, 1] are kept, and clamped only on conversion
+  gfx::half_image bright(2, 2);
+  bright.pixel(1, 1, gfx::float_rgb{4.5f, -0.25f, 1000.0f});
+  EXPECT_EQ((gfx::float_rgb{4.5f, -0.25f, 1000.0f}), bright.pixel(1, 1));
+  EXPECT_EQ((gfx::float_rgb{0.0f, 0.0f, 0.0f}), bright.pixel(0, 1));
+  EXPECT_EQ(gfx::hdr_rgb(1.0f, 0.0f, 1.0f), bright.to_hdr().pixel(1, 1));
+
+  std::vector<float> row(6);
+  bright.load_row(1, row.data());
+  EXPECT_EQ((std::vector<float>{0.0f, 0.0f, 0.0f, 4.5f, -0.25f, 1000.0f}),
+            row);
+  row[0] = 2.0f;
+  bright.store_row(0, row.data());
+  EXPECT_EQ(2.0f, bright.pixel(0, 0).r);
+}
+
+TEST(GfxHalfTest, Pfm) {
+  gfx::half_image image(5, 3);
+  for (size_t y = 0; y < 3; ++y) {
+    for (size_t x = 0; x < 5; ++x) {
+      image.pixel(x, y, gfx::float_rgb{float(x) * 100.0f, float(y) / 3.0f,
+                                       -1.0f / float(x + 1)});
+    }
+  }
+
+  auto bytes = gfx::encode_pfm(image);
+  EXPECT_EQ(std::string(gfx::detail::is_little_endian() ? "PF\n5 3\n-1.0\n"
+                                                        : "PF\n5 3\n1.0\n"),
+            bytes.substr(0, bytes.size() - (5 * 3 * 12)));
+  // the bottom row is stored first
+  float first;
+  std::memcpy(&first, &bytes[bytes.size() - (5 * 3 * 12) + 4], 4);
+  EXPECT_EQ(image.pixel(0, 2).g, first);
+
+  auto decoded = gfx::decode_pfm(bytes);
+  ASSERT_TRUE(decoded);
+  EXPECT_EQ(image, *decoded);
+  auto clamped = gfx::decode_pfm<gfx::hdr_image>(bytes);
+  ASSERT_TRUE(clamped);
+  EXPECT_EQ(image.to_hdr(), *clamped);
+
+  // hdr_image pixels are stored as they are
+  gfx::hdr_image hdr(4, 4, gfx::hdr_rgb(0.1f, 0.2f, 0.3f));
+  auto hdr_decoded = gfx::decode_pfm<gfx::hdr_image>(gfx::encode_pfm(hdr));
+  ASSERT_TRUE(hdr_decoded);
+  EXPECT_EQ(hdr, *hdr_decoded);
+
+  // the opposite byte order, and grayscale
+  std::string swapped = gfx::detail::is_little_endian() ? "Pf\n2 1\n1.0\n"
+                                                        : "Pf\n2 1\n-1.0\n";
+  swapped += std::string("\x3f\x80\x00\x00\x40\x00\x00\x00", 8);
+  if (!gfx::detail::is_little_endian()) {
+    swapped.replace(swapped.size() - 8, 8,
+                    std::string("\x00\x00\x80\x3f\x00\x00\x00\x40", 8));
+  }
+  auto gray = gfx::decode_pfm(swapped);
+  ASSERT_TRUE(gray);
+  EXPECT_EQ((gfx::float_rgb{1.0f, 1.0f, 1.0f}), gray->pixel(0, 0));
+  EXPECT_EQ((gfx::float_rgb{2.0f, 2.0f, 2.0f}), gray->pixel(1, 0));
+
+  ASSERT_TRUE(gfx::write_pfm(image, "half.pfm"));
+  auto read = gfx::read_pfm("half.pfm");
+  ASSERT_TRUE(read);
+  EXPECT_EQ(image, *read);
+  std::remove("half.pfm");
+
+  // malformed files
+  EXPECT_FALSE(gfx::read_pfm("<nonexistent>.pfm"));
+  EXPECT_FALSE(gfx::decode_pfm("P6\n1 1\n255\n\0\0\0"));
+  EXPECT_FALSE(gfx::decode_pfm("PF\n1 1\n0.0\n............"));
+  EXPECT_FALSE(gfx::decode_pfm("PF\n1 1\nscale\n............"));
+  EXPECT_FALSE(gfx::decode_pfm(bytes.substr(0, bytes.size() - 1)));
+}
+
+TEST(GfxPngTest, IndexedColorMode) {
+  // an image with count distinct colors
+  auto make_image = [](unsigned count) {
+    gfx::hdr_image image(40, 20, gfx::BLACK);
+    for (unsigned i = 0; i < (40 * 20); ++i) {
+      unsigned color = i % count;
+      image.pixel(i % 40, i / 40,
+                  gfx::hdr_rgb::from_bytes(color % 256, color / 256, 7));
+    }
+    return image;
+  };
+
+  // bit depth and color type from the IHDR chunk
+  auto header = [](const std::string& bytes) {
+    return std::make_pair(int(uint8_t(bytes[24])), int(uint8_t(bytes[25])));
+  };
+  const int PALETTE = 3, RGB = 2;
+
+  struct expectation { unsigned colors; int depth, color_type; };
+  for (auto e : {expectation{1, 1, PALETTE}, expectation{2, 1, PALETTE},
+                 expectation{3, 2, PALETTE}, expectation{4, 2, PALETTE},
+                 expectation{5, 4, PALETTE}, expectation{16, 4, PALETTE},
+                 expectation{17, 8, PALETTE}, expectation{256, 8, PALETTE},
+                 expectation{257, 8, RGB}, expectation{800, 8, RGB}}) {
+    auto image = make_image(e.colors);
+    auto indexed = gfx::encode_png(image, gfx::png_color_mode::automatic),
+         truecolor = gfx::encode_png(image);
+    ASSERT_TRUE(indexed);
+    ASSERT_TRUE(truecolor);
+    EXPECT_EQ(std::make_pair(e.depth, e.color_type), header(*indexed))
+      << e.colors;
+    EXPECT_EQ(std::make_pair(8, RGB), header(*truecolor));
+    auto decoded = gfx::decode_png(*indexed);
+    ASSERT_TRUE(decoded);
+    EXPECT_EQ(image, *decoded);
+  }
+
+  // drawings in a few colors make smaller files
+  gfx::hdr_image drawing(256, 256, gfx::SILVER);
+  for (unsigned i = 0; i < 64; ++i) {
+    gfx::rasterize_line_segment(drawing, (i * 37) % 256, (i * 11) % 256,
+                                (i * 101) % 256, (i * 53) % 256,
+                                (i % 2) ? gfx::RED : gfx::NAVY);
+  }
+  auto small = gfx::encode_png(drawing, gfx::png_color_mode::automatic);
+  ASSERT_TRUE(small);
+  EXPECT_EQ(std::make_pair(2, PALETTE), header(*small));
+  EXPECT_LT(small->size(), gfx::encode_png(drawing)->size());
+
+  // the same, through files
+  gfx::hdr_image cases(11, 11, gfx::SILVER);
+  gfx::rasterize_line_segment(cases, 5, 5, 10, 2, gfx::RED);
+  ASSERT_TRUE(gfx::write_png(cases, "indexed.png",
+                             gfx::png_color_mode::automatic));
+  auto read = gfx::read_png("indexed.png");
+  ASSERT_TRUE(read);
+  EXPECT_EQ(cases, *read);
+  std::remove("indexed.png");
+  EXPECT_FALSE(gfx::write_png(cases, "no-such-directory/indexed.png",
+                              gfx::png_color_mode::automatic));
+}
+
 /*
 TEST(single_pixel, single_pixel) {
   hdr_image img(3, 3, BLACK);